@@ -0,0 +1,72 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+void BVH::build(std::vector< Item > items_) {
+	items = std::move(items_);
+	nodes.clear();
+	if (items.empty()) return;
+	nodes.reserve(2 * (items.size() / LeafSize + 1));
+	build_node(0, uint32_t(items.size()));
+}
+
+uint32_t BVH::build_node(uint32_t begin, uint32_t end) {
+	assert(begin < end);
+	uint32_t index = uint32_t(nodes.size());
+	nodes.emplace_back();
+
+	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	glm::vec3 center_min = min;
+	glm::vec3 center_max = max;
+	for (uint32_t i = begin; i < end; ++i) {
+		min = glm::min(min, items[i].min);
+		max = glm::max(max, items[i].max);
+		glm::vec3 center = 0.5f * (items[i].min + items[i].max);
+		center_min = glm::min(center_min, center);
+		center_max = glm::max(center_max, center);
+	}
+	nodes[index].min = min;
+	nodes[index].max = max;
+
+	if (end - begin <= LeafSize) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return index;
+	}
+
+	//split at the median center along the axis where centers are most spread out:
+	glm::vec3 extent = center_max - center_min;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [axis](Item const &a, Item const &b) {
+		return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+	});
+
+	build_node(begin, mid);
+	uint32_t right = build_node(mid, end);
+	//(n.b. 'nodes' may have been reallocated by the recursive calls)
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+bool BVH::ray_hits_box(glm::vec3 const &origin, glm::vec3 const &inv_direction, float t_max, glm::vec3 const &min, glm::vec3 const &max, float *t_enter) {
+	//slab test:
+	float t0 = 0.0f;
+	float t1 = t_max;
+	for (int a = 0; a < 3; ++a) {
+		float t_near = (min[a] - origin[a]) * inv_direction[a];
+		float t_far = (max[a] - origin[a]) * inv_direction[a];
+		if (t_near > t_far) std::swap(t_near, t_far);
+		//(NaN from 0 * inf -- ray parallel to and on a slab boundary -- leaves t0/t1 unchanged)
+		if (t_near > t0) t0 = t_near;
+		if (t_far < t1) t1 = t_far;
+		if (t0 > t1) return false;
+	}
+	*t_enter = t0;
+	return true;
+}
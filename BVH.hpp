@@ -0,0 +1,155 @@
+#pragma once
+
+/*
+ * "BVH" is a bounding volume hierarchy over a set of axis-aligned boxes.
+ * Items are referred to by caller-supplied ids (e.g., indices into Scene::drawables).
+ *
+ * build() picks a tree shape from the current boxes; refit() keeps that shape
+ *  and only recomputes node bounds, which is much cheaper for a few moving items.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+struct BVH {
+	struct Item {
+		uint32_t id;
+		glm::vec3 min, max;
+	};
+
+	struct Node {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//leaf: items[first, first + count)
+		//internal (count == 0): left child is the next node, right child is nodes[first]
+		uint32_t first = 0;
+		uint32_t count = 0;
+	};
+
+	//nodes in depth-first order (so children always come after their parent):
+	std::vector< Node > nodes;
+	//items in leaf order:
+	std::vector< Item > items;
+
+	//maximum number of items stored in a leaf:
+	enum : uint32_t { LeafSize = 4 };
+
+	//build a new tree over 'items':
+	void build(std::vector< Item > items);
+
+	//recompute node bounds after item boxes changed (tree shape is unchanged):
+	// 'get_bounds(id, &min, &max)' is called once per item to fetch its current box
+	template< typename GetBounds >
+	void refit(GetBounds const &get_bounds);
+
+	//result of testing a box against a query volume:
+	enum Overlap : uint8_t {
+		Outside, //box is entirely outside
+		Intersects, //box may be partly inside
+		Inside //box is entirely inside
+	};
+
+	//call 'fn(id)' for every item whose box is not Outside according to 'test(min, max)':
+	// (test should be conservative; subtrees that are Outside are skipped, and
+	//  subtrees that are Inside are reported without testing their items)
+	template< typename BoxTest, typename Fn >
+	void query(BoxTest const &test, Fn const &fn) const;
+
+	//call 'fn(id, t)' for every item whose box is hit by the ray origin + t * direction, 0 <= t <= t_max:
+	// (t is where the ray enters the item's box; items are not visited in any particular order)
+	template< typename Fn >
+	void ray_query(glm::vec3 const &origin, glm::vec3 const &direction, float t_max, Fn const &fn) const;
+
+	//ray/box helper: returns true and sets *t_enter if the ray hits [min, max] within [0, t_max]:
+	static bool ray_hits_box(glm::vec3 const &origin, glm::vec3 const &inv_direction, float t_max, glm::vec3 const &min, glm::vec3 const &max, float *t_enter);
+
+	size_t size() const { return items.size(); }
+	bool empty() const { return items.empty(); }
+
+private:
+	uint32_t build_node(uint32_t begin, uint32_t end);
+};
+
+//---------------------------------
+
+template< typename GetBounds >
+void BVH::refit(GetBounds const &get_bounds) {
+	for (auto &item : items) {
+		get_bounds(item.id, &item.min, &item.max);
+	}
+	//children come after parents, so walking backward visits children first:
+	for (uint32_t n = uint32_t(nodes.size()); n > 0; --n) {
+		Node &node = nodes[n-1];
+		if (node.count) {
+			node.min = glm::vec3( std::numeric_limits< float >::infinity());
+			node.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				node.min = glm::min(node.min, items[i].min);
+				node.max = glm::max(node.max, items[i].max);
+			}
+		} else {
+			Node const &left = nodes[n];
+			Node const &right = nodes[node.first];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+}
+
+template< typename BoxTest, typename Fn >
+void BVH::query(BoxTest const &test, Fn const &fn) const {
+	if (nodes.empty()) return;
+	uint32_t stack[64];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size) {
+		uint32_t index = stack[--stack_size];
+		Node const &node = nodes[index];
+		Overlap overlap = test(node.min, node.max);
+		if (overlap == Outside) continue;
+		if (overlap == Inside) {
+			//every item in this subtree is inside, and a subtree's items are contiguous (leftmost leaf to rightmost leaf):
+			uint32_t leaf = index;
+			while (nodes[leaf].count == 0) leaf = nodes[leaf].first; //rightmost leaf
+			uint32_t first = index;
+			while (nodes[first].count == 0) first = first + 1; //leftmost leaf
+			for (uint32_t i = nodes[first].first; i < nodes[leaf].first + nodes[leaf].count; ++i) {
+				fn(items[i].id);
+			}
+		} else if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (test(items[i].min, items[i].max) != Outside) fn(items[i].id);
+			}
+		} else {
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = index + 1;
+		}
+	}
+}
+
+template< typename Fn >
+void BVH::ray_query(glm::vec3 const &origin, glm::vec3 const &direction, float t_max, Fn const &fn) const {
+	if (nodes.empty()) return;
+	//n.b. division by zero gives +/-inf here, which the slab test handles:
+	glm::vec3 inv_direction = 1.0f / direction;
+	uint32_t stack[64];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size) {
+		Node const &node = nodes[stack[--stack_size]];
+		float t;
+		if (!ray_hits_box(origin, inv_direction, t_max, node.min, node.max, &t)) continue;
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (ray_hits_box(origin, inv_direction, t_max, items[i].min, items[i].max, &t)) fn(items[i].id, t);
+			}
+		} else {
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = uint32_t(&node - nodes.data()) + 1;
+		}
+	}
+}
@@ -114,6 +114,16 @@ BoneAnimation::BoneAnimation(std::string const &filename) {
 			std::cout << "INFO: bounding box of animation mesh in '" << filename << "' is [" << min.x << "," << max.x << "]x[" << min.y << "," << max.y << "]x[" << min.z << "," << max.z << "]" << std::endl;
 		}
 
+		//keep what skinning needs on the CPU:
+		positions.reserve(data.size());
+		bone_weights.reserve(data.size());
+		bone_indices.reserve(data.size());
+		for (auto const &v : data) {
+			positions.emplace_back(v.Position);
+			bone_weights.emplace_back(v.BoneWeights);
+			bone_indices.emplace_back(v.BoneIndices);
+		}
+
 		//upload data:
 		glGenBuffers(1, &buffer);
 		glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -177,8 +187,15 @@ void BoneAnimationPlayer::update(float elapsed) {
 }
 
 void BoneAnimationPlayer::set_uniform(GLint bones_mat4x3_array) const {
+	std::vector< glm::mat4x3 > bones; //actual uniforms
+	get_bones(&bones);
+	glUniformMatrix4x3fv(bones_mat4x3_array, GLsizei(bones.size()), GL_FALSE, glm::value_ptr(bones[0]));
+}
+
+void BoneAnimationPlayer::get_bones(std::vector< glm::mat4x3 > *bones_) const {
 	std::vector< glm::mat4x3 > bone_to_object(banims.bones.size()); //needed for hierarchy
-	std::vector< glm::mat4x3 > bones(banims.bones.size()); //actual uniforms
+	std::vector< glm::mat4x3 > &bones = *bones_;
+	bones.resize(banims.bones.size());
 
 	int32_t frame = int32_t(std::floor((anim.end - 1 - anim.begin) * position + anim.begin));
 	if (frame < int32_t(anim.begin)) frame = anim.begin;
@@ -206,5 +223,17 @@ void BoneAnimationPlayer::set_uniform(GLint bones_mat4x3_array) const {
 		}
 		bones[b] = bone_to_object[b] * glm::mat4(bone.inverse_bind_matrix);
 	}
-	glUniformMatrix4x3fv(bones_mat4x3_array, GLsizei(bones.size()), GL_FALSE, glm::value_ptr(bones[0]));
+}
+
+void BoneAnimationPlayer::pose_positions(std::vector< glm::vec3 > *positions) const {
+	std::vector< glm::mat4x3 > bones;
+	get_bones(&bones);
+	//same blend as the bone vertex shaders:
+	positions->resize(banims.positions.size());
+	for (size_t i = 0; i < banims.positions.size(); ++i) {
+		glm::vec4 p = glm::vec4(banims.positions[i], 1.0f);
+		glm::vec4 const &w = banims.bone_weights[i];
+		glm::uvec4 const &b = banims.bone_indices[i];
+		(*positions)[i] = (bones[b.x] * p) * w.x + (bones[b.y] * p) * w.y + (bones[b.z] * p) * w.z + (bones[b.w] * p) * w.w;
+	}
 }
@@ -27,6 +27,10 @@ struct BoneAnimation {
 	Attrib BoneWeights;
 	Attrib BoneIndices;
 	Mesh mesh;
+	//CPU-side copies of the skinning inputs (e.g., for posing on the CPU with BoneAnimationPlayer::pose_positions):
+	std::vector< glm::vec3 > positions;
+	std::vector< glm::vec4 > bone_weights;
+	std::vector< glm::uvec4 > bone_indices;
 
 	//Skeleton description:
 	struct Bone {
@@ -89,6 +93,10 @@ struct BoneAnimationPlayer {
 	void update(float elapsed);
 
 	void set_uniform(GLint bones_mat4x3_array) const;
+	//bone-to-object matrices of the current pose (what set_uniform uploads):
+	void get_bones(std::vector< glm::mat4x3 > *bones) const;
+	//skin banims.positions with the current pose:
+	void pose_positions(std::vector< glm::vec3 > *positions) const;
 
 	bool done() const { return (loop_or_once == Once && position >= 1.0f); }
 
@@ -15,7 +15,7 @@ Load< BoneLitColorTextureProgram > bone_lit_color_texture_program(LoadTagEarly,
 	bone_lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
 	bone_lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
     bone_lit_color_texture_program_pipeline.LIGHT_TO_SPOT_mat4 = ret->LIGHT_TO_SPOT_mat4;
-    bone_lit_color_texture_program_pipeline.USES_VERTEX_COLOR = ret->USES_VERTEX_COLOR_bool;
+    bone_lit_color_texture_program_pipeline.Material_block = ret->Material_block;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -101,15 +101,22 @@ BoneLitColorTextureProgram::BoneLitColorTextureProgram() {
         "uniform sampler2D TEX;\n"
         "uniform sampler2D DEPTH_TEX;\n"
         "uniform sampler2DShadow DIRECTIONAL_DEPTH_TEX;\n"
-        "uniform float ROUGHNESS;\n"
-        "uniform uint LIGHTS;\n"
-        "uniform int LIGHT_TYPE[" + std::to_string(MaxLights) + "];\n"
-        "uniform vec3 LIGHT_LOCATION[" + std::to_string(MaxLights) + "];\n"
-         "uniform vec3 LIGHT_DIRECTION[" + std::to_string(MaxLights) + "];\n"
-          "uniform vec3 LIGHT_ENERGY[" + std::to_string(MaxLights) + "];\n"
-          "uniform float LIGHT_CUTOFF[" + std::to_string(MaxLights) + "];\n"
-          "uniform bool USES_VERTEX_COLOR;\n"
-          "uniform vec3 EYE;\n"
+        "struct Light {\n" //see Scene::LightData
+        "	vec3 LOCATION;\n"
+        "	int TYPE;\n"
+        "	vec3 DIRECTION;\n"
+        "	float CUTOFF;\n"
+        "	vec3 ENERGY;\n"
+        "};\n"
+        "layout(std140) uniform Lights {\n"
+        "	vec3 EYE;\n"
+        "	uint LIGHTS;\n"
+        "	Light LIGHT[" + std::to_string(Scene::MaxLights) + "];\n"
+        "};\n"
+          "layout(std140) uniform Material {\n"
+          "	float ROUGHNESS;\n"
+          "	bool USES_VERTEX_COLOR;\n"
+          "};\n"
           "in vec3 position;\n"
           "in vec3 normal;\n"
           "in vec4 color;\n"
@@ -130,11 +137,11 @@ BoneLitColorTextureProgram::BoneLitColorTextureProgram() {
           "   }\n"
           "   if (albedo.a < 0.5) discard;\n"
           "	for (uint light = 0u; light < LIGHTS; ++light) {\n"
-          "		int TYPE = LIGHT_TYPE[light];\n"
-          "		vec3 LOCATION = LIGHT_LOCATION[light];\n"
-          "		vec3 DIRECTION = LIGHT_DIRECTION[light];\n"
-          "		vec3 ENERGY = LIGHT_ENERGY[light];\n"
-          "		float CUTOFF = LIGHT_CUTOFF[light];\n"
+          "		int TYPE = LIGHT[light].TYPE;\n"
+          "		vec3 LOCATION = LIGHT[light].LOCATION;\n"
+          "		vec3 DIRECTION = LIGHT[light].DIRECTION;\n"
+          "		vec3 ENERGY = LIGHT[light].ENERGY;\n"
+          "		float CUTOFF = LIGHT[light].CUTOFF;\n"
           "		vec3 l; //direction to light\n"
           "		vec3 h; //half-vector\n"
           "		vec3 e; //light flux\n"
@@ -203,17 +210,13 @@ BoneLitColorTextureProgram::BoneLitColorTextureProgram() {
 
     LIGHT_TO_SPOT_mat4 = glGetUniformLocation(program, "LIGHT_TO_SPOT");
 
-    ROUGHNESS_float = glGetUniformLocation(program, "ROUGHNESS");
-    EYE_vec3 = glGetUniformLocation(program, "EYE");
-    LIGHTS_uint = glGetUniformLocation(program, "LIGHTS");
+    //lights come from Scene::lights_buffer:
+    Lights_block = glGetUniformBlockIndex(program, "Lights");
+    glUniformBlockBinding(program, Lights_block, Scene::LightsBinding);
 
-    LIGHT_TYPE_int_array = glGetUniformLocation(program, "LIGHT_TYPE");
-    LIGHT_LOCATION_vec3_array = glGetUniformLocation(program, "LIGHT_LOCATION");
-    LIGHT_DIRECTION_vec3_array = glGetUniformLocation(program, "LIGHT_DIRECTION");
-    LIGHT_ENERGY_vec3_array = glGetUniformLocation(program, "LIGHT_ENERGY");
-    LIGHT_CUTOFF_float_array = glGetUniformLocation(program, "LIGHT_CUTOFF");
-
-    USES_VERTEX_COLOR_bool = glGetUniformLocation(program, "USES_VERTEX_COLOR");
+    //material parameters come from Scene::materials_buffer:
+    Material_block = glGetUniformBlockIndex(program, "Material");
+    glUniformBlockBinding(program, Material_block, Scene::MaterialBinding);
 
     GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
     GLuint DIRECTIONAL_DEPTH_TEX_sampler2D = glGetUniformLocation(program, "DIRECTIONAL_DEPTH_TEX");
@@ -37,24 +37,13 @@ struct BoneLitColorTextureProgram {
 
     GLuint LIGHT_TO_SPOT_mat4 = -1U;
 
-    //lighting: based on https://github.com/15-466/15-466-f19-base6/blob/master/BasicMaterialForwardProgram.hpp
-    GLuint EYE_vec3 = -1U; //camera position in lighting space
-    GLuint LIGHTS_uint = -1U;
-    GLuint ROUGHNESS_float = -1U;
-
-    GLuint LIGHT_TYPE_int_array = -1U;
-    GLuint LIGHT_LOCATION_vec3_array = -1U;
-    GLuint LIGHT_DIRECTION_vec3_array = -1U;
-    GLuint LIGHT_ENERGY_vec3_array = -1U;
-    GLuint LIGHT_CUTOFF_float_array = -1U;
-
-    enum : uint32_t { MaxLights = 40 };
-
     //Textures:
     //TEXTURE0 - texture that is accessed by TexCoord
     //TEXTURE1 - depth texture
 
-    GLuint USES_VERTEX_COLOR_bool = -1U;
+    //Uniform blocks:
+    GLuint Material_block = -1U; //Scene::Material parameters (ROUGHNESS, USES_VERTEX_COLOR)
+    GLuint Lights_block = -1U; //lighting (EYE, LIGHTS, LIGHT[]), shared by all lit programs; see Scene::upload_lights
 };
 
 extern Load< BoneLitColorTextureProgram > bone_lit_color_texture_program;
@@ -0,0 +1,44 @@
+#include "DepthReconstruct.hpp"
+
+#include "gl_errors.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+char const *DepthReconstruct::GLSL =
+	"uniform mat4 CLIP_TO_WORLD;\n"
+	"uniform vec4 CLIP_W;\n" //w row of WORLD_TO_CLIP, which is the view depth for perspective projections
+	"uniform vec3 EYE;\n"
+	"uniform vec2 VIEWPORT;\n"
+	"vec3 world_position(vec2 frag_coord, float depth) {\n"
+	"	vec4 world = CLIP_TO_WORLD * vec4(2.0 * frag_coord / VIEWPORT - 1.0, 2.0 * depth - 1.0, 1.0);\n"
+	"	return world.xyz / world.w;\n"
+	"}\n"
+	"float view_distance(vec2 frag_coord, float depth) {\n"
+	"	return distance(EYE, world_position(frag_coord, depth));\n"
+	"}\n"
+	"float view_depth(vec2 frag_coord, float depth) {\n"
+	"	return dot(CLIP_W, vec4(world_position(frag_coord, depth), 1.0));\n"
+	"}\n"
+;
+
+DepthReconstruct::DepthReconstruct(GLuint program) {
+	CLIP_TO_WORLD_mat4 = glGetUniformLocation(program, "CLIP_TO_WORLD");
+	CLIP_W_vec4 = glGetUniformLocation(program, "CLIP_W");
+	EYE_vec3 = glGetUniformLocation(program, "EYE");
+	VIEWPORT_vec2 = glGetUniformLocation(program, "VIEWPORT");
+}
+
+void DepthReconstruct::set(glm::mat4 const &world_to_clip, glm::vec3 const &eye, glm::uvec2 const &viewport) const {
+	glm::mat4 clip_to_world = glm::inverse(world_to_clip);
+	glm::vec4 clip_w = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+	glUniformMatrix4fv(CLIP_TO_WORLD_mat4, 1, GL_FALSE, glm::value_ptr(clip_to_world));
+	glUniform4fv(CLIP_W_vec4, 1, glm::value_ptr(clip_w));
+	glUniform3fv(EYE_vec3, 1, glm::value_ptr(eye));
+	glUniform2f(VIEWPORT_vec2, float(viewport.x), float(viewport.y));
+	GL_ERRORS();
+}
+
+glm::vec3 DepthReconstruct::world_position(glm::mat4 const &clip_to_world, glm::vec2 const &frag_coord, glm::uvec2 const &viewport, float depth) {
+	glm::vec4 world = clip_to_world * glm::vec4(2.0f * frag_coord / glm::vec2(viewport) - 1.0f, 2.0f * depth - 1.0f, 1.0f);
+	return glm::vec3(world) / world.w;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * "DepthReconstruct" gets world positions back from a depth buffer and the view that drew it,
+ *  so post-processing can measure distances without a position target.
+ *
+ * DepthReconstruct::GLSL goes at the top of a fragment shader (after '#version'); it declares
+ *  its uniforms and:
+ *    vec3 world_position(vec2 frag_coord, float depth); //depth as stored ([0,1], 1 is far)
+ *    float view_distance(vec2 frag_coord, float depth); //from the eye
+ *    float view_depth(vec2 frag_coord, float depth); //along the view direction (perspective views)
+ *  (a depth of 1 -- nothing drawn -- has no position with an infinite projection, so check for it first)
+ *
+ * A DepthReconstruct holds a program's locations for those uniforms, and set() fills them in.
+ *
+ */
+
+#include "GL.hpp"
+#include <glm/glm.hpp>
+
+struct DepthReconstruct {
+	static char const *GLSL;
+
+	DepthReconstruct() = default;
+	explicit DepthReconstruct(GLuint program); //look up the uniforms in 'program'
+
+	GLuint CLIP_TO_WORLD_mat4 = -1U;
+	GLuint CLIP_W_vec4 = -1U;
+	GLuint EYE_vec3 = -1U;
+	GLuint VIEWPORT_vec2 = -1U;
+
+	//for a depth buffer of size 'viewport' drawn with 'world_to_clip' from 'eye' (the program must be in use):
+	void set(glm::mat4 const &world_to_clip, glm::vec3 const &eye, glm::uvec2 const &viewport) const;
+
+	//the GLSL world_position(), on the CPU:
+	static glm::vec3 world_position(glm::mat4 const &clip_to_world, glm::vec2 const &frag_coord, glm::uvec2 const &viewport, float depth);
+};
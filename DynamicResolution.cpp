@@ -0,0 +1,116 @@
+#include "DynamicResolution.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+std::string DynamicResolution::default_log_filename;
+
+DynamicResolution::~DynamicResolution() {
+	if (queries[0].begin == 0) return;
+	for (auto &frame : queries) {
+		glDeleteQueries(1, &frame.begin);
+		glDeleteQueries(1, &frame.end);
+	}
+}
+
+glm::uvec2 DynamicResolution::render_size(glm::uvec2 drawable_size) const {
+	return glm::uvec2(
+		std::max(1L, std::lround(double(drawable_size.x) * scale)),
+		std::max(1L, std::lround(double(drawable_size.y) * scale))
+	);
+}
+
+void DynamicResolution::begin_frame() {
+	if (queries[0].begin == 0) {
+		for (auto &frame : queries) {
+			glGenQueries(1, &frame.begin);
+			glGenQueries(1, &frame.end);
+		}
+	}
+
+	//read back whatever has finished, oldest first:
+	while (pending > 0) {
+		FrameQueries const &frame = queries[(next + queries.size() - pending) % queries.size()];
+		GLuint available = 0;
+		glGetQueryObjectuiv(frame.end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 begin_ns = 0, end_ns = 0;
+		glGetQueryObjectui64v(frame.begin, GL_QUERY_RESULT, &begin_ns);
+		glGetQueryObjectui64v(frame.end, GL_QUERY_RESULT, &end_ns);
+		pending -= 1;
+		update(float(double(end_ns - begin_ns) * 1e-6));
+	}
+
+	//(if the GPU is so far behind that every frame is still in flight, this one just isn't timed)
+	in_frame = (pending < queries.size());
+	if (in_frame) glQueryCounter(queries[next].begin, GL_TIMESTAMP);
+	GL_ERRORS();
+}
+
+void DynamicResolution::end_frame() {
+	if (!in_frame) return;
+	in_frame = false;
+	glQueryCounter(queries[next].end, GL_TIMESTAMP);
+	next = (next + 1) % queries.size();
+	pending += 1;
+	GL_ERRORS();
+}
+
+bool DynamicResolution::update(float gpu_ms) {
+	frames += 1;
+	average_ms = (average_ms == 0.0f ? gpu_ms : glm::mix(average_ms, gpu_ms, 0.1f));
+	if (!enabled || frames < last_change + settle_frames) return false;
+
+	//(the small bias keeps scales that are already multiples of 'step' from rounding down a step)
+	auto quantize = [this](float s) {
+		return std::floor(s / step + 1e-3f) * step;
+	};
+	float want = scale;
+	if (average_ms > budget_ms) {
+		want = std::min(quantize(scale * std::sqrt(budget_ms / average_ms)), scale - step);
+	} else {
+		float up = quantize(scale + step);
+		float predicted = average_ms * (up * up) / (scale * scale);
+		if (predicted < headroom * budget_ms) want = up;
+	}
+	want = std::clamp(want, min_scale, max_scale);
+	if (want == scale) return false;
+
+	Change change;
+	change.frame = frames;
+	change.gpu_ms = average_ms;
+	change.from = scale;
+	change.to = want;
+	changes.emplace_back(change);
+
+	if (!log_filename.empty()) {
+		std::cout << "dynamic resolution: " << average_ms << " gpu ms per frame (budget " << budget_ms << "), scale " << change.from << " -> " << change.to << std::endl;
+		std::ofstream out(log_filename, std::ios::app);
+		out << change.frame << ' ' << change.gpu_ms << ' ' << change.from << ' ' << change.to << '\n';
+	}
+
+	scale = want;
+	last_change = frames;
+	average_ms = 0.0f; //(the old average was at the old scale)
+	return true;
+}
+
+void DynamicResolution::set_scale(float new_scale) {
+	scale = std::clamp(new_scale, min_scale, max_scale);
+	last_change = frames;
+	average_ms = 0.0f;
+}
+
+std::vector< DynamicResolution::Change > DynamicResolution::load_log(std::string const &filename) {
+	std::vector< Change > ret;
+	std::ifstream in(filename);
+	Change change;
+	while (in >> change.frame >> change.gpu_ms >> change.from >> change.to) {
+		ret.emplace_back(change);
+	}
+	return ret;
+}
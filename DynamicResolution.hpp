@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * "DynamicResolution" picks the scale PlayMode draws the 3D view at (Framebuffers::size, so
+ *  ms_fb, pp_fb and everything sized from them), so that slower GPUs can keep up with vsync;
+ *  post-processing draws at that size too, and the result is stretched to the window.
+ *  (Frames a picture is taken from are drawn at full size, into PlayMode::picture_framebuffers, and not timed.)
+ *
+ * GPU time per frame comes from a pair of GL_TIMESTAMP queries around the frame's commands
+ *  (begin_frame / end_frame), read back a few frames later so nothing waits on the GPU.
+ *  update() keeps an average, and once 'settle_frames' have passed since the last change:
+ *  - over budget, the scale drops by the square root of budget / time (cost goes with area),
+ *  - if one step up is predicted to fit in 'headroom' of the budget, it rises one step,
+ *  always to a multiple of 'step' within [min_scale, max_scale]. Every change reallocates
+ *  the render targets, hence the steps and the waiting.
+ *
+ * Each change is recorded in 'changes'. Only when 'log_filename' is set (by default, from
+ *  'aperture --dynamic-resolution-log <file>') is it also printed and appended there as a
+ *  "<frame> <gpu ms> <old scale> <new scale>" line, which
+ *  'aperture --dynamic-resolution-log <file> --benchmark dynamic_resolution' replays (see load_log).
+ *
+ */
+
+#include "GL.hpp"
+#include <glm/glm.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+struct DynamicResolution {
+	DynamicResolution() = default;
+	~DynamicResolution();
+	DynamicResolution(DynamicResolution const &) = delete;
+	DynamicResolution &operator=(DynamicResolution const &) = delete;
+
+	//configuration:
+	bool enabled = true; //(when false, 'scale' is left alone, but frames are still timed)
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	float step = 0.125f;
+	float budget_ms = 14.0f; //GPU time to aim for (a 60Hz frame is 16.7ms)
+	float headroom = 0.85f;
+	uint32_t settle_frames = 60; //measured frames to wait after a change before deciding again
+	std::string log_filename = default_log_filename; //("" to not write a log)
+	static std::string default_log_filename; //(set by main from the command line; "" otherwise)
+
+	//scale of each axis of the 3D view:
+	float scale = 1.0f;
+
+	//size to draw the 3D view at for a window of 'drawable_size':
+	glm::uvec2 render_size(glm::uvec2 drawable_size) const;
+
+	//bracket one frame's GL commands (begin_frame also reads back earlier frames and passes them to update()):
+	void begin_frame();
+	void end_frame();
+
+	//take one frame's GPU time and maybe change 'scale'; returns true if it did (no GL calls, so it can be driven directly):
+	bool update(float gpu_ms);
+
+	//set 'scale' (clamped to the bounds) without logging it, and start measuring afresh:
+	void set_scale(float new_scale);
+
+	float average_ms = 0.0f; //exponential average of GPU ms per frame since the last change (0 until measured)
+	uint32_t frames = 0; //frames measured so far
+	uint32_t last_change = 0; //value of 'frames' at the last change
+
+	struct Change {
+		uint32_t frame = 0;
+		float gpu_ms = 0.0f; //average that prompted it
+		float from = 1.0f, to = 1.0f;
+	};
+	std::vector< Change > changes;
+
+	//changes from a log written as above (empty if there is no such file):
+	static std::vector< Change > load_log(std::string const &filename);
+
+	//-- internals ---
+private:
+	struct FrameQueries {
+		GLuint begin = 0, end = 0;
+	};
+	std::array< FrameQueries, 4 > queries; //ring of frames in flight
+	uint32_t next = 0; //index of the next frame's queries
+	uint32_t pending = 0; //frames issued but not yet read back
+	bool in_frame = false; //(begin_frame issued a query that end_frame hasn't matched yet)
+};
@@ -5,9 +5,14 @@
 #include "gl_compile_program.hpp"
 #include "gl_check_fb.hpp"
 #include "gl_errors.hpp"
+#include "DepthReconstruct.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cmath>
+#include <memory>
 
 Framebuffers framebuffers;
 
@@ -17,6 +22,15 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
     if (drawable_size == size) return;
     size = drawable_size;
 
+    // Pooled transients are all the old size, so let them go (graphs will allocate new ones as needed)
+    for (uint32_t t = Blur; t < Backbuffer; ++t) {
+        bind_transient(Target(t), 0);
+    }
+    for (Transient &transient : transients) {
+        glDeleteTextures(1, &transient.tex);
+    }
+    transients.clear();
+
     // Resize ms_color_tex (msaa based on: https://learnopengl.com/Advanced-OpenGL/Anti-Aliasing)
     {
         //name texture if not yet named:
@@ -69,44 +83,6 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
         GL_ERRORS();
     }
 
-    // Resize depth_effect_tex
-    {
-        // name texture if not yet named:
-        if (depth_effect_tex == 0) glGenTextures(1, &depth_effect_tex);
-
-        // resize texture:
-        glBindTexture(GL_TEXTURE_2D, depth_effect_tex);
-        glTexImage2D(GL_TEXTURE_2D, 0,
-                     GL_RGB16F, //<-- storage will be RGB 16-bit half-float
-                     size.x, size.y, 0, //width, height, border
-                     GL_RGB, GL_FLOAT, //<-- source data (if we were uploading it) would be floating point RGB
-                     nullptr //<-- don't upload data, just allocate on-GPU storage
-        );
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        GL_ERRORS();
-    }
-
-    // Resize depth_effect_fb
-    {
-        // set up depth_effect_fb if not yet named:
-        if (depth_effect_fb == 0) {
-            glGenFramebuffers(1, &depth_effect_fb);
-            glBindFramebuffer(GL_FRAMEBUFFER, depth_effect_fb);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, depth_effect_tex, 0);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        }
-
-        // make sure depth_effect_fb isn't borked
-        glBindFramebuffer(GL_FRAMEBUFFER, depth_effect_fb);
-        gl_check_fb(); //<-- helper function to check framebuffer completeness
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        GL_ERRORS();
-    }
-    
     // Resize screen_texture
     {
         // Set up screen_texture if not yet named
@@ -120,8 +96,9 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
             GL_RGB, GL_FLOAT, //<-- source data (if we were uploading it) would be floating point RGB
             nullptr //<-- don't upload data, just allocate on-GPU storage
         );
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        //linear, so the first level of the depth of field pyramid averages the texels it covers (other passes use texelFetch):
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glBindTexture(GL_TEXTURE_2D, 0);
@@ -140,6 +117,9 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
                      GL_DEPTH_COMPONENT, GL_FLOAT,
                      nullptr //<-- don't upload data, just allocate on-GPU storage
         );
+        //(no mipmaps, so build_hiz can read it)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
         GL_ERRORS();
     }
@@ -161,82 +141,33 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
         GL_ERRORS();
     }
 
-    //Resize oc_position_rb
-    {
-        if(vertex_position_tex == 0) glGenTextures(1, &vertex_position_tex);
-
-        glBindTexture(GL_TEXTURE_2D, vertex_position_tex);
-        glTexImage2D(GL_TEXTURE_2D, 0,
-                     GL_RGBA32F,
-                     size.x, size.y, 0, //width, height, border
-                     GL_RGBA, GL_FLOAT, //<-- source data (if we were uploading it) would be floating point RGBA
-                     nullptr //<-- don't upload data, just allocate on-GPU storage
-        );
-        //glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE,
-        //                          4, // number of samples per pixel
-        //                        GL_RGBA32F, //<-- storage will be RGBA 32-bit float
-        //                          size.x, size.y, //width, height
-        //                          GL_TRUE //<-- use identical sample locations and the same number of samples per texel
-        //);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        GL_ERRORS();
-    }
-
-    //Resize oc_fb
+    //Set up oc_fb (depth only)
     {
         if (oc_fb == 0) {
             glGenFramebuffers(1, &oc_fb);
             glBindFramebuffer(GL_FRAMEBUFFER, oc_fb);
-            //rgba texture to hold positions
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vertex_position_tex, 0);
             //depth texture for querying for occlusion
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, pp_depth, 0); //comes pre-filled from blitting (used for occlusion)
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 
-        // make sure pp_fb isn't borked
+        // make sure oc_fb isn't borked
         glBindFramebuffer(GL_FRAMEBUFFER, oc_fb);
         gl_check_fb(); //<-- helper function to check framebuffer completeness
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         GL_ERRORS();
     }
     
-    // Resize blur textures
+    // Set up blur_fb (blur_tex is attached by bind_transient)
     {
-        // set up tex if not yet named
-        if (blur_tex == 0) glGenTextures(1, &blur_tex);
-
-        // resize texture
-        glBindTexture(GL_TEXTURE_2D, blur_tex);
-        glTexImage2D(GL_TEXTURE_2D, 0,
-            GL_RGB16F, //<-- storage will be RGB 16-bit half-float
-            size.x, size.y, 0, //width, height, border
-            GL_RGB, GL_FLOAT, //<-- source data (if we were uploading it) would be floating point RGB
-            nullptr //<-- don't upload data, just allocate on-GPU storage
-        );
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        // set up framebuffer if not yet named
-        if (blur_fb == 0) {
-            glGenFramebuffers(1, &blur_fb);
-            glBindFramebuffer(GL_FRAMEBUFFER, blur_fb);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blur_tex, 0);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        }
+        if (blur_fb == 0) glGenFramebuffers(1, &blur_fb);
+    }
 
-        // make sure blur_x_fb isn't borked
-        glBindFramebuffer(GL_FRAMEBUFFER, blur_fb);
-        gl_check_fb(); //<-- helper function to check framebuffer completeness
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        GL_ERRORS();
+    // Set up dof_fb (blur_depth_of_field attaches what it draws as it goes)
+    {
+        if (dof_fb == 0) glGenFramebuffers(1, &dof_fb);
     }
 
     //allocate shadow map framebuffer, from https://github.com/ixchow/15-466-f18-base3
@@ -278,19 +209,34 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
         GL_ERRORS();
     }
 
-    // Resize picture_tex
+    // Set up picture_fb (picture_tex is attached by bind_transient)
     {
-        // Set up picture_tex if not yet named
-        if (picture_tex == 0) glGenTextures(1, &picture_tex);
+        if (picture_fb == 0) glGenFramebuffers(1, &picture_fb);
+    }
 
-        // resize screen_texture and set parameters
-        glBindTexture(GL_TEXTURE_2D, picture_tex);
-        glTexImage2D(GL_TEXTURE_2D, 0,
-                     GL_RGB16F, //<-- storage will be RGB 16-bit half-float
-                     size.x, size.y, 0, //width, height, border
-                     GL_RGB, GL_FLOAT, //<-- source data (if we were uploading it) would be floating point RGB
-                     nullptr //<-- don't upload data, just allocate on-GPU storage
-        );
+    // Set up upscale_fb (upscale_tex is attached by bind_transient)
+    {
+        if (upscale_fb == 0) glGenFramebuffers(1, &upscale_fb);
+    }
+
+    // Resize hiz_tex
+    {
+        if (hiz_tex == 0) glGenTextures(1, &hiz_tex);
+
+        glBindTexture(GL_TEXTURE_2D, hiz_tex);
+        hiz_levels = 0;
+        do {
+            glm::uvec2 level_size = hiz_size(hiz_levels);
+            glTexImage2D(GL_TEXTURE_2D, hiz_levels,
+                         GL_R32F, //<-- storage will be one 32-bit float
+                         level_size.x, level_size.y, 0, //width, height, border
+                         GL_RED, GL_FLOAT,
+                         nullptr //<-- don't upload data, just allocate on-GPU storage
+            );
+            hiz_levels += 1;
+        } while (hiz_size(hiz_levels - 1) != glm::uvec2(1));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz_levels - 1);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -299,115 +245,65 @@ void Framebuffers::realloc(glm::uvec2 const &drawable_size, glm::uvec2 const &ne
         GL_ERRORS();
     }
 
-    // Resize picture_fb
+    // Resize hiz_fb
     {
-        // set up picture_fb if not yet named
-        if (picture_fb == 0) {
-            glGenFramebuffers(1, &picture_fb);
-            glBindFramebuffer(GL_FRAMEBUFFER, picture_fb);
-            //temporary bind to appease gl_check_fb()
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, picture_tex, 0);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        }
+        if (hiz_fb == 0) glGenFramebuffers(1, &hiz_fb);
 
-        // make sure picture_fb isn't borked
-        glBindFramebuffer(GL_FRAMEBUFFER, picture_fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, hiz_fb);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz_tex, 0);
         gl_check_fb(); //<-- helper function to check framebuffer completeness
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         GL_ERRORS();
     }
 
+    // Set up id_fb (id_tex and id_depth_tex are attached by bind_transient)
+    {
+        if (id_fb == 0) {
+            glGenFramebuffers(1, &id_fb);
+            glBindFramebuffer(GL_FRAMEBUFFER, id_fb);
+            //the shadow programs write ids to output 1 (output 0 is their world position, which isn't needed here)
+            GLenum bufs[2] = {GL_NONE, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, bufs);
+            glReadBuffer(GL_COLOR_ATTACHMENT1);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+    }
+
 
     // Check for gl errors
     GL_ERRORS();
 }
 
-struct ToneMapProgram {
-    ToneMapProgram() {
-        program = gl_compile_program(
-                // vertex shader -- draws a fullscreen triangle using no attribute streams
-                "#version 330\n"
-
-                "void main() {\n"
-                "	gl_Position = vec4(4 * (gl_VertexID & 1) - 1,  2 * (gl_VertexID & 2) - 1, 0.0, 1.0);\n"
-                "}\n"
-                ,
-                // fragment shader -- reads a HDR texture, maps to output pixel colors
-                "#version 330\n"
-                // saturation and exposure from https://timseverien.com/posts/2020-06-19-colour-correction-with-webgl/
-                "vec3 adjustSaturation(vec3 color, float value) {\n"
-                // https://www.w3.org/TR/WCAG21/#dfn-relative-luminance
-                "  const vec3 luminosityFactor = vec3(0.2126, 0.7152, 0.0722);\n"
-                "  vec3 grayscale = vec3(dot(color, luminosityFactor));\n"
-                "  return mix(grayscale, color, 1.0 + value);\n"
-                "}\n"
-                "vec3 adjustExposure(vec3 color, float value) {\n"
-                "  return (1.0 + value) * color;\n"
-                "}\n"
-                "uniform sampler2D TEX;\n"
-                "out vec4 fragColor;\n"
-                "void main() {\n"
-                "	vec3 color = texelFetch(TEX, ivec2(gl_FragCoord.xy), 0).rgb;\n"
-                //exposure-correction-style range compression:
-                //"		color = vec3(log(color.r + 1.0), log(color.g + 1.0), log(color.b + 1.0)) / log(2.0 + 1.0);\n"
-                //weird color effect:
-                //"		color = vec3(color.rg, gl_FragCoord.x/textureSize(TEX,0).x);\n"
-                //basic gamma-style range compression:
-                //"		color = vec3(pow(color.r, 0.45), pow(color.g, 0.45), pow(color.b, 0.45));\n"
-                //raw values:
-                //"		color = vec3(color.r - color.r % 0.01, color.r - color.g % 0.01, color.r - color.b % 0.01);\n"
-                //"		color = vec3(pow(color.r, 2) * 2, pow(color.g, 2)* 2, pow(color.b, 2)* 2);\n"
-                "   color = adjustSaturation(color, 1.2f);"
-                "   color = adjustExposure(color, 0.4f);\n"
-                "	fragColor = vec4(color, 1.0);\n"
-                "}\n"
-        );
-
-        //set TEX to texture unit 0:
-        GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
-        glUseProgram(program);
-        glUniform1i(TEX_sampler2D, 0);
-        glUseProgram(0);
-
-        GL_ERRORS();
+void Framebuffers::release() {
+    for (uint32_t t = Blur; t < Backbuffer; ++t) {
+        bind_transient(Target(t), 0);
     }
+    for (Transient &transient : transients) {
+        glDeleteTextures(1, &transient.tex);
+    }
+    transients.clear();
 
-    GLuint program = 0;
-
-    //uniforms:
-    //none
-
-    //textures:
-    //texture0 -- texture to copy
-};
-
-//Tone Map & Blur program adjusted from https://github.com/15-466/15-466-f20-framebuffer
-GLuint empty_vao = 0;
-Load< ToneMapProgram > tone_map_program(LoadTagEarly, []() -> ToneMapProgram const * {
-    if(empty_vao == 0) glGenVertexArrays(1, &empty_vao);
-    return new ToneMapProgram();
-});
-
-void Framebuffers::tone_map_to_screen(GLuint texture) {
-    glDisable(GL_BLEND);
-    glDisable(GL_DEPTH_TEST);
-
-    glUseProgram(tone_map_program->program);
-    glBindVertexArray(empty_vao);
-
-    glActiveTexture(GL_TEXTURE0);
-    //glBindTexture(GL_TEXTURE_2D, shadow_color_tex);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glDrawArrays(GL_TRIANGLES, 0, 3);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
+    for (GLuint *tex : {&ms_color_tex, &ms_depth_tex, &pp_depth, &screen_texture, &shadow_depth_tex, &hiz_tex}) {
+        if (*tex) glDeleteTextures(1, tex);
+        *tex = 0;
+    }
+    for (GLuint *fb : {&oc_fb, &ms_fb, &pp_fb, &blur_fb, &dof_fb, &shadow_fb, &picture_fb, &hiz_fb, &id_fb, &upscale_fb}) {
+        if (*fb) glDeleteFramebuffers(1, fb);
+        *fb = 0;
+    }
+    for (auto &pair : pass_timers) {
+        if (pair.second.queries[0]) glDeleteQueries(GLsizei(pair.second.queries.size()), pair.second.queries.data());
+    }
+    pass_timers.clear();
 
-    glBindVertexArray(0);
-    glUseProgram(0);
+    size = glm::uvec2(0);
+    shadow_size = glm::uvec2(0);
+    hiz_levels = 0;
     GL_ERRORS();
 }
 
+//Blur programs adjusted from https://github.com/15-466/15-466-f20-framebuffer
+GLuint empty_vao = 0;
 
 constexpr uint32_t KERNEL_RADIUS = 20;
 std::array< float, KERNEL_RADIUS > bloom_kernel = ([](){
@@ -491,7 +387,10 @@ struct BlurXProgram {
     //texture0 -- texture to copy
 };
 
-Load< BlurXProgram > blur_x_program(LoadTagEarly);
+Load< BlurXProgram > blur_x_program(LoadTagEarly, []() -> BlurXProgram const * {
+    if (empty_vao == 0) glGenVertexArrays(1, &empty_vao);
+    return new BlurXProgram();
+});
 
 
 struct BlurYProgram {
@@ -550,46 +449,61 @@ struct BlurYProgram {
 Load< BlurYProgram > blur_y_program(LoadTagEarly);
 
 
-void Framebuffers::tone_map_to_buffer(GLuint texture, GLuint buffer) {
-    glBindFramebuffer(GL_FRAMEBUFFER, buffer);
-    glDisable(GL_BLEND);
-    glDisable(GL_DEPTH_TEST);
-
-    GLint ret = 0;
-
-    glUseProgram(blur_y_program->program);
-    glBindVertexArray(empty_vao);
-    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &ret);
-
-    std::cout << ret << std::endl;
-
-    glActiveTexture(GL_TEXTURE0);
-    //glBindTexture(GL_TEXTURE_2D, shadow_color_tex);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glDrawArrays(GL_TRIANGLES, 0, 3);
-
-
-    //Add depth of field, store into pp_fb/screen_texture
-    glBindFramebuffer(GL_FRAMEBUFFER, buffer);
+//assisted by this tutorial https://lettier.github.io/3d-game-shaders-for-beginners/depth-of-field.html
+// (the GLSL twin of depth_of_field_blur, below)
+static char const *DepthOfFieldBlurGLSL =
+    "float depth_of_field_blur(float distance, float focal_distance) {\n"
+    //I know this function is complicated, but trust me, it works, look here: https://www.desmos.com/calculator/qhviivdx7k It could be less complex for performance reasons but it's good
+    //because the focal distance is exactly where the focus hits zero, and it has a reverse exponential falloff at first.
+    //"	return clamp((abs(2 * focal_distance - pow(distance,2)/focal_distance) - focal_distance)/(focal_distance), 0, 1);\n" //returns 0-1, first arg can be changed to increase "in focus" range
+
+    //most performant blue with neg exponential blur close and slow linear falloff far
+    //blur graphs here: https://www.desmos.com/calculator/iga7nhk3hr
+    "	if (distance < focal_distance) {\n"
+    "		return clamp(1 - pow(distance/focal_distance, 2), 0, 1);\n"
+    "	} else {\n"
+    "		return clamp((abs(focal_distance - distance) - focal_distance)/(2 * focal_distance), 0, 1);\n"
+    "	}\n"
+    "}\n";
+
+float depth_of_field_blur(float distance, float focal_distance) {
+    if (distance < focal_distance) {
+        return std::clamp(1.0f - (distance / focal_distance) * (distance / focal_distance), 0.0f, 1.0f);
+    } else {
+        return std::clamp((std::abs(focal_distance - distance) - focal_distance) / (2.0f * focal_distance), 0.0f, 1.0f);
+    }
+}
 
-    glUseProgram(tone_map_program->program);
-    glBindVertexArray(empty_vao);
+glm::uvec2 Framebuffers::dof_size(uint32_t level) const {
+    glm::uvec2 ret = glm::max((size + 1U) / 2U, glm::uvec2(1));
+    for (uint32_t l = 0; l < level; ++l) {
+        ret = glm::max((ret + 1U) / 2U, glm::uvec2(1));
+    }
+    return ret;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depth_effect_tex);
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+//the pyramid levels use every fourth tap of bloom_kernel: at half size that covers half of the full-size
+// blur's radius, and the quarter level (blurred again from the half level) a little more than all of it
+constexpr uint32_t DOF_KERNEL_STRIDE = 4;
+constexpr uint32_t DOF_KERNEL_RADIUS = KERNEL_RADIUS / DOF_KERNEL_STRIDE;
+std::array< float, DOF_KERNEL_RADIUS > dof_kernel = ([](){
+    std::array< float, DOF_KERNEL_RADIUS > weights;
+    for (uint32_t i = 0; i < weights.size(); ++i) {
+        weights[i] = bloom_kernel[i * DOF_KERNEL_STRIDE];
+    }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    //normalize:
+    float sum = 0.0f;
+    for (auto const &w : weights) sum += w;
+    sum = 2.0f * sum - weights[0]; //account for the fact that all taps other than center are used 2x
+    float inv_sum = 1.0f / sum;
+    for (auto &w : weights) w *= inv_sum;
 
-    glBindVertexArray(0);
-    glUseProgram(0);
-    GL_ERRORS();
-}
+    return weights;
+})();
 
-//assisted by this tutorial https://lettier.github.io/3d-game-shaders-for-beginners/depth-of-field.html
-struct DepthOfFieldProgram {
-    DepthOfFieldProgram() {
+struct DofBlurProgram {
+    DofBlurProgram() {
         program = gl_compile_program(
                 //vertex shader -- draws a fullscreen triangle using no attribute streams
                 "#version 330\n"
@@ -597,62 +511,39 @@ struct DepthOfFieldProgram {
                 "	gl_Position = vec4(4 * (gl_VertexID & 1) - 1,  2 * (gl_VertexID & 2) - 1, 0.0, 1.0);\n"
                 "}\n"
                 ,
-                //fragment shader -- blur in X direction with a given kernel
+                //fragment shader -- blur along STEP with filtered reads, so a larger TEX is also averaged down
                 "#version 330\n"
                 "uniform sampler2D TEX;\n"
-                "uniform sampler2D POS_TEX;\n"
-                "uniform sampler2D BLUR_TEX;\n"
-                "uniform vec3 PLAYER_POS;\n"
-                "uniform float FOCAL_DISTANCE;\n"
+                "uniform vec2 INV_SIZE;\n" //1 / size of the level being drawn
+                "uniform vec2 STEP;\n" //one texel of the level being drawn, along the blur, in TEX's coordinates
+                "const int KERNEL_RADIUS = " + std::to_string(DOF_KERNEL_RADIUS) + ";\n"
+                "uniform float KERNEL[KERNEL_RADIUS];\n"
                 "out vec4 fragColor;\n"
                 "void main() {\n"
-                "	ivec2 c = ivec2(gl_FragCoord.xy);\n"
-                "	vec3 location = vec3(texelFetch(POS_TEX, c, 0));\n"
-                "   float blur;\n"
-                "   if (location == vec3(0, 0, 0)) {\n"
-                "       blur = clamp(1 - (FOCAL_DISTANCE - 15)/30, 0, 1);\n" //setting blur for the sky, less blur at large values of focal distance
-                //"       if(FOCAL_DISTANCE > 20) {\n"
-                //"           blur = 0.0f;\n"
-                //"       } else {\n"
-                //"           blur = 1.0f;\n"
-                //"       }\n"
-                "   } else {\n"
-                "	    float distance = distance(PLAYER_POS, location);\n"
-                //I know this function is complicated, but trust me, it works, look here: https://www.desmos.com/calculator/qhviivdx7k It could be less complex for performance reasons but it's good
-                //because the focal distance is exactly where the focus hits zero, and it has a reverse exponential falloff at first.
-                //"	    blur = clamp((abs(2 * FOCAL_DISTANCE - pow(distance,2)/FOCAL_DISTANCE) - FOCAL_DISTANCE)/(FOCAL_DISTANCE), 0, 1);\n" //returns 0-1, first arg can be changed to increase "in focus" range
-
-                //most performant blue with neg exponential blur close and slow linear falloff far
-                //blur graphs here: https://www.desmos.com/calculator/iga7nhk3hr
-                "       if(distance < FOCAL_DISTANCE) {\n"
-                "           blur = clamp(1 - pow(distance/FOCAL_DISTANCE, 2), 0, 1);\n"
-                "       } else {\n"
-                "           blur = clamp((abs(FOCAL_DISTANCE - distance) - FOCAL_DISTANCE)/(2 * FOCAL_DISTANCE), 0, 1);\n"
-                "       }\n"
-                "   }\n"
-                "	fragColor = mix(texelFetch(TEX, c, 0), texelFetch(BLUR_TEX, c, 0), blur);\n"
-                //"	fragColor = vec4(blur, blur, blur, 1.0);\n"
-                //"	fragColor = texelFetch(TEX, c, 0);\n"
+                "	vec2 uv = gl_FragCoord.xy * INV_SIZE;\n"
+                "	vec3 acc = KERNEL[0] * texture(TEX, uv).rgb;\n"
+                "	for (int ofs = 1; ofs < KERNEL_RADIUS; ++ofs) {\n"
+                "		acc += KERNEL[ofs] * (\n"
+                "			  texture(TEX, uv + ofs * STEP).rgb\n"
+                "			+ texture(TEX, uv - ofs * STEP).rgb\n"
+                "		);\n"
+                "	}\n"
+                "	fragColor = vec4(acc, 1.0);\n"
                 "}\n"
         );
 
         glUseProgram(program);
+        //set KERNEL:
+        GLuint KERNEL_float_array = glGetUniformLocation(program, "KERNEL");
+        glUniform1fv(KERNEL_float_array, DOF_KERNEL_RADIUS, dof_kernel.data());
 
-        //set uniforms
-        PLAYER_POS_vec3 = glGetUniformLocation(program, "PLAYER_POS");
-        FOCAL_DISTANCE_float = glGetUniformLocation(program, "FOCAL_DISTANCE");
+        INV_SIZE_vec2 = glGetUniformLocation(program, "INV_SIZE");
+        STEP_vec2 = glGetUniformLocation(program, "STEP");
 
         //set TEX to texture unit 0:
         GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
         glUniform1i(TEX_sampler2D, 0);
 
-        //set POS_TEX to texture unit 1:
-        GLuint POS_TEX_sampler2D = glGetUniformLocation(program, "POS_TEX");
-        glUniform1i(POS_TEX_sampler2D, 1);
-
-        GLuint BLUR_TEX_sampler2D = glGetUniformLocation(program, "BLUR_TEX");
-        glUniform1i(BLUR_TEX_sampler2D, 2);
-
         glUseProgram(0);
 
         GL_ERRORS();
@@ -661,143 +552,348 @@ struct DepthOfFieldProgram {
     GLuint program = 0;
 
     //uniforms:
-    GLuint PLAYER_POS_vec3 = -1U;
-    GLuint FOCAL_DISTANCE_float = -1U;
+    GLuint INV_SIZE_vec2 = -1U;
+    GLuint STEP_vec2 = -1U;
 
     //textures:
-    //texture0 -- texture to copy
-    //texture1 -- position texture
-    //texture2 -- blurred texture
+    //texture0 -- texture to blur (linear filtering, clamped to edge)
 };
 
-Load< DepthOfFieldProgram > depth_of_field(LoadTagEarly, []() -> DepthOfFieldProgram const * {
-    if (empty_vao == 0) glGenVertexArrays(1, &empty_vao);
-    return new DepthOfFieldProgram();
-});
+Load< DofBlurProgram > dof_blur_program(LoadTagEarly);
 
-void Framebuffers::add_depth_of_field(float focal_distance, glm::vec3 player_pos) {
+void Framebuffers::blur_depth_of_field(uint32_t level) {
     glDisable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
 
-    // blur depth_effect_tex in the X direction, store into screen_texture:
-    glBindFramebuffer(GL_FRAMEBUFFER, pp_fb);
+    if (!dof_pyramid) {
+        assert(level == 0);
+        glBindVertexArray(empty_vao);
+        glActiveTexture(GL_TEXTURE0);
 
-    glUseProgram(blur_x_program->program);
-    glBindVertexArray(empty_vao);
+        // blur screen_texture in the X direction, store into blur_temp_tex:
+        glBindFramebuffer(GL_FRAMEBUFFER, dof_fb);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blur_temp_tex, 0);
+        glUseProgram(blur_x_program->program);
+        glBindTexture(GL_TEXTURE_2D, screen_texture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+
+        // blur blur_temp_tex in the Y direction, store into blur_tex:
+        glBindFramebuffer(GL_FRAMEBUFFER, blur_fb);
+        glUseProgram(blur_y_program->program);
+        glBindTexture(GL_TEXTURE_2D, blur_temp_tex);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindVertexArray(0);
+        glUseProgram(0);
+        GL_ERRORS();
+        return;
+    }
+
+    assert(level < DofLevels);
+    glm::uvec2 level_size = dof_size(level);
+    glViewport(0, 0, level_size.x, level_size.y);
 
+    glUseProgram(dof_blur_program->program);
+    glBindVertexArray(empty_vao);
+    glUniform2f(dof_blur_program->INV_SIZE_vec2, 1.0f / level_size.x, 1.0f / level_size.y);
+    glBindFramebuffer(GL_FRAMEBUFFER, dof_fb);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depth_effect_tex);
 
+    // blur the level above in the X direction, store into dof_temp_tex (reads land between the level above's texels, so they average them):
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dof_temp_tex[level], 0);
+    glUniform2f(dof_blur_program->STEP_vec2, 1.0f / level_size.x, 0.0f);
+    glBindTexture(GL_TEXTURE_2D, level == 0 ? screen_texture : dof_tex[level - 1]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // blur dof_temp_tex in the Y direction, store into dof_tex:
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dof_tex[level], 0);
+    glUniform2f(dof_blur_program->STEP_vec2, 0.0f, 1.0f / level_size.y);
+    glBindTexture(GL_TEXTURE_2D, dof_temp_tex[level]);
     glDrawArrays(GL_TRIANGLES, 0, 3);
 
     glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
 
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, size.x, size.y);
     glBindVertexArray(0);
     glUseProgram(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GL_ERRORS();
+}
 
-    // blur screen_texture in the Y direction, store into blur_tex
-    glBindFramebuffer(GL_FRAMEBUFFER, blur_fb);
+//Post-processing used to be separate full-screen passes (fog, depth of field, tone mapping), each a full read and
+// write of an HDR target. Now each is a section of this one fragment shader, switched on by a #define, and every
+// combination is compiled as its own PostProgram variant; depth of field is applied first, then fog, then tone mapping.
+static char const *PostGLSL =
+    "uniform sampler2D TEX;\n"
+    "out vec4 fragColor;\n"
+
+    "#ifdef DEPTH_OF_FIELD\n"
+    "uniform sampler2D DEPTH_TEX;\n"
+    "uniform sampler2D BLUR_TEX;\n" //full-size blur, or (DOF_PYRAMID) the half-size level
+    "uniform sampler2D BLUR_QUARTER_TEX;\n" //(DOF_PYRAMID) the quarter-size level
+    "uniform float FOCAL_DISTANCE;\n"
+    //mix in the blurred image by distance from the eye:
+    "vec3 add_depth_of_field(vec3 sharp, ivec2 c) {\n"
+    "	float depth = texelFetch(DEPTH_TEX, c, 0).r;\n"
+    "	float blur;\n"
+    "	if (depth == 1.0) {\n"
+    "		blur = clamp(1 - (FOCAL_DISTANCE - 15)/30, 0, 1);\n" //setting blur for the sky, less blur at large values of focal distance
+    "	} else {\n"
+    "		blur = depth_of_field_blur(view_distance(gl_FragCoord.xy, depth), FOCAL_DISTANCE);\n"
+    "	}\n"
+    "#ifndef DOF_PYRAMID\n"
+    "	return mix(sharp, texelFetch(BLUR_TEX, c, 0).rgb, blur);\n"
+    "#else\n"
+    "	if (blur == 0.0) return sharp;\n"
+    //the circle of confusion picks the level: sharp at 0, the half-size level at 0.5, the quarter-size level at 1
+    "	vec2 uv = gl_FragCoord.xy / VIEWPORT;\n"
+    "	vec3 half_blur = texture(BLUR_TEX, uv).rgb;\n"
+    "	if (blur < 0.5) return mix(sharp, half_blur, 2.0 * blur);\n"
+    "	return mix(half_blur, texture(BLUR_QUARTER_TEX, uv).rgb, 2.0 * blur - 1.0);\n"
+    "#endif\n"
+    "}\n"
+    "#endif\n"
+
+    "#ifdef FOG\n"
+    "uniform sampler2DMS MS_DEPTH_TEX;\n"
+    "uniform float FOG_DISTANCE;\n"
+    "uniform float FOG_INTENSITY;\n"
+    "uniform vec3 FOG_COLOR;\n"
+    //fog thickens toward 1 far away (and is 1 where nothing was drawn):
+    "float fog(float depth) {\n"
+    "	return depth < 1.0 ? exp(-FOG_DISTANCE / view_depth(gl_FragCoord.xy, depth)) : 1.0;\n"
+    "}\n"
+    //add color based on depth:
+    "vec3 add_fog(vec3 color, ivec2 c) {\n"
+    //(averaged over the samples, so there's no aliasing)
+    "	float depth = 0.0;\n"
+    "	for (int s = 0; s < MS_SAMPLES; ++s) {\n"
+    "		depth += fog(texelFetch(MS_DEPTH_TEX, c, s).r);\n"
+    "	}\n"
+    "	float intensity = depth / float(MS_SAMPLES) * FOG_INTENSITY;\n"
+    //"	return vec3(intensity);\n"
+    "	return mix(color, FOG_COLOR, intensity);\n"
+    "}\n"
+    "#endif\n"
+
+    "#ifdef TONE_MAP\n"
+    // saturation and exposure from https://timseverien.com/posts/2020-06-19-colour-correction-with-webgl/
+    "vec3 adjustSaturation(vec3 color, float value) {\n"
+    // https://www.w3.org/TR/WCAG21/#dfn-relative-luminance
+    "  const vec3 luminosityFactor = vec3(0.2126, 0.7152, 0.0722);\n"
+    "  vec3 grayscale = vec3(dot(color, luminosityFactor));\n"
+    "  return mix(grayscale, color, 1.0 + value);\n"
+    "}\n"
+    "vec3 adjustExposure(vec3 color, float value) {\n"
+    "  return (1.0 + value) * color;\n"
+    "}\n"
+    //maps HDR colors to output pixel colors:
+    "vec3 tone_map(vec3 color) {\n"
+    //exposure-correction-style range compression:
+    //"		color = vec3(log(color.r + 1.0), log(color.g + 1.0), log(color.b + 1.0)) / log(2.0 + 1.0);\n"
+    //basic gamma-style range compression:
+    //"		color = vec3(pow(color.r, 0.45), pow(color.g, 0.45), pow(color.b, 0.45));\n"
+    //"		color = vec3(pow(color.r, 2) * 2, pow(color.g, 2)* 2, pow(color.b, 2)* 2);\n"
+    "	color = adjustSaturation(color, 1.2f);\n"
+    "	color = adjustExposure(color, 0.4f);\n"
+    "	return color;\n"
+    "}\n"
+    "#endif\n"
+
+    "void main() {\n"
+    "	ivec2 c = ivec2(gl_FragCoord.xy);\n"
+    "	vec3 color = texelFetch(TEX, c, 0).rgb;\n"
+    "#ifdef DEPTH_OF_FIELD\n"
+    "	color = add_depth_of_field(color, c);\n"
+    "#endif\n"
+    "#ifdef FOG\n"
+    "	color = add_fog(color, c);\n"
+    "#endif\n"
+    "#ifdef TONE_MAP\n"
+    "	color = tone_map(color);\n"
+    "#endif\n"
+    "	fragColor = vec4(color, 1.0);\n"
+    "}\n";
+
+struct PostProgram {
+    explicit PostProgram(uint32_t features) {
+        std::string defines;
+        if (features & Framebuffers::PostDepthOfField) defines += "#define DEPTH_OF_FIELD\n";
+        if (features & Framebuffers::PostDofPyramid) defines += "#define DOF_PYRAMID\n";
+        if (features & Framebuffers::PostFog) defines += "#define FOG\n";
+        if (features & Framebuffers::PostToneMap) defines += "#define TONE_MAP\n";
+        defines += "#define MS_SAMPLES " + std::to_string(framebuffers.msaa_samples) + "\n";
 
-    //blending disabled?
-    //glEnable(GL_BLEND);
-    //glBlendEquation(GL_FUNC_ADD);
-    //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        program = gl_compile_program(
+                //vertex shader -- draws a fullscreen triangle using no attribute streams
+                "#version 330\n"
+                "void main() {\n"
+                "	gl_Position = vec4(4 * (gl_VertexID & 1) - 1,  2 * (gl_VertexID & 2) - 1, 0.0, 1.0);\n"
+                "}\n"
+                ,
+                //fragment shader -- the sections of PostGLSL that 'features' asks for
+                "#version 330\n"
+                + defines
+                + DepthReconstruct::GLSL
+                + DepthOfFieldBlurGLSL
+                + PostGLSL
+        );
 
-    glUseProgram(blur_y_program->program);
-    glBindVertexArray(empty_vao);
+        glUseProgram(program);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, screen_texture);
+        //set uniform locations:
+        FOG_DISTANCE_float = glGetUniformLocation(program, "FOG_DISTANCE");
+        FOG_INTENSITY_float = glGetUniformLocation(program, "FOG_INTENSITY");
+        FOG_COLOR_vec3 = glGetUniformLocation(program, "FOG_COLOR");
+        FOCAL_DISTANCE_float = glGetUniformLocation(program, "FOCAL_DISTANCE");
+        reconstruct = DepthReconstruct(program);
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+        //set samplers to texture units (sections that aren't compiled in have no sampler, which glUniform ignores):
+        glUniform1i(glGetUniformLocation(program, "TEX"), 0);
+        glUniform1i(glGetUniformLocation(program, "MS_DEPTH_TEX"), 1);
+        glUniform1i(glGetUniformLocation(program, "DEPTH_TEX"), 2);
+        glUniform1i(glGetUniformLocation(program, "BLUR_TEX"), 3);
+        glUniform1i(glGetUniformLocation(program, "BLUR_QUARTER_TEX"), 4);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
 
-    glBindVertexArray(0);
-    glUseProgram(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        GL_ERRORS();
+    }
 
-    //glDisable(GL_BLEND);
+    GLuint program = 0;
 
-    //Add depth of field, store into pp_fb/screen_texture
-    glBindFramebuffer(GL_FRAMEBUFFER, pp_fb);
+    //uniforms:
+    GLuint FOG_DISTANCE_float = -1U;
+    GLuint FOG_INTENSITY_float = -1U;
+    GLuint FOG_COLOR_vec3 = -1U;
+    GLuint FOCAL_DISTANCE_float = -1U;
+    DepthReconstruct reconstruct; //(view the depth buffers were drawn with)
 
-    glUseProgram(depth_of_field->program);
+    //textures:
+    //texture0 -- image to post-process
+    //texture1 -- multisampled depth (ms_depth_tex), for fog
+    //texture2 -- prepass depth (pp_depth), for depth of field
+    //texture3 -- blurred image (blur_tex, or the half-size pyramid level)
+    //texture4 -- quarter-size pyramid level
+};
+
+//every variant, compiled up front so changing features (e.g., raising the camera) never waits on a compile:
+struct PostPrograms {
+    std::array< std::unique_ptr< PostProgram >, Framebuffers::PostVariants > variants;
+};
+
+Load< PostPrograms > post_programs(LoadTagEarly, []() -> PostPrograms const * {
+    if (empty_vao == 0) glGenVertexArrays(1, &empty_vao);
+    PostPrograms *ret = new PostPrograms();
+    for (uint32_t features = 0; features < Framebuffers::PostVariants; ++features) {
+        //(the pyramid only means something with depth of field)
+        if ((features & Framebuffers::PostDofPyramid) && !(features & Framebuffers::PostDepthOfField)) continue;
+        ret->variants[features] = std::make_unique< PostProgram >(features);
+    }
+    return ret;
+});
+
+void Framebuffers::post_process(GLuint texture, uint32_t features) {
+    if ((features & PostDepthOfField) && dof_pyramid) features |= PostDofPyramid;
+    assert(features < PostVariants && post_programs->variants[features]);
+    PostProgram const &program = *post_programs->variants[features];
+
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(program.program);
     glBindVertexArray(empty_vao);
 
     //set uniforms
-    glUniform1f(depth_of_field->FOCAL_DISTANCE_float, focal_distance );
-    glUniform3fv(depth_of_field->PLAYER_POS_vec3, 1, glm::value_ptr(player_pos));
+    glUniform1f(program.FOG_INTENSITY_float, post.fog_intensity);
+    glUniform1f(program.FOG_DISTANCE_float, post.fog_distance);
+    glUniform3fv(program.FOG_COLOR_vec3, 1, glm::value_ptr(post.fog_color));
+    glUniform1f(program.FOCAL_DISTANCE_float, post.focal_distance);
+    program.reconstruct.set(post.world_to_clip, post.eye, size);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depth_effect_tex);
-
-    //texture1 is vertex position texture
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, vertex_position_tex);
-
-    //texture2 is blurred texture
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, blur_tex);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (features & PostFog) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, ms_depth_tex);
+    }
+    if (features & PostDepthOfField) {
+        //texture2 is the prepass depth (positions are reconstructed from it)
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, pp_depth);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, dof_pyramid ? dof_tex[0] : blur_tex);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, dof_pyramid ? dof_tex[1] : 0);
+    }
 
     glDrawArrays(GL_TRIANGLES, 0, 3);
 
     //unbind textures
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (features & PostDepthOfField) {
+        for (GLenum unit : {GL_TEXTURE4, GL_TEXTURE3, GL_TEXTURE2}) {
+            glActiveTexture(unit);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
+    if (features & PostFog) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    }
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     glBindVertexArray(0);
     glUseProgram(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     GL_ERRORS();
 }
 
-struct DepthEffectsProgram {
-    DepthEffectsProgram() {
+glm::uvec2 Framebuffers::hiz_size(uint32_t level) const {
+    glm::uvec2 ret = glm::max(size / 2U, glm::uvec2(1));
+    for (uint32_t l = 0; l < level; ++l) {
+        ret = glm::max(ret / 2U, glm::uvec2(1));
+    }
+    return ret;
+}
+
+struct HiZProgram {
+    HiZProgram() {
         program = gl_compile_program(
-                //vertex shader -- draws a fullscreen triangle using no attribute streams
+                // vertex shader -- draws a fullscreen triangle using no attribute streams
                 "#version 330\n"
                 "void main() {\n"
                 "	gl_Position = vec4(4 * (gl_VertexID & 1) - 1,  2 * (gl_VertexID & 2) - 1, 0.0, 1.0);\n"
                 "}\n"
                 ,
-                //fragment shader -- add color based on depth
+                // fragment shader -- max of the 2x2 (or, along odd edges, up to 3x3) texels of SRC this texel covers
                 "#version 330\n"
-                "uniform sampler2D TEX;\n"
-                "uniform sampler2DMS DEPTH_TEX;\n"
-                "uniform float FOG_EXP;\n"
-                "uniform float FOG_INTENSITY;\n"
-                "uniform vec3 FOG_COLOR;\n"
-                "out vec4 fragColor;\n"
+                "uniform sampler2D SRC;\n"
+                "out float depth;\n"
                 "void main() {\n"
-                "	ivec2 c = ivec2(gl_FragCoord.xy);\n"
-                "	vec4 color = texelFetch(TEX, c, 0);\n"
-                "   float depth = pow((texelFetch(DEPTH_TEX, c, 0).r + texelFetch(DEPTH_TEX, c, 1).r + texelFetch(DEPTH_TEX, c, 2).r + texelFetch(DEPTH_TEX, c, 3).r)/4.0, FOG_EXP);\n"
-                "   float intensity = depth * FOG_INTENSITY;\n"
-                //"   fragColor = vec4(vec3(intensity), 1.0);\n"
-                "	fragColor = vec4(mix(color.rgb, FOG_COLOR, intensity), 1.0);\n"
+                "	ivec2 src_size = textureSize(SRC, 0);\n"
+                "	ivec2 dst_size = max(src_size / 2, ivec2(1));\n"
+                "	ivec2 dst = ivec2(gl_FragCoord.xy);\n"
+                "	ivec2 begin = (dst * src_size) / dst_size;\n"
+                "	ivec2 end = ((dst + 1) * src_size + dst_size - 1) / dst_size;\n"
+                "	float m = 0.0;\n"
+                "	for (int y = begin.y; y < end.y; ++y) {\n"
+                "		for (int x = begin.x; x < end.x; ++x) {\n"
+                "			m = max(m, texelFetch(SRC, ivec2(x, y), 0).r);\n"
+                "		}\n"
+                "	}\n"
+                "	depth = m;\n"
                 "}\n"
         );
 
+        //set SRC to texture unit 0:
+        GLuint SRC_sampler2D = glGetUniformLocation(program, "SRC");
         glUseProgram(program);
-
-        //set uniform locaitons:
-        FOG_EXP_float = glGetUniformLocation(program, "FOG_EXP");
-        FOG_INTENSITY_float = glGetUniformLocation(program, "FOG_INTENSITY");
-        FOG_COLOR_vec3 = glGetUniformLocation(program, "FOG_COLOR");
-
-        //set TEX to texture unit 0:
-        GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
-        GLuint DEPTH_TEX_sampler2D = glGetUniformLocation(program, "DEPTH_TEX");
-
-        glUniform1i(TEX_sampler2D, 0);
-        glUniform1i(DEPTH_TEX_sampler2D, 1); //set DEPTH_TEX to sample from GL_TEXTURE1
-
+        glUniform1i(SRC_sampler2D, 0);
         glUseProgram(0);
 
         GL_ERRORS();
@@ -805,53 +901,304 @@ struct DepthEffectsProgram {
 
     GLuint program = 0;
 
-    //uniforms:
-    GLuint FOG_EXP_float = -1U;
-    GLuint FOG_INTENSITY_float = -1U;
-    GLuint FOG_COLOR_vec3 = -1U;
-
     //textures:
-    //texture0 -- texture to copy
+    //texture0 -- level to reduce (pp_depth, or the previous level of hiz_tex, made its only level)
 };
 
-Load< DepthEffectsProgram > depth_effects_program(LoadTagEarly, []() -> DepthEffectsProgram const * {
-    if (empty_vao == 0) glGenVertexArrays(1, &empty_vao);
-    return new DepthEffectsProgram();
-});
+Load< HiZProgram > hiz_program(LoadTagEarly);
 
-void Framebuffers::add_depth_effects(float fog_intensity, float fog_exp, glm::vec3 fog_color) {
+void Framebuffers::build_hiz() {
     glDisable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_FALSE);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depth_effect_fb);
 
-    glUseProgram(depth_effects_program->program);
+    glUseProgram(hiz_program->program);
     glBindVertexArray(empty_vao);
-
-    //set up uniforms
-    glUniform1f(depth_effects_program->FOG_INTENSITY_float, fog_intensity);
-    glUniform1f(depth_effects_program->FOG_EXP_float, fog_exp);
-    glUniform3fv(depth_effects_program->FOG_COLOR_vec3, 1, glm::value_ptr(fog_color));
-
-    //bind color texture to tex0
+    glBindFramebuffer(GL_FRAMEBUFFER, hiz_fb);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, screen_texture);
-
-    //bind multisampled depth texture to tex1
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, ms_depth_tex);
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+    for (uint32_t level = 0; level < hiz_levels; ++level) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz_tex, level);
+        glm::uvec2 level_size = hiz_size(level);
+        glViewport(0, 0, level_size.x, level_size.y);
+        if (level == 0) {
+            glBindTexture(GL_TEXTURE_2D, pp_depth);
+        } else {
+            //read only the previous level (so the level being written isn't also being sampled):
+            glBindTexture(GL_TEXTURE_2D, hiz_tex);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
 
+    glBindTexture(GL_TEXTURE_2D, hiz_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiz_levels - 1);
     glBindTexture(GL_TEXTURE_2D, 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiz_tex, 0);
 
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, size.x, size.y);
     glBindVertexArray(0);
     glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+    GL_ERRORS();
+}
+
+// -------- Frame graph --------
+
+char const *Framebuffers::target_name(Target target) {
+    static char const *names[TargetCount] = {
+        "shadow depth", "prepass depth", "hi-z", "ms color", "ms depth", "screen",
+        "blur", "blur temp", "dof 1/2", "dof 1/2 temp", "dof 1/4", "dof 1/4 temp", "picture", "ids", "ids depth", "upscale",
+        "backbuffer"
+    };
+    return target < TargetCount ? names[target] : "?";
+}
+
+//formats of the transient targets (pooled textures are shared only between targets whose formats match exactly):
+struct TransientFormat {
+    GLenum internal_format, format, type;
+    glm::uvec2 size;
+    GLenum filter;
+};
+static TransientFormat transient_format(Framebuffers const &fbs, Framebuffers::Target target) {
+    switch (target) {
+        case Framebuffers::Blur: case Framebuffers::BlurTemp: return TransientFormat{GL_RGB16F, GL_RGB, GL_FLOAT, fbs.size, GL_NEAREST};
+        case Framebuffers::DofHalf: case Framebuffers::DofHalfTemp: return TransientFormat{GL_RGB16F, GL_RGB, GL_FLOAT, fbs.dof_size(0), GL_LINEAR};
+        case Framebuffers::DofQuarter: case Framebuffers::DofQuarterTemp: return TransientFormat{GL_RGB16F, GL_RGB, GL_FLOAT, fbs.dof_size(1), GL_LINEAR};
+        case Framebuffers::Picture: return TransientFormat{GL_RGB16F, GL_RGB, GL_FLOAT, fbs.size, GL_NEAREST};
+        case Framebuffers::IDs: return TransientFormat{GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, fbs.size, GL_NEAREST};
+        case Framebuffers::IDDepth: return TransientFormat{GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, fbs.size, GL_NEAREST};
+        case Framebuffers::Upscale: return TransientFormat{GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, fbs.size, GL_NEAREST};
+        default: assert(0 && "not a transient target"); return TransientFormat{GL_NONE, GL_NONE, GL_NONE, glm::uvec2(0), GL_NEAREST};
+    }
+}
+
+//where each transient target's texture goes (member, framebuffer, attachment):
+static GLuint *transient_member(Framebuffers &fbs, Framebuffers::Target target, GLuint *fb = nullptr, GLenum *attachment = nullptr) {
+    GLuint dummy_fb;
+    GLenum dummy_attachment;
+    if (!fb) fb = &dummy_fb;
+    if (!attachment) attachment = &dummy_attachment;
+    *attachment = GL_COLOR_ATTACHMENT0;
+    switch (target) {
+        case Framebuffers::Blur: *fb = fbs.blur_fb; return &fbs.blur_tex;
+        case Framebuffers::BlurTemp: *fb = 0; return &fbs.blur_temp_tex;
+        case Framebuffers::DofHalf: *fb = 0; return &fbs.dof_tex[0];
+        case Framebuffers::DofHalfTemp: *fb = 0; return &fbs.dof_temp_tex[0];
+        case Framebuffers::DofQuarter: *fb = 0; return &fbs.dof_tex[1];
+        case Framebuffers::DofQuarterTemp: *fb = 0; return &fbs.dof_temp_tex[1];
+        case Framebuffers::Picture: *fb = fbs.picture_fb; return &fbs.picture_tex;
+        case Framebuffers::IDs: *fb = fbs.id_fb; *attachment = GL_COLOR_ATTACHMENT1; return &fbs.id_tex;
+        case Framebuffers::IDDepth: *fb = fbs.id_fb; *attachment = GL_DEPTH_ATTACHMENT; return &fbs.id_depth_tex;
+        case Framebuffers::Upscale: *fb = fbs.upscale_fb; return &fbs.upscale_tex;
+        default: assert(0 && "not a transient target"); return nullptr;
+    }
+}
+
+void Framebuffers::bind_transient(Target target, GLuint tex) {
+    GLuint fb;
+    GLenum attachment;
+    GLuint *member = transient_member(*this, target, &fb, &attachment);
+    if (*member == tex) return;
+    *member = tex;
+    if (fb == 0) return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, tex, 0);
+    if (tex) gl_check_fb(); //<-- helper function to check framebuffer completeness
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDepthMask(GL_TRUE);
+    GL_ERRORS();
+}
+
+size_t Framebuffers::texel_bytes(GLenum internal_format) {
+    switch (internal_format) {
+        case GL_RGBA32F: return 16;
+        case GL_RGB16F: case GL_RGBA16F: return 8;
+        default: return 4; //GL_R32UI, GL_R32F, GL_DEPTH_COMPONENT24, GL_RGBA8
+    }
+}
+
+size_t Framebuffers::persistent_bytes() const {
+    size_t texels = size_t(size.x) * size.y;
+    size_t bytes = texels * msaa_samples * (texel_bytes(GL_RGB16F) + texel_bytes(GL_DEPTH_COMPONENT24)); //ms_color_tex, ms_depth_tex
+    bytes += texels * (texel_bytes(GL_RGB16F) + texel_bytes(GL_DEPTH_COMPONENT24)); //screen_texture, pp_depth
+    for (uint32_t level = 0; level < hiz_levels; ++level) {
+        glm::uvec2 level_size = hiz_size(level);
+        bytes += size_t(level_size.x) * level_size.y * texel_bytes(GL_R32F);
+    }
+    bytes += size_t(shadow_size.x) * shadow_size.y * texel_bytes(GL_DEPTH_COMPONENT24);
+    return bytes;
+}
+
+size_t Framebuffers::transient_bytes() const {
+    size_t bytes = 0;
+    for (Transient const &transient : transients) {
+        bytes += size_t(transient.size.x) * transient.size.y * texel_bytes(transient.internal_format);
+    }
+    return bytes;
+}
+
+void FrameGraph::add(std::string const &name, std::vector< Target > const &reads, std::vector< Target > const &writes, std::function< void() > const &run, bool keep) {
+    passes.emplace_back(Pass{name, reads, writes, run, keep, false});
+}
+
+void FrameGraph::run() {
+    Framebuffers &fbs = framebuffers;
 
+    //cull, last pass first: a pass is needed if something after it reads what it writes
+    std::array< bool, Framebuffers::TargetCount > needed{};
+    read.fill(false);
+    for (Target target : exports) {
+        needed[target] = read[target] = true;
+    }
+    for (size_t i = passes.size(); i-- > 0; ) {
+        Pass &pass = passes[i];
+        pass.culled = !pass.keep;
+        for (Target target : pass.writes) {
+            if (target == Framebuffers::Backbuffer || needed[target]) pass.culled = false;
+        }
+        if (pass.culled) continue;
+        for (Target target : pass.writes) needed[target] = false;
+        for (Target target : pass.reads) needed[target] = read[target] = true;
+    }
+
+    //span of passes using each transient that something reads:
+    struct Span {
+        Target target;
+        uint32_t first, last;
+    };
+    std::vector< Span > spans;
+    for (uint32_t t = Framebuffers::Blur; t < Framebuffers::Backbuffer; ++t) {
+        Target target = Target(t);
+        if (!read[target]) continue;
+        Span span{target, uint32_t(passes.size()), 0};
+        for (uint32_t i = 0; i < passes.size(); ++i) {
+            Pass const &pass = passes[i];
+            if (pass.culled) continue;
+            bool reads = std::find(pass.reads.begin(), pass.reads.end(), target) != pass.reads.end();
+            bool writes = std::find(pass.writes.begin(), pass.writes.end(), target) != pass.writes.end();
+            if (reads || writes) span.first = std::min(span.first, i);
+            if (reads) span.last = i;
+        }
+        if (std::find(exports.begin(), exports.end(), target) != exports.end()) span.last = uint32_t(passes.size());
+        spans.emplace_back(span);
+    }
+    std::sort(spans.begin(), spans.end(), [](Span const &a, Span const &b) { return a.first < b.first; });
+
+    //hand out pooled textures, first fit (so the same graph gets the same textures every frame):
+    for (auto &transient : fbs.transients) {
+        transient.free_from = 0;
+    }
+    std::vector< bool > assigned(fbs.transients.size(), false);
+    for (Span const &span : spans) {
+        TransientFormat want = transient_format(fbs, span.target);
+        size_t found = fbs.transients.size();
+        for (size_t i = 0; i < fbs.transients.size(); ++i) {
+            Framebuffers::Transient const &transient = fbs.transients[i];
+            if (transient.internal_format == want.internal_format && transient.size == want.size && transient.filter == want.filter && transient.free_from <= span.first) {
+                found = i;
+                break;
+            }
+        }
+        if (found == fbs.transients.size()) {
+            Framebuffers::Transient transient;
+            transient.internal_format = want.internal_format;
+            transient.size = want.size;
+            transient.filter = want.filter;
+            glGenTextures(1, &transient.tex);
+            glBindTexture(GL_TEXTURE_2D, transient.tex);
+            glTexImage2D(GL_TEXTURE_2D, 0, want.internal_format, want.size.x, want.size.y, 0, want.format, want.type, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, want.filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, want.filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            GL_ERRORS();
+            fbs.transients.emplace_back(transient);
+            assigned.emplace_back(false);
+        }
+        Framebuffers::Transient &transient = fbs.transients[found];
+        transient.free_from = span.last + 1;
+        transient.idle_runs = 0;
+        assigned[found] = true;
+        fbs.bind_transient(span.target, transient.tex);
+    }
+
+    //let go of pooled textures that haven't been wanted in a while:
+    for (size_t i = fbs.transients.size(); i-- > 0; ) {
+        if (assigned[i]) continue;
+        Framebuffers::Transient &transient = fbs.transients[i];
+        transient.idle_runs += 1;
+        if (transient.idle_runs <= Framebuffers::TransientIdleRuns) continue;
+        for (uint32_t t = Framebuffers::Blur; t < Framebuffers::Backbuffer; ++t) {
+            if (*transient_member(fbs, Target(t)) == transient.tex) fbs.bind_transient(Target(t), 0);
+        }
+        glDeleteTextures(1, &transient.tex);
+        fbs.transients.erase(fbs.transients.begin() + i);
+    }
+
+    fbs.graph_runs += 1;
+    for (Pass &pass : passes) {
+        if (pass.culled) continue;
+        if (!fbs.time_passes) {
+            pass.run();
+            continue;
+        }
+
+        Framebuffers::PassTimer &timer = fbs.pass_timers[pass.name];
+        if (timer.queries[0] == 0) glGenQueries(GLsizei(timer.queries.size()), timer.queries.data());
+        //read back whatever has finished, oldest first:
+        while (timer.pending > 0) {
+            GLuint query = timer.queries[(timer.next + timer.queries.size() - timer.pending) % timer.queries.size()];
+            GLuint available = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            timer.ms = float(double(ns) * 1e-6);
+            timer.average_ms = (timer.average_ms == 0.0f ? timer.ms : glm::mix(timer.average_ms, timer.ms, 0.1f));
+            timer.pending -= 1;
+        }
+        timer.last_run = fbs.graph_runs;
+
+        //(if the GPU is so far behind that every query is still in flight, this run just isn't timed)
+        if (timer.pending == timer.queries.size()) {
+            pass.run();
+            continue;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, timer.queries[timer.next]);
+        pass.run();
+        glEndQuery(GL_TIME_ELAPSED);
+        timer.next = (timer.next + 1) % timer.queries.size();
+        timer.pending += 1;
+    }
     GL_ERRORS();
 }
+
+float Framebuffers::pass_ms(std::vector< std::string > const &names) const {
+    float ms = 0.0f;
+    for (std::string const &name : names) {
+        auto f = pass_timers.find(name);
+        if (f == pass_timers.end() || f->second.last_run + 4 < graph_runs) continue;
+        ms += f->second.average_ms;
+    }
+    return ms;
+}
+
+std::vector< Framebuffers::Target > add_depth_of_field_blur(FrameGraph &graph) {
+    if (!framebuffers.dof_pyramid) {
+        graph.add("dof blur", {Framebuffers::Screen, Framebuffers::BlurTemp}, {Framebuffers::Blur, Framebuffers::BlurTemp}, []() {
+            framebuffers.blur_depth_of_field(0);
+        });
+        return {Framebuffers::Blur};
+    }
+    graph.add("dof blur 1/2", {Framebuffers::Screen, Framebuffers::DofHalfTemp}, {Framebuffers::DofHalf, Framebuffers::DofHalfTemp}, []() {
+        framebuffers.blur_depth_of_field(0);
+    });
+    graph.add("dof blur 1/4", {Framebuffers::DofHalf, Framebuffers::DofQuarterTemp}, {Framebuffers::DofQuarter, Framebuffers::DofQuarterTemp}, []() {
+        framebuffers.blur_depth_of_field(1);
+    });
+    return {Framebuffers::DofHalf, Framebuffers::DofQuarter};
+}
@@ -3,19 +3,26 @@
 #include "GL.hpp"
 #include <glm/glm.hpp>
 
+#include <array>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
 // Framebuffer code, adjusted from: https://github.com/15-466/15-466-f20-framebuffer
 // A global set of framebuffers for use in various offscreen rendering effects:
 struct Framebuffers {
 
     // Called to trigger (re-)allocation on window size change
     void realloc(const glm::uvec2 &drawable_size, const glm::uvec2 &new_shadow_size);
+    // Delete every GL object (settings are kept; the next realloc starts over):
+    void release();
 
     // Current size of framebuffer attachments
     glm::uvec2 size = glm::uvec2(0,0);
 
     //occlusion checking
-    GLuint oc_fb = 0;
-    GLuint vertex_position_tex = 0; //stores positions for each fragment
+    GLuint oc_fb = 0; // depth: pp_depth (positions are reconstructed from it where needed, see DepthReconstruct)
 
     // MSAA enabled gl objects
     int msaa_samples = 4; // number of samples per pixel for multisample anti-aliasing
@@ -29,29 +36,145 @@ struct Framebuffers {
     GLuint screen_texture = 0;
 
     // Objects for the "bloom" effect
-    GLuint blur_tex = 0; //GL_RGB16F color texture for first pass of blur
+    GLuint blur_tex = 0; //GL_RGB16F color texture for first pass of blur (transient)
+    GLuint blur_temp_tex = 0; //GL_RGB16F horizontal pass of blur_tex (transient)
     GLuint blur_fb = 0; // color0: blur_x_tex
 
+    //Depth of field blur pyramid (see blur_depth_of_field), all GL_RGB16F with linear filtering (transient)
+    enum : uint32_t { DofLevels = 2 };
+    GLuint dof_tex[DofLevels] = {0, 0}; // screen_texture blurred at half and quarter of 'size'
+    GLuint dof_temp_tex[DofLevels] = {0, 0}; // horizontal pass of each level
+    GLuint dof_fb = 0; // color0: whichever of the above (or blur_temp_tex) is being drawn
+    glm::uvec2 dof_size(uint32_t level) const; // size of dof_tex[level]
+    bool dof_pyramid = true; // false: blur screen_texture into blur_tex at full size instead, as before (to compare GPU time)
+
     //This framebuffer is used for shadow maps, from https://github.com/ixchow/15-466-f18-base3
     glm::uvec2 shadow_size = glm::uvec2(0,0);
     GLuint shadow_depth_tex = 0;
     GLuint shadow_fb = 0;
 
-    //Objects for depth effects
-    GLuint depth_effect_fb = 0;
-    GLuint depth_effect_tex = 0;
-
     //Object for picture transfer = 0;
     GLuint picture_fb = 0;
-    GLuint picture_tex = 0;
+    GLuint picture_tex = 0; //GL_RGB16F (transient)
+
+    //Hierarchical depth for occlusion culling (see build_hiz and Scene::read_hiz)
+    GLuint hiz_tex = 0; // GL_R32F, level 0 is half of 'size'; every level is the max of the texels it covers below
+    GLuint hiz_fb = 0; // color0: hiz_tex (level being built)
+    uint32_t hiz_levels = 0;
+    glm::uvec2 hiz_size(uint32_t level) const; // size of a hiz_tex level
+
+    //Object IDs for picture scoring (see Scene::begin_picture)
+    GLuint id_tex = 0; // GL_R32UI, 1 + index of the frontmost drawable (0 = nothing) (transient)
+    GLuint id_depth_tex = 0; // GL_DEPTH_COMPONENT24, the ID pass's own depth (transient)
+    GLuint id_fb = 0; // color1: id_tex (written by the shadow programs' second output), depth: id_depth_tex
+
+    //Post-processed frame, when 'size' is smaller than the window (see DynamicResolution)
+    GLuint upscale_tex = 0; // GL_RGBA8, stretched to the window by a blit (transient)
+    GLuint upscale_fb = 0; // color0: upscale_tex
+
+    // Post-processing, all in one full-screen pass (one program per set of features, see PostProgram):
+    enum PostFeature : uint32_t {
+        PostFog = 1, // by ms_depth_tex's view depth (fog reaches 1/e of fog_intensity at fog_distance)
+        PostDepthOfField = 2, // blend toward the blurred image by pp_depth's distance from the eye (blur_depth_of_field first)
+        PostToneMap = 4,
+        PostDofPyramid = 8, // (added by post_process when dof_pyramid is set)
+        PostVariants = 16
+    };
+    struct PostSettings {
+        float fog_intensity = 0.0f;
+        float fog_distance = 13.0f;
+        glm::vec3 fog_color = glm::vec3(0.0f);
+        float focal_distance = 1.0f;
+        glm::mat4 world_to_clip = glm::mat4(1.0f); // view the depth buffers were drawn with
+        glm::vec3 eye = glm::vec3(0.0f);
+    } post; // (set by PlayMode every frame; pictures taken before the next frame reuse them)
+    //draw 'texture' into the bound framebuffer with 'features' applied (depth of field first, then fog, then tone mapping):
+    void post_process(GLuint texture, uint32_t features);
+    //blur screen_texture into blur_tex, or, with dof_pyramid, screen_texture (level 0) or dof_tex[level - 1] into dof_tex[level]:
+    void blur_depth_of_field(uint32_t level);
+    void build_hiz(); //reduce pp_depth (as left by the depth prepass) into every level of hiz_tex
+
+    // Render targets, as passes declare them to a FrameGraph:
+    //  persistent targets are allocated by realloc() and stay resident;
+    //  transient targets only get a texture while passes that use them run, from a pool shared by all transients
+    //  (so, e.g., blur_tex and picture_tex are the same texture, since nothing needs both at once)
+    enum Target : uint32_t {
+        ShadowDepth, PrepassDepth, HiZ, MSColor, MSDepth, Screen, // persistent
+        Blur, BlurTemp, DofHalf, DofHalfTemp, DofQuarter, DofQuarterTemp, Picture, IDs, IDDepth, Upscale, // transient
+        Backbuffer, // the window; passes that write it are never culled
+        TargetCount
+    };
+    static bool is_transient(Target target) { return target >= Blur && target < Backbuffer; }
+    static char const *target_name(Target target);
+
+    struct Transient {
+        GLuint tex = 0;
+        GLenum internal_format = GL_NONE;
+        glm::uvec2 size = glm::uvec2(0);
+        GLenum filter = GL_NEAREST;
+        uint32_t free_from = 0; // (while a graph is being set up: index of the first pass after its last use so far)
+        uint32_t idle_runs = 0; // graphs run since it was last used
+    };
+    std::vector< Transient > transients; // (sizes depend on 'size', so realloc() frees them all)
+    enum : uint32_t { TransientIdleRuns = 600 }; // free a pooled texture after this many graphs without use (~10 seconds of frames, so going in and out of the camera doesn't reallocate)
 
-    void tone_map_to_screen(GLuint texture); //copy ms_color_tex to screen with tone mapping applied
-    void tone_map_to_buffer(GLuint texture, GLuint buffer);
-    void add_depth_of_field(float focal_distance, glm::vec3 player_pos); //do a basic bloom effect on the screen_texture
-    void add_depth_effects(float fog_intensity, float fog_exp, glm::vec3 fog_color);
+    // point the transient 'target' (and the framebuffer it's attached to) at 'tex' (0 to detach):
+    void bind_transient(Target target, GLuint tex);
+
+    // GPU memory held by render targets, estimated from their formats (RGB16F counted as 8 bytes/texel, since drivers pad it to RGBA):
+    size_t persistent_bytes() const;
+    size_t transient_bytes() const;
+    static size_t texel_bytes(GLenum internal_format);
+
+    // GPU time of frame graph passes, by pass name, from GL_TIME_ELAPSED queries read back a few graphs later (so nothing waits on the GPU):
+    struct PassTimer {
+        std::array< GLuint, 4 > queries{}; // ring of queries in flight
+        uint32_t next = 0; // index of the next query to issue
+        uint32_t pending = 0; // issued but not yet read back
+        float ms = 0.0f; // latest result
+        float average_ms = 0.0f; // exponential average of results
+        uint32_t last_run = 0; // value of graph_runs when the pass last ran
+    };
+    std::map< std::string, PassTimer > pass_timers;
+    bool time_passes = true;
+    uint32_t graph_runs = 0; // FrameGraph::run calls so far
+    // sum of the average GPU ms of the named passes that ran in the last few graphs (ones that didn't count as 0):
+    float pass_ms(std::vector< std::string > const &names) const;
 
 };
 
+// A list of render passes, each declaring the targets it reads and writes. run():
+//  - culls passes whose writes nothing later reads (unless they write Backbuffer, or were added with 'keep'),
+//  - gives each transient target a pooled texture for the span of passes that use it, sharing textures between targets of the same format whose spans don't overlap,
+//  - then runs the remaining passes in order (timing each one, see Framebuffers::pass_timers).
+// Targets in 'exports' are wanted after the graph is done (e.g., Screen, by a picture taken before the next frame).
+struct FrameGraph {
+    using Target = Framebuffers::Target;
+
+    struct Pass {
+        std::string name;
+        std::vector< Target > reads, writes; // (scratch targets used only inside a pass go in both)
+        std::function< void() > run;
+        bool keep = false; // has effects outside the graph (e.g., starts a readback)
+        bool culled = false; // (set by run())
+    };
+    std::vector< Pass > passes;
+    std::vector< Target > exports;
+
+    void add(std::string const &name, std::vector< Target > const &reads, std::vector< Target > const &writes, std::function< void() > const &run, bool keep = false);
+    void run();
+
+    // true if a pass that wasn't culled reads 'target' (so it got a texture, if transient); valid while run() is running passes:
+    bool used(Target target) const { return read[target]; }
+    std::array< bool, Framebuffers::TargetCount > read{};
+};
+
+// declare the depth of field blur passes (Framebuffers::blur_depth_of_field) to 'graph', reading Screen; returns what they leave for PostDepthOfField:
+std::vector< Framebuffers::Target > add_depth_of_field_blur(FrameGraph &graph);
+
+// how blurred (0 to 1) depth of field leaves something 'distance' from the camera (the curve PostProgram uses):
+float depth_of_field_blur(float distance, float focal_distance);
+
 // the actual storage
 extern Framebuffers framebuffers;
 // NOTE: I could have used a namespace and declared every element extern but that seemed more cumbersome to write
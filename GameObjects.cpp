@@ -408,12 +408,15 @@ void Creature::play_animation(std::string const &anim_name, bool loop, float spe
     // For that creature, set the current animation to the new one
     drawable->pipeline[Scene::Drawable::ProgramTypeDefault].set_uniforms = [&] () {
         animation_player->set_uniform(bone_lit_color_texture_program->BONES_mat4x3_array);
-        glUniform1f(bone_lit_color_texture_program->ROUGHNESS_float, drawable->roughness);
     };
     //set uniforms on shadow pipeline
     drawable->pipeline[Scene::Drawable::ProgramTypeShadow].set_uniforms = [&] () {
         animation_player->set_uniform(bone_shadow_program->BONES_mat4x3_array);
     };
+    //posed vertices for CPU pictures (see Scene::soft_picture):
+    drawable->pose_positions = [&] (std::vector< glm::vec3 > *positions) {
+        animation_player->pose_positions(positions);
+    };
 }
 
 glm::vec3 Creature::get_best_angle() const {
@@ -0,0 +1,78 @@
+#include "HiZ.hpp"
+
+#include <algorithm>
+
+bool HiZ::occluded(glm::vec3 const &min, glm::vec3 const &max) const {
+	if (levels.empty()) return false;
+
+	//screen-space bounds and nearest depth of the box's corners:
+	glm::vec2 lo = glm::vec2( 1.0f);
+	glm::vec2 hi = glm::vec2(-1.0f);
+	float nearest = 1.0f;
+	for (uint32_t c = 0; c < 8; ++c) {
+		glm::vec4 clip = world_to_clip * glm::vec4(
+			(c & 1 ? max.x : min.x),
+			(c & 2 ? max.y : min.y),
+			(c & 4 ? max.z : min.z),
+			1.0f
+		);
+		if (clip.w <= 0.0f) return false; //(behind the eye)
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		lo = glm::min(lo, glm::vec2(ndc));
+		hi = glm::max(hi, glm::vec2(ndc));
+		nearest = std::min(nearest, 0.5f * ndc.z + 0.5f);
+	}
+	if (lo.x < -1.0f || lo.y < -1.0f || hi.x > 1.0f || hi.y > 1.0f) return false;
+	if (nearest <= 0.0f) return false;
+
+	//texels of the finest level the box covers:
+	glm::uvec2 size = levels[0].size;
+	glm::uvec2 begin = glm::min(glm::uvec2((0.5f * lo + 0.5f) * glm::vec2(size)), size - 1U);
+	glm::uvec2 end = glm::min(glm::uvec2((0.5f * hi + 0.5f) * glm::vec2(size)), size - 1U);
+
+	//step up until the area is at most two texels across (texel x of a level is inside texel x * dst / src of the next):
+	uint32_t l = 0;
+	while (l + 1 < levels.size() && (end.x - begin.x > 1 || end.y - begin.y > 1)) {
+		glm::uvec2 src = levels[l].size;
+		glm::uvec2 dst = levels[l + 1].size;
+		begin = begin * dst / src;
+		end = end * dst / src;
+		l += 1;
+	}
+
+	Level const &level = levels[l];
+	float farthest = 0.0f;
+	for (uint32_t y = begin.y; y <= end.y; ++y) {
+		for (uint32_t x = begin.x; x <= end.x; ++x) {
+			farthest = std::max(farthest, level.depth[y * level.size.x + x]);
+		}
+	}
+	return nearest > farthest;
+}
+
+void HiZ::build_levels() {
+	if (levels.empty()) return;
+	while (levels.back().size.x > 1 || levels.back().size.y > 1) {
+		Level const &src = levels.back();
+		Level dst;
+		dst.size = glm::max(src.size / 2U, glm::uvec2(1));
+		dst.depth.assign(size_t(dst.size.x) * dst.size.y, 0.0f);
+		//same coverage as Framebuffers::build_hiz:
+		for (uint32_t y = 0; y < dst.size.y; ++y) {
+			uint32_t y0 = y * src.size.y / dst.size.y;
+			uint32_t y1 = ((y + 1) * src.size.y + dst.size.y - 1) / dst.size.y;
+			for (uint32_t x = 0; x < dst.size.x; ++x) {
+				uint32_t x0 = x * src.size.x / dst.size.x;
+				uint32_t x1 = ((x + 1) * src.size.x + dst.size.x - 1) / dst.size.x;
+				float m = 0.0f;
+				for (uint32_t sy = y0; sy < y1; ++sy) {
+					for (uint32_t sx = x0; sx < x1; ++sx) {
+						m = std::max(m, src.depth[sy * src.size.x + sx]);
+					}
+				}
+				dst.depth[y * dst.size.x + x] = m;
+			}
+		}
+		levels.emplace_back(std::move(dst));
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * "HiZ" is a CPU copy of a depth pyramid: each level holds the farthest (max) depth
+ *  of the texels it covers in the level below, as built by Framebuffers::build_hiz.
+ *
+ * occluded() projects a world-space box with the view the depth was rendered from and
+ *  compares its nearest point against the farthest depth in the area it covers, using
+ *  the level where that area is only a couple of texels across.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct HiZ {
+	struct Level {
+		glm::uvec2 size = glm::uvec2(0);
+		std::vector< float > depth; //row-major, window-space depth ([0,1], 1 is far)
+	};
+	//finest first; level i + 1 has max(1, size / 2) texels, each covering 2 or 3 texels per axis of level i:
+	std::vector< Level > levels;
+
+	//view the depth was rendered from:
+	glm::mat4 world_to_clip = glm::mat4(1.0f);
+
+	bool empty() const { return levels.empty(); }
+
+	//true if every point in the box is behind the depth it would cover:
+	// conservative -- boxes crossing the near plane or the edge of the view are never occluded
+	bool occluded(glm::vec3 const &min, glm::vec3 const &max) const;
+
+	//fill in levels above levels[0] (if they weren't read back):
+	void build_levels();
+};
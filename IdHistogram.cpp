@@ -0,0 +1,48 @@
+#include "IdHistogram.hpp"
+
+#include <algorithm>
+#include <thread>
+
+//count one strip into 'bins' (which must have id_count + 1 entries; the last collects out-of-range ids):
+static void count_strip(uint32_t const *ids, size_t count, uint32_t id_count, uint32_t *bins) {
+	//ID images are mostly long runs of the same id, so count a whole run at once:
+	size_t i = 0;
+	while (i < count) {
+		uint32_t id = ids[i];
+		size_t end = i + 1;
+		while (end < count && ids[end] == id) ++end;
+		bins[std::min(id, id_count)] += uint32_t(end - i);
+		i = end;
+	}
+}
+
+void IdHistogram::count(uint32_t const *ids, size_t count, uint32_t id_count, uint32_t threads) {
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	size_t strips = std::max< size_t >(1, std::min< size_t >(threads, count / MinStrip));
+
+	//one set of bins per strip (plus an overflow bin each), summed at the end:
+	std::vector< uint32_t > bins(strips * (id_count + 1), 0);
+	auto run = [&](size_t strip) {
+		size_t begin = count * strip / strips;
+		size_t end = count * (strip + 1) / strips;
+		count_strip(ids + begin, end - begin, id_count, bins.data() + strip * (id_count + 1));
+	};
+
+	std::vector< std::thread > workers;
+	workers.reserve(strips - 1);
+	for (size_t strip = 1; strip < strips; ++strip) {
+		workers.emplace_back(run, strip);
+	}
+	run(0);
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+	counts.assign(id_count, 0);
+	for (size_t strip = 0; strip < strips; ++strip) {
+		uint32_t const *strip_bins = bins.data() + strip * (id_count + 1);
+		for (uint32_t id = 0; id < id_count; ++id) {
+			counts[id] += strip_bins[id];
+		}
+	}
+}
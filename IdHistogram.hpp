@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * "IdHistogram" counts how many pixels of an object-ID image (one uint32 per pixel,
+ *  as read back from Framebuffers::id_tex) belong to each id.
+ *
+ * Doesn't touch GL, so it can be run on synthetic images (see 'tests/aperture-tests id_histogram').
+ *
+ */
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct IdHistogram {
+	//counts[id] is the number of pixels with that id (ids >= counts.size() are ignored):
+	std::vector< uint32_t > counts;
+
+	//set counts to the histogram of ids[0, count), with 'id_count' bins:
+	// the image is split into strips counted on up to 'threads' threads (0 = one per hardware thread),
+	// each into its own bins; small images are counted on the calling thread
+	void count(uint32_t const *ids, size_t count, uint32_t id_count, uint32_t threads = 0);
+
+	//fewest pixels worth handing to another thread:
+	enum : size_t { MinStrip = 64 * 1024 };
+};
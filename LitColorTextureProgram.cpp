@@ -16,7 +16,7 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
     lit_color_texture_program_pipeline.LIGHT_TO_SPOT_mat4 = ret->LIGHT_TO_SPOT_mat4;
 
-    lit_color_texture_program_pipeline.USES_VERTEX_COLOR = ret->USES_VERTEX_COLOR_bool;
+    lit_color_texture_program_pipeline.Material_block = ret->Material_block;
 
 	/* This will be used later if/when we build a light loop into the Scene:
 	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
@@ -48,16 +48,41 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > instanced_lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(true);
+
+	//----- add the instanced variant to the pipeline template -----
+	lit_color_texture_program_pipeline.instanced_program = ret->program;
+	lit_color_texture_program_pipeline.WORLD_TO_CLIP_mat4 = ret->WORLD_TO_CLIP_mat4;
+	lit_color_texture_program_pipeline.WORLD_TO_LIGHT_mat4x3 = ret->WORLD_TO_LIGHT_mat4x3;
+	lit_color_texture_program_pipeline.NORMAL_WORLD_TO_LIGHT_mat3 = ret->NORMAL_WORLD_TO_LIGHT_mat3;
+	lit_color_texture_program_pipeline.BATCHED_bool = ret->BATCHED_bool;
+	lit_color_texture_program_pipeline.SLOTS_BASE_int = ret->SLOTS_BASE_int;
+
+	return ret;
+});
+
+LitColorTextureProgram::LitColorTextureProgram(bool instanced) {
     //forward lighting shader based on https://github.com/15-466/15-466-f19-base6/blob/master/BasicMaterialForwardProgram.cpp
     //shadow mapping based on https://github.com/ixchow/15-466-f18-base3/blob/master/texture_program.cpp
     //shader with no vertex color
     program = gl_compile_program(
             //vertex shader:
             "#version 330\n"
+            + std::string(instanced ? "#define INSTANCED\n" : "") +
+            "#ifdef INSTANCED\n"
+            "uniform mat4 WORLD_TO_CLIP;\n"
+            "uniform mat4x3 WORLD_TO_LIGHT;\n"
+            "uniform mat3 NORMAL_WORLD_TO_LIGHT;\n"
+            "uniform samplerBuffer INSTANCES;\n" //see Scene::InstanceGroup for layout
+            "uniform bool BATCHED;\n" //drawn as a Scene::StaticBatch: instance comes from SLOTS, by vertex
+            "uniform int SLOTS_BASE;\n"
+            "uniform usamplerBuffer SLOTS;\n"
+            "#else\n"
             "uniform mat4 OBJECT_TO_CLIP;\n"
             "uniform mat4x3 OBJECT_TO_LIGHT;\n"
             "uniform mat3 NORMAL_TO_LIGHT;\n"
+            "#endif\n"
             "uniform mat4 LIGHT_TO_SPOT;\n"
             "in vec4 Position;\n"
             "in vec3 Normal;\n"
@@ -69,6 +94,15 @@ LitColorTextureProgram::LitColorTextureProgram() {
             "out vec2 texCoord;\n"
             "out vec4 spotPosition;\n"
             "void main() {\n"
+            "#ifdef INSTANCED\n"
+            "	int instance = BATCHED ? int(texelFetch(SLOTS, gl_VertexID - SLOTS_BASE).r) : gl_InstanceID;\n"
+            "	int i = " + std::to_string(Scene::InstanceTexels) + " * instance;\n"
+            "	mat4x3 OBJECT_TO_WORLD = transpose(mat3x4(texelFetch(INSTANCES, i), texelFetch(INSTANCES, i+1), texelFetch(INSTANCES, i+2)));\n"
+            "	mat3 NORMAL_TO_WORLD = transpose(mat3(texelFetch(INSTANCES, i+3).xyz, texelFetch(INSTANCES, i+4).xyz, texelFetch(INSTANCES, i+5).xyz));\n"
+            "	mat4 OBJECT_TO_CLIP = WORLD_TO_CLIP * mat4(OBJECT_TO_WORLD);\n"
+            "	mat4x3 OBJECT_TO_LIGHT = WORLD_TO_LIGHT * mat4(OBJECT_TO_WORLD);\n"
+            "	mat3 NORMAL_TO_LIGHT = NORMAL_WORLD_TO_LIGHT * NORMAL_TO_WORLD;\n"
+            "#endif\n"
             "	gl_Position = OBJECT_TO_CLIP * Position;\n"
             "	position = OBJECT_TO_LIGHT * Position;\n"
             "   spotPosition = LIGHT_TO_SPOT * vec4(position, 1.0f); \n"
@@ -82,15 +116,22 @@ LitColorTextureProgram::LitColorTextureProgram() {
             "uniform sampler2D TEX;\n"
             "uniform sampler2D DEPTH_TEX;\n"
             "uniform sampler2DShadow DIRECTIONAL_DEPTH_TEX;\n"
-            "uniform float ROUGHNESS;\n"
-            "uniform uint LIGHTS;\n"
-            "uniform int LIGHT_TYPE[" + std::to_string(MaxLights) + "];\n"
-            "uniform vec3 LIGHT_LOCATION[" + std::to_string(MaxLights) + "];\n"
-            "uniform vec3 LIGHT_DIRECTION[" + std::to_string(MaxLights) + "];\n"
-            "uniform vec3 LIGHT_ENERGY[" + std::to_string(MaxLights) + "];\n"
-            "uniform float LIGHT_CUTOFF[" + std::to_string(MaxLights) + "];\n"
-            "uniform bool USES_VERTEX_COLOR;\n"
-            "uniform vec3 EYE;\n"
+            "struct Light {\n" //see Scene::LightData
+            "	vec3 LOCATION;\n"
+            "	int TYPE;\n"
+            "	vec3 DIRECTION;\n"
+            "	float CUTOFF;\n"
+            "	vec3 ENERGY;\n"
+            "};\n"
+            "layout(std140) uniform Lights {\n"
+            "	vec3 EYE;\n"
+            "	uint LIGHTS;\n"
+            "	Light LIGHT[" + std::to_string(Scene::MaxLights) + "];\n"
+            "};\n"
+            "layout(std140) uniform Material {\n"
+            "	float ROUGHNESS;\n"
+            "	bool USES_VERTEX_COLOR;\n"
+            "};\n"
             "in vec3 position;\n"
             "in vec3 normal;\n"
             "in vec4 color;\n"
@@ -111,11 +152,11 @@ LitColorTextureProgram::LitColorTextureProgram() {
             "   }\n"
             "   if (albedo.a < 0.5) discard;\n"
             "	for (uint light = 0u; light < LIGHTS; ++light) {\n"
-            "		int TYPE = LIGHT_TYPE[light];\n"
-            "		vec3 LOCATION = LIGHT_LOCATION[light];\n"
-            "		vec3 DIRECTION = LIGHT_DIRECTION[light];\n"
-            "		vec3 ENERGY = LIGHT_ENERGY[light];\n"
-            "		float CUTOFF = LIGHT_CUTOFF[light];\n"
+            "		int TYPE = LIGHT[light].TYPE;\n"
+            "		vec3 LOCATION = LIGHT[light].LOCATION;\n"
+            "		vec3 DIRECTION = LIGHT[light].DIRECTION;\n"
+            "		vec3 ENERGY = LIGHT[light].ENERGY;\n"
+            "		float CUTOFF = LIGHT[light].CUTOFF;\n"
             "		vec3 l; //direction to light\n"
             "		vec3 h; //half-vector\n"
             "		vec3 e; //light flux\n"
@@ -181,27 +222,33 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
     LIGHT_TO_SPOT_mat4 = glGetUniformLocation(program, "LIGHT_TO_SPOT");
 
-    ROUGHNESS_float = glGetUniformLocation(program, "ROUGHNESS");
-    EYE_vec3 = glGetUniformLocation(program, "EYE");
-    LIGHTS_uint = glGetUniformLocation(program, "LIGHTS");
+    WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+    WORLD_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "WORLD_TO_LIGHT");
+    NORMAL_WORLD_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_WORLD_TO_LIGHT");
+    BATCHED_bool = glGetUniformLocation(program, "BATCHED");
+    SLOTS_BASE_int = glGetUniformLocation(program, "SLOTS_BASE");
 
-	LIGHT_TYPE_int_array = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3_array = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3_array = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3_array = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float_array = glGetUniformLocation(program, "LIGHT_CUTOFF");
+    //lights come from Scene::lights_buffer:
+    Lights_block = glGetUniformBlockIndex(program, "Lights");
+    glUniformBlockBinding(program, Lights_block, Scene::LightsBinding);
 
-    USES_VERTEX_COLOR_bool = glGetUniformLocation(program, "USES_VERTEX_COLOR");
+    //material parameters come from Scene::materials_buffer:
+    Material_block = glGetUniformBlockIndex(program, "Material");
+    glUniformBlockBinding(program, Material_block, Scene::MaterialBinding);
 
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
     GLuint DIRECTIONAL_DEPTH_TEX_sampler2D = glGetUniformLocation(program, "DIRECTIONAL_DEPTH_TEX");
+    GLuint INSTANCES_samplerBuffer = glGetUniformLocation(program, "INSTANCES");
+    GLuint SLOTS_usamplerBuffer = glGetUniformLocation(program, "SLOTS");
 
 	//set TEX to always refer to texture binding zero:
 	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
 	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
     glUniform1i(DIRECTIONAL_DEPTH_TEX_sampler2D, 5); //set DIRECTIONAL_DEPTH_TEX_sampler2D to sample from GL_TEXTURE5 (1-4 reserved for per-drawable textures)
+    if (INSTANCES_samplerBuffer != -1U) glUniform1i(INSTANCES_samplerBuffer, Scene::InstancesTextureUnit);
+    if (SLOTS_usamplerBuffer != -1U) glUniform1i(SLOTS_usamplerBuffer, Scene::SlotsTextureUnit);
 
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
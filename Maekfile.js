@@ -140,6 +140,7 @@ const game_names = [
 	maek.CPP('GP22IntroMode.cpp'),
 	maek.CPP('main.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
+	maek.CPP('benchmarks.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
 ];
 
@@ -151,6 +152,12 @@ const common_names = [
 	maek.CPP('ColorProgram.cpp'),
 	maek.CPP('ColorTextureProgram.cpp'),
 	maek.CPP('Scene.cpp'),
+	maek.CPP('BVH.cpp'),
+	maek.CPP('RenderQueue.cpp'),
+	maek.CPP('IdHistogram.cpp'),
+	maek.CPP('HiZ.cpp'),
+	maek.CPP('SoftRaster.cpp'),
+	maek.CPP('PhotoWriter.cpp'),
 	maek.CPP('Mesh.cpp'),
 	maek.CPP('load_save_png.cpp'),
 	maek.CPP('gl_compile_program.cpp'),
@@ -167,12 +174,13 @@ const common_names = [
 	maek.CPP('BoneAnimation.cpp'),
 	maek.CPP('BoneLitColorTextureProgram.cpp'),
 	maek.CPP('Framebuffers.cpp'),
+	maek.CPP('DepthReconstruct.cpp'),
+	maek.CPP('DynamicResolution.cpp'),
 	maek.CPP('Sound.cpp'),
 	maek.CPP('load_wav.cpp'),
 	maek.CPP('load_opus.cpp'),
 	maek.CPP('GameObjects.cpp'),
-	maek.CPP('ShadowProgram.cpp'),
-	maek.CPP('FragCountQueryAsync.cpp')
+	maek.CPP('ShadowProgram.cpp')
 ];
 
 const show_meshes_names = [
@@ -191,6 +199,11 @@ const pack_sprites_names = [
 	maek.CPP('pack-sprites.cpp')
 ]
 
+//developer checks that don't need GL (see tests.cpp):
+const tests_names = [
+	maek.CPP('tests.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
@@ -199,9 +212,10 @@ const game_exe = maek.LINK([...game_names, ...common_names], 'dist/aperture');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
 const pack_sprites_exe = maek.LINK([...pack_sprites_names, ...common_names], 'sprites/pack-sprites');
+const tests_exe = maek.LINK([...tests_names, ...common_names], 'tests/aperture-tests');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, pack_sprites_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, pack_sprites_exe, tests_exe, ...copies];
 
 //the '[targets =] RULE(targets, prerequisites[, recipe])' rule defines a Makefile-style task
 // targets: array of targets the task produces (can include both files and ':abstract targets')
@@ -212,6 +226,11 @@ maek.RULE([':run'], [game_exe], [
 	[game_exe, '--some-command-line-option']
 ]);
 
+//'node Maekfile.js :test' runs the checks in tests.cpp (no window or GL context needed; fails if any check fails):
+maek.RULE([':test'], [tests_exe], [
+	[tests_exe]
+]);
+
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
 
@@ -38,6 +38,11 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 
 		total = GLuint(data.size()); //store total for later checks on index
 
+		positions.reserve(data.size());
+		for (auto const &vertex : data) {
+			positions.emplace_back(vertex.Position);
+		}
+
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
 		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
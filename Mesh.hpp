@@ -14,6 +14,7 @@
 #include <map>
 #include <limits>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
@@ -44,6 +45,8 @@ struct MeshBuffer {
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//...and a CPU-side copy of its vertex positions (e.g., for Scene::bake_static):
+	std::vector< glm::vec3 > positions;
 
 	//-- internals ---
 
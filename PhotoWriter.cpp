@@ -0,0 +1,139 @@
+#include "PhotoWriter.hpp"
+
+#include "load_save_png.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+PhotoWriter::PhotoWriter(std::string const &folder_) : folder(folder_), worker([this](){ run(); }) {
+}
+
+PhotoWriter::~PhotoWriter() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	worker.join();
+}
+
+uint32_t PhotoWriter::save(std::string const &title, glm::uvec2 size, std::shared_ptr< std::vector< glm::u8vec4 > const > pixels) {
+	assert(pixels && pixels->size() >= size_t(size.x) * size.y);
+	uint32_t ticket;
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		ticket = next_ticket++;
+		jobs.emplace_back(Job{ticket, title, size, std::move(pixels)});
+	}
+	wake.notify_one();
+	return ticket;
+}
+
+std::vector< PhotoWriter::Result > PhotoWriter::poll() {
+	std::vector< Result > ret;
+	std::unique_lock< std::mutex > lock(mutex);
+	ret.swap(results);
+	return ret;
+}
+
+uint32_t PhotoWriter::pending() const {
+	std::unique_lock< std::mutex > lock(mutex);
+	return uint32_t(jobs.size()) + busy;
+}
+
+void PhotoWriter::flush() {
+	std::unique_lock< std::mutex > lock(mutex);
+	idle.wait(lock, [this](){ return jobs.empty() && busy == 0; });
+}
+
+void PhotoWriter::run() {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [this](){ return quit || !jobs.empty(); });
+		//(queued pictures are still written when quitting)
+		if (jobs.empty()) break;
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		busy += 1;
+		lock.unlock();
+
+		Result result;
+		result.ticket = job.ticket;
+		auto before = std::chrono::high_resolution_clock::now();
+		write(job, &result);
+		result.ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+
+		lock.lock();
+		results.emplace_back(std::move(result));
+		busy -= 1;
+		if (jobs.empty() && busy == 0) idle.notify_all();
+	}
+}
+
+//split "Title12" into "Title" and 12 (no trailing digits means no suffix, i.e., 0):
+static std::pair< std::string, uint32_t > split_number(std::string const &stem) {
+	size_t end = stem.size();
+	while (end > 0 && stem.size() - end < 9 && stem[end - 1] >= '0' && stem[end - 1] <= '9') --end;
+	if (end == stem.size()) return std::make_pair(stem, 0U);
+	return std::make_pair(stem.substr(0, end), uint32_t(std::stoul(stem.substr(end))));
+}
+
+void PhotoWriter::load_index() {
+	index_loaded = true;
+	std::error_code ec;
+	std::filesystem::create_directories(folder, ec);
+
+	std::filesystem::path index_path = std::filesystem::path(folder) / IndexFilename;
+	std::ifstream index(index_path);
+	if (index) {
+		uint32_t number;
+		std::string title;
+		while (index >> number && index.get() == ' ' && std::getline(index, title)) {
+			uint32_t &next = next_number[title];
+			next = std::max(next, number);
+		}
+		return;
+	}
+
+	//no index yet (first run, or it was deleted), so take stock of what's in the folder once:
+	for (auto const &entry : std::filesystem::directory_iterator(folder, ec)) {
+		if (entry.path().extension() != ".png") continue;
+		auto split = split_number(entry.path().stem().string());
+		uint32_t &next = next_number[split.first];
+		next = std::max(next, split.second + 1);
+	}
+	std::ofstream out(index_path);
+	for (auto const &pair : next_number) {
+		out << pair.second << ' ' << pair.first << '\n';
+	}
+}
+
+void PhotoWriter::write(Job const &job, Result *result) {
+	if (!index_loaded) load_index();
+
+	//next free name (the check only fails if files were added behind the index's back):
+	uint32_t &next = next_number[job.title];
+	std::filesystem::path path;
+	std::error_code ec;
+	while (true) {
+		result->filename = job.title + (next == 0 ? "" : std::to_string(next)) + ".png";
+		path = std::filesystem::path(folder) / result->filename;
+		next += 1;
+		if (!std::filesystem::exists(path, ec)) break;
+	}
+
+	save_png(path.string(), job.size, job.pixels->data(), LowerLeftOrigin);
+	result->ok = std::filesystem::file_size(path, ec) > 0 && !ec;
+	if (!result->ok) {
+		std::cerr << "PhotoWriter: failed to write '" << path.string() << "'." << std::endl;
+		return;
+	}
+
+	//record the new next number (appending, so this stays cheap however big the album gets):
+	std::ofstream index(std::filesystem::path(folder) / IndexFilename, std::ios::app);
+	index << next << ' ' << job.title << '\n';
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+ * "PhotoWriter" saves pictures to the photo album folder on a background thread:
+ *  save() only queues the picture, and the worker picks a free filename, encodes the
+ *  png, and writes it; poll() hands back what has finished.
+ *
+ * Filenames are '<title>.png', '<title>1.png', '<title>2.png', ... as before; the next
+ *  free number for each title is kept in an index file in the folder ('album-index.txt',
+ *  one "<next number> <title>" line per save, later lines winning), so picking a name
+ *  doesn't have to probe the folder. If the index is missing, the folder is scanned once.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct PhotoWriter {
+	//album folder (created if needed, by the worker):
+	explicit PhotoWriter(std::string const &folder);
+	//finishes everything already queued before returning:
+	~PhotoWriter();
+	PhotoWriter(PhotoWriter const &) = delete;
+	PhotoWriter &operator=(PhotoWriter const &) = delete;
+
+	//queue a picture (RGBA, bottom row first, size.x * size.y pixels) to be saved; never touches the disk:
+	// returns a ticket that identifies the save in poll() results
+	uint32_t save(std::string const &title, glm::uvec2 size, std::shared_ptr< std::vector< glm::u8vec4 > const > pixels);
+
+	struct Result {
+		uint32_t ticket = 0;
+		std::string filename; //without the folder
+		bool ok = false;
+		float ms = 0.0f; //time the worker spent on this picture
+	};
+	//saves that have finished since the last call (call from the thread that calls save()):
+	std::vector< Result > poll();
+
+	//pictures queued or being written:
+	uint32_t pending() const;
+
+	//block until everything queued so far is written (e.g., for tests):
+	void flush();
+
+	std::string const folder;
+	static constexpr char const *IndexFilename = "album-index.txt";
+
+	//-- internals ---
+private:
+	struct Job {
+		uint32_t ticket;
+		std::string title;
+		glm::uvec2 size;
+		std::shared_ptr< std::vector< glm::u8vec4 > const > pixels;
+	};
+	void run(); //worker loop
+	void write(Job const &job, Result *result); //(on the worker)
+	void load_index(); //(on the worker, before the first write)
+
+	mutable std::mutex mutex;
+	std::condition_variable wake; //worker waits for jobs (or quit)
+	std::condition_variable idle; //flush() waits for the queue to drain
+	std::deque< Job > jobs;
+	std::vector< Result > results;
+	uint32_t next_ticket = 1;
+	uint32_t busy = 0; //jobs taken by the worker but not yet in 'results'
+	bool quit = false;
+
+	//only touched by the worker:
+	bool index_loaded = false;
+	std::unordered_map< std::string, uint32_t > next_number; //title -> next free number (0 means no suffix)
+
+	std::thread worker;
+};
@@ -13,13 +13,14 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <algorithm>
+#include <cassert>
 #include <utility>
 #include <filesystem>
 #include <math.h>
 
 const std::string Picture::adjectives[] = { "Majestic", "Beautiful", "Vibrant", "Grand", "Impressive", "Sublime", "Striking", "Marvelous", "Gorgeous", "Glamorous", "Divine", "Exquisite", "Stunning", "Breathtaking", "Graceful", "Dazzling", "Lovely", "Superb", "Radiant", "Great"};
 
-Picture::Picture(PictureInfo &stats, glm::vec3& player_pos) : dimensions(stats.dimensions), data(stats.data) {
+Picture::Picture(PictureInfo &stats, glm::vec3& player_pos) : dimensions(stats.dimensions) {
     if (stats.frag_counts.empty()) {
         title = "Pure Emptiness";
         score_elements.emplace_back("Relatable", (uint32_t)500);
@@ -38,13 +39,8 @@ Picture::Picture(PictureInfo &stats, glm::vec3& player_pos) : dimensions(stats.d
                           int total_score = creature_info.creature->score;
                           std::for_each(result.begin(), result.end(), [&](ScoreElement el) { total_score += el.value; });
                           float distance = glm::length(creature_info.player_to_creature) - creature_info.creature->radius;
-                          //calculate blur using same calculation as blur shader in Framebuffers.cpp
-                          float percent;
-                          if (distance < stats.focal_distance) {
-                              percent = 1 - std::clamp(1 - (float)pow(distance/stats.focal_distance, 2), 0.f, 1.f);
-                          } else {
-                              percent = 1 - std::clamp((abs(stats.focal_distance - distance) - stats.focal_distance)/(2 * stats.focal_distance), 0.f, 1.f);
-                          }
+                          //how in focus the creature is (the same curve the depth of field shader uses on screen)
+                          float percent = 1 - depth_of_field_blur(distance, stats.focal_distance);
                           scores.emplace_back(std::make_pair((uint32_t) (pow(percent, 2) * total_score), &creature_info));
                       });
         scores.sort([&](auto &a, auto &b) {
@@ -93,29 +89,50 @@ Picture::Picture(PictureInfo &stats, glm::vec3& player_pos) : dimensions(stats.d
             }
         }
 
-    // Create a texture for this picture, to be used for drawing it
-    {
-        // Upload the texture data to the GPU
+    // The picture stays on the GPU; take its textures over from the capture
+    tex = stats.texture;
+    thumbnail_tex = stats.thumbnail_tex;
+    thumbnail_size = stats.thumbnail_size;
+    stats.texture = 0;
+    stats.thumbnail_tex = 0;
+}
 
-        // Generate a new texture object name
-        glGenTextures(1, &tex);
+Picture::~Picture() {
+    thumbnail_atlas.release(*this);
+    if (tex != 0) glDeleteTextures(1, &tex);
+    if (thumbnail_tex != 0) glDeleteTextures(1, &thumbnail_tex);
+}
 
-        // Bind the new texture object
-        glBindTexture(GL_TEXTURE_2D, tex);
+void Picture::compact() {
+    pixels.reset();
+    if (tex != 0) {
+        glDeleteTextures(1, &tex);
+        tex = 0;
+    }
+}
 
-        // init the texture
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, (GLsizei)dimensions.x, (GLsizei)dimensions.y, 0, GL_RGB, GL_FLOAT, data->data());
+std::shared_ptr<std::vector<glm::u8vec4> const> Picture::read_pixels() {
+    if (pixels || tex == 0) return pixels;
 
-        // Set filtering and wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // The texture was finished long ago, so this only waits for the copy itself
+    auto rgba = std::make_shared<std::vector<glm::u8vec4>>(size_t(dimensions.x) * size_t(dimensions.y));
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba->data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GL_ERRORS();
+    pixels = rgba;
+    return pixels;
+}
 
-        // Unbind the texture object:
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
+size_t Picture::cpu_bytes() const {
+    return pixels ? pixels->size() * sizeof(glm::u8vec4) : 0;
+}
+
+size_t Picture::gpu_bytes() const {
+    size_t ret = size_t(thumbnail_size.x) * thumbnail_size.y * 4;
+    if (tex != 0) ret += size_t(dimensions.x) * size_t(dimensions.y) * 4 * 4 / 3; // (with mipmaps)
+    return ret;
 }
 
 std::list<ScoreElement> Picture::score_creature(PictureCreatureInfo &creature_info, PictureInfo &stats) {
@@ -255,34 +272,11 @@ std::list<std::string> Picture::get_scoring_strings() {
 }
 
 
-void Picture::save_picture_png() {
-
-    //convert pixel data to correct format for png export
-    std::vector<uint8_t>png_data(4 * (unsigned long)dimensions.x * (unsigned long)dimensions.y);
-    for (uint32_t i = 0; i < dimensions.x * dimensions.y; i++) {
-        png_data[i * 4] = (uint8_t)round(std::clamp((*data)[i * 3], 0.f, 1.f) * 255);
-        png_data[i * 4 + 1] = (uint8_t)round(std::clamp((*data)[i * 3 + 1], 0.f, 1.f) * 255);
-        png_data[i * 4 + 2] = (uint8_t)round(std::clamp((*data)[i * 3 + 2], 0.f, 1.f) * 255);
-        png_data[i * 4 + 3] = 255;
-    }
-    // create album folder if it doesn't exist
-    if (!std::filesystem::exists(data_path("PhotoAlbum/"))) {
-        std::filesystem::create_directory(data_path("PhotoAlbum/"));
-    }
-    //save pic if name is unique
-    if (!std::filesystem::exists(data_path("PhotoAlbum/" + title + ".png"))) {
-        save_png(data_path("PhotoAlbum/" + title + ".png"), dimensions,
-                 reinterpret_cast<const glm::u8vec4*>(png_data.data()), LowerLeftOrigin);
-    } else {
-        //enumerate file name
-        for(uint16_t count = 1; count < 9999; count++) {
-            if (!std::filesystem::exists(data_path("PhotoAlbum/" + title + std::to_string(count) + ".png"))) {
-                save_png(data_path("PhotoAlbum/" + title + std::to_string(count) + ".png"), dimensions,
-                         reinterpret_cast<const glm::u8vec4*>(png_data.data()), LowerLeftOrigin);
-                break;
-            }
-        }
-    }
+uint32_t Picture::save_picture_png(PhotoWriter &writer) {
+    std::shared_ptr<std::vector<glm::u8vec4> const> rgba = read_pixels();
+    if (!rgba) return 0;
+    //naming and encoding happen on the writer's thread:
+    return writer.save(title, glm::uvec2(dimensions), rgba);
 }
 
 // Picture drawing stuff (Based on DrawSprites)
@@ -426,8 +420,10 @@ void DrawPicture::draw(glm::vec2 const& center, float scale, glm::u8vec4 const&
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     //bind the sprite texture to location zero:
+    // (the thumbnail if it has enough texels for the size on screen, or if the full size copy has been freed)
+    float screen_width = (max.x - min.x) * to_clip[0][0] * 0.5f * float(drawable_size.x);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, pic.tex);
+    glBindTexture(GL_TEXTURE_2D, (pic.tex == 0 || screen_width <= float(pic.thumbnail_size.x)) ? pic.thumbnail_tex : pic.tex);
 
     //run the OpenGL pipeline:
     glDrawArrays(GL_TRIANGLES, 0, GLsizei(attribs.size()));
@@ -440,4 +436,171 @@ void DrawPicture::draw(glm::vec2 const& center, float scale, glm::u8vec4 const&
 
     //reset current program to none:
     glUseProgram(0);
-}
\ No newline at end of file
+}
+// Thumbnail atlas
+
+ThumbnailAtlas thumbnail_atlas;
+
+uint32_t ThumbnailAtlas::acquire(Picture const& pic) {
+    // already there:
+    if (pic.atlas_slot != -1U) {
+        assert(pic.atlas_slot < owners.size() && owners[pic.atlas_slot] == &pic);
+        last_drawn[pic.atlas_slot] = frame;
+        return pic.atlas_slot;
+    }
+
+    GLuint thumbnail_tex = pic.thumbnail_tex;
+    glm::uvec2 thumbnail_size = pic.thumbnail_size;
+    if (thumbnail_tex == 0 || thumbnail_size.x == 0 || thumbnail_size.y == 0) return -1U;
+
+    if (tex == 0) {
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, Columns * SlotWidth, Rows * SlotHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &read_fb);
+        glGenFramebuffers(1, &draw_fb);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fb);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+        slot_sizes.assign(Columns * Rows, glm::uvec2(0));
+        owners.assign(Columns * Rows, nullptr);
+        last_drawn.assign(Columns * Rows, 0);
+        // hand out low slots first:
+        for (uint32_t slot = Columns * Rows; slot > 0; --slot) {
+            free_slots.emplace_back(slot - 1);
+        }
+        GL_ERRORS();
+    }
+
+    // take a free slot, or else the one drawn least recently (but not this frame):
+    uint32_t slot = -1U;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        for (uint32_t s = 0; s < owners.size(); ++s) {
+            if (last_drawn[s] == frame) continue;
+            if (slot == -1U || last_drawn[s] < last_drawn[slot]) slot = s;
+        }
+        if (slot == -1U) return -1U;
+        owners[slot]->atlas_slot = -1U; // (it gets a slot again the next time it is drawn)
+    }
+    owners[slot] = &pic;
+    last_drawn[slot] = frame;
+    pic.atlas_slot = slot;
+
+    // keep the thumbnail's aspect, shrinking it if it doesn't fit:
+    glm::uvec2 size = thumbnail_size;
+    if (size.x > SlotWidth || size.y > SlotHeight) {
+        float s = std::min(float(SlotWidth) / float(size.x), float(SlotHeight) / float(size.y));
+        size = glm::max(glm::uvec2(glm::round(glm::vec2(size) * s)), glm::uvec2(1));
+    }
+    slot_sizes[slot] = size;
+
+    // copy on the GPU (nothing waits on this):
+    glm::uvec2 origin = glm::uvec2((slot % Columns) * SlotWidth, (slot / Columns) * SlotHeight);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fb);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, thumbnail_tex, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fb);
+    glBlitFramebuffer(0, 0, thumbnail_size.x, thumbnail_size.y,
+                      origin.x, origin.y, origin.x + size.x, origin.y + size.y,
+                      GL_COLOR_BUFFER_BIT, size == thumbnail_size ? GL_NEAREST : GL_LINEAR);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    GL_ERRORS();
+
+    copies += 1;
+    dirty = true;
+    return slot;
+}
+
+void ThumbnailAtlas::release(Picture const& pic) {
+    uint32_t slot = pic.atlas_slot;
+    if (slot == -1U) return;
+    assert(slot < owners.size() && owners[slot] == &pic);
+    slot_sizes[slot] = glm::uvec2(0);
+    owners[slot] = nullptr;
+    free_slots.emplace_back(slot);
+    pic.atlas_slot = -1U;
+    dirty = true;
+}
+
+void ThumbnailAtlas::draw(std::vector<Quad> const& quads, glm::uvec2 const& drawable_size) {
+    // (slots acquired since the last call were this frame's; from here on, they can be handed to other pictures)
+    frame += 1;
+    if (quads.empty()) return;
+    assert(tex != 0 && "quads refer to slots, so something must have been added");
+
+    if (vao == 0) {
+        glGenBuffers(1, &buffer);
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        // same layout as DrawPicture:
+        glVertexAttribPointer(color_texture_program->Position_vec4, 2, GL_FLOAT, GL_FALSE, sizeof(DrawPicture::Vertex), (GLbyte*)0 + offsetof(DrawPicture::Vertex, Position));
+        glEnableVertexAttribArray(color_texture_program->Position_vec4);
+        glVertexAttribPointer(color_texture_program->TexCoord_vec2, 2, GL_FLOAT, GL_FALSE, sizeof(DrawPicture::Vertex), (GLbyte*)0 + offsetof(DrawPicture::Vertex, TexCoord));
+        glEnableVertexAttribArray(color_texture_program->TexCoord_vec2);
+        glVertexAttribPointer(color_texture_program->Color_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DrawPicture::Vertex), (GLbyte*)0 + offsetof(DrawPicture::Vertex, Color));
+        glEnableVertexAttribArray(color_texture_program->Color_vec4);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+        GL_ERRORS();
+    }
+
+    // vertices are in clip space, so the same quads on the same size screen can be drawn straight from last frame's buffer:
+    if (dirty || drawable_size != uploaded_drawable_size || quads != uploaded) {
+        glm::vec2 to_clip = glm::vec2(2.0f) / glm::vec2(drawable_size);
+        glm::vec2 texel = glm::vec2(1.0f) / glm::vec2(Columns * SlotWidth, Rows * SlotHeight);
+        std::vector<DrawPicture::Vertex> attribs;
+        attribs.reserve(6 * quads.size());
+        for (Quad const& q : quads) {
+            assert(q.slot < slot_sizes.size() && slot_sizes[q.slot] != glm::uvec2(0));
+            glm::vec2 min = q.min * to_clip - 1.0f;
+            glm::vec2 max = q.max * to_clip - 1.0f;
+            glm::vec2 origin = glm::vec2((q.slot % Columns) * SlotWidth, (q.slot / Columns) * SlotHeight);
+            glm::vec2 min_tc = origin * texel;
+            glm::vec2 max_tc = (origin + glm::vec2(slot_sizes[q.slot])) * texel;
+
+            attribs.emplace_back(glm::vec2(min.x, min.y), glm::vec2(min_tc.x, min_tc.y), q.tint);
+            attribs.emplace_back(glm::vec2(max.x, min.y), glm::vec2(max_tc.x, min_tc.y), q.tint);
+            attribs.emplace_back(glm::vec2(max.x, max.y), glm::vec2(max_tc.x, max_tc.y), q.tint);
+
+            attribs.emplace_back(glm::vec2(min.x, min.y), glm::vec2(min_tc.x, min_tc.y), q.tint);
+            attribs.emplace_back(glm::vec2(max.x, max.y), glm::vec2(max_tc.x, max_tc.y), q.tint);
+            attribs.emplace_back(glm::vec2(min.x, max.y), glm::vec2(min_tc.x, max_tc.y), q.tint);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, attribs.size() * sizeof(attribs[0]), attribs.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        uploaded = quads;
+        uploaded_drawable_size = drawable_size;
+        dirty = false;
+        uploads += 1;
+    }
+
+    glUseProgram(color_texture_program->program);
+    glUniformMatrix4fv(color_texture_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+    glBindVertexArray(vao);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    glDrawArrays(GL_TRIANGLES, 0, GLsizei(6 * uploaded.size()));
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
@@ -2,6 +2,7 @@
 
 #include "Scene.hpp"
 #include "GameObjects.hpp"
+#include "PhotoWriter.hpp"
 #include <glm/glm.hpp>
 #include <iostream>
 #include <unordered_set>
@@ -26,7 +27,10 @@ struct PictureCreatureInfo {
 //data about the picture that is used for scoring
 struct PictureInfo {
     glm::vec2 dimensions;
-    std::shared_ptr<std::vector<GLfloat>> data;
+    // the picture, on the GPU (see Scene::PictureCapture); Picture takes these over:
+    GLuint texture = 0;
+    GLuint thumbnail_tex = 0;
+    glm::uvec2 thumbnail_size = glm::uvec2(0);
 
     float focal_distance;
     glm::vec3 angle;
@@ -43,12 +47,20 @@ struct Picture {
 
     Picture() = default;
     Picture(const Picture&) { std::cout << "yes\n"; }
-    explicit Picture(PictureInfo &stats, glm::vec3& player_pos);
+    explicit Picture(PictureInfo &stats, glm::vec3& player_pos); // takes over stats' textures
+    ~Picture();
 
     glm::vec2 dimensions;
-    // TODO: we probably don't need both of these
-    std::shared_ptr<std::vector<GLfloat>> data; // used to save pic to png
-    GLuint tex = 0; // used to draw picture
+    // 8 bits per channel is all a png (or the screen) gets, and the tone-mapped values are already display (sRGB) encoded:
+    GLuint tex = 0; // used to draw picture large (GL_RGBA8, with mipmaps)
+    GLuint thumbnail_tex = 0; // used to draw picture small (GL_RGBA8, Scene::PictureCapture::ThumbnailWidth wide)
+    glm::uvec2 thumbnail_size = glm::uvec2(0);
+    mutable uint32_t atlas_slot = -1U; // copy of the thumbnail in thumbnail_atlas, while it's being shown (-1U if not; see ThumbnailAtlas::acquire)
+    std::shared_ptr<std::vector<glm::u8vec4> const> pixels; // CPU copy of tex (RGBA, bottom row first), only once something asks for it
+    std::shared_ptr<std::vector<glm::u8vec4> const> read_pixels(); // read tex back (if not already), e.g. to save pic to png; null once compacted
+    void compact(); // frees pixels and tex once they aren't needed (saved or skipped); the thumbnail stays
+    size_t cpu_bytes() const; // memory held for this picture (not counting score info)
+    size_t gpu_bytes() const;
 
     std::string title; //generate a silly title based on subject of title + adjective?
     std::list<ScoreElement> score_elements;
@@ -57,13 +69,14 @@ struct Picture {
     uint32_t get_total_score();
     std::string get_scoring_string();
     std::list<std::string> get_scoring_strings(); // list of scoring elements formatted for picture reviewing
-    void save_picture_png(); // saves picture as a png to dist/PhotoAlbum/ (creating folder if needed)
+    uint32_t save_picture_png(PhotoWriter &writer); // queues picture to be saved as a png in the writer's album (dist/PhotoAlbum/); returns the writer's ticket (0 if already compacted)
 
     static const std::string adjectives[];
 };
 
 // TODO: currently one of these is getting constructed for every picture being drawn in a frame
 // Should probably have one struct handle a list of pictures to draw, and maybe cache those resources to avoid setting everything up for every pic every frame
+// (thumbnail-sized pictures can go through ThumbnailAtlas, below, which does that)
 // Based on DrawSprites
 struct DrawPicture {
 
@@ -84,3 +97,46 @@ struct DrawPicture {
     // draw the picture with given parameters
     void draw(glm::vec2 const& center, float scale = 1.0f, glm::u8vec4 const& tint = glm::u8vec4(0xff, 0xff, 0xff, 0xff));
 };
+
+// Thumbnails of the pictures being shown, copied (on the GPU) into slots of one big texture,
+// so a page full of pictures (the journal) is one vertex buffer and one draw call however many pictures there are.
+// Pictures only get a slot when they are drawn, and keep it until they are freed or the slot is needed by
+// a picture being drawn now (least recently drawn first), so any number of pictures can be taken over a game
+struct ThumbnailAtlas {
+    static constexpr uint32_t SlotWidth = 320, SlotHeight = 240; // thumbnails bigger than this are scaled down to fit
+    static constexpr uint32_t Columns = 6, Rows = 8; // 48 slots in a 1920x1920 texture
+
+    // slot holding pic's thumbnail, copying it in if it isn't there already; call every frame pic is drawn, before draw():
+    // returns -1U if every slot is in use this frame (draw that picture with DrawPicture instead)
+    uint32_t acquire(Picture const& pic);
+    // give up pic's slot (if it has one):
+    void release(Picture const& pic);
+
+    struct Quad {
+        uint32_t slot;
+        glm::vec2 min, max; // in drawable pixels
+        glm::u8vec4 tint = glm::u8vec4(0xff);
+        bool operator==(Quad const& o) const { return slot == o.slot && min == o.min && max == o.max && tint == o.tint; }
+    };
+    // draw quads in one call; the vertex buffer is only refilled when the quads (or drawable size, or slots) change
+    void draw(std::vector<Quad> const& quads, glm::uvec2 const& drawable_size);
+
+    // GL objects are made on first use:
+    GLuint tex = 0;
+    GLuint read_fb = 0, draw_fb = 0; // for blitting thumbnails in
+    GLuint buffer = 0, vao = 0;
+    std::vector<glm::uvec2> slot_sizes; // texels used in each slot (0,0 if free)
+    std::vector<Picture const*> owners; // picture in each slot (nullptr if free)
+    std::vector<uint32_t> last_drawn; // value of 'frame' when each slot was last acquired
+    std::vector<uint32_t> free_slots;
+    uint32_t frame = 1; // bumped by every draw()
+    uint32_t copies = 0; // thumbnails copied in (see F3 stats)
+
+    // what's in buffer:
+    std::vector<Quad> uploaded;
+    glm::uvec2 uploaded_drawable_size = glm::uvec2(0);
+    bool dirty = true;
+    uint32_t uploads = 0; // times buffer was refilled (see F3 stats)
+};
+
+extern ThumbnailAtlas thumbnail_atlas;
@@ -75,11 +75,15 @@ Load< SpriteAtlas > ui_sprites_atlas(LoadTagDefault, []() -> SpriteAtlas const*
 
 GLuint main_meshes_for_lit_color_texture_program = 0;
 GLuint main_meshes_for_depth_program = 0;
+GLuint main_meshes_for_instanced_lit_color_texture_program = 0;
+GLuint main_meshes_for_instanced_depth_program = 0;
 GLuint main_meshes_for_bone_lit_color_texture_program = 0;
 Load< MeshBuffer > main_meshes(LoadTagDefault, []() -> MeshBuffer const * {
 	MeshBuffer const *ret = new MeshBuffer(data_path("assets/proto-world2.pnct"));
 	main_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
     main_meshes_for_depth_program = ret->make_vao_for_program(shadow_program->program);
+    main_meshes_for_instanced_lit_color_texture_program = ret->make_vao_for_program(instanced_lit_color_texture_program->program);
+    main_meshes_for_instanced_depth_program = ret->make_vao_for_program(instanced_shadow_program->program);
 	return ret;
 });
 
@@ -153,6 +157,10 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
         //unlock drawables
         lock.unlock();
 
+        //bounds for frustum culling:
+        drawable.bbox_min = mesh.min;
+        drawable.bbox_max = mesh.max;
+
         //to find if creature (has anims)
         auto is_creature = [&](std::pair< std::string, CreatureStats > pair) {
             return pair.first == transform->name.substr(0, 3);
@@ -166,12 +174,10 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
             //animated object pipeline setup
 			drawable.pipeline[Scene::Drawable::ProgramTypeDefault] = bone_lit_color_texture_program_pipeline;
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault].type = mesh.type;
-            //set roughnesses, possibly should be from csv??
-            drawable.roughness = 0.9f;
-            //this will get changed later
-            drawable.pipeline[Scene::Drawable::ProgramTypeDefault].set_uniforms = [drawable](){
-                glUniform1f(bone_lit_color_texture_program->ROUGHNESS_float, drawable.roughness);
-            };
+            //animation moves vertices away from the bind pose, so pad the mesh bounds:
+            glm::vec3 pad = 0.5f * (mesh.max - mesh.min);
+            drawable.bbox_min = mesh.min - pad;
+            drawable.bbox_max = mesh.max + pad;
 
             //Set up depth program
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].program = bone_shadow_program_pipeline.program;
@@ -179,6 +185,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
 
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_TO_CLIP_mat4 = bone_shadow_program_pipeline.OBJECT_TO_CLIP_mat4;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_TO_LIGHT_mat4x3 = bone_shadow_program_pipeline.OBJECT_TO_LIGHT_mat4x3;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_ID_uint = bone_shadow_program_pipeline.OBJECT_ID_uint; //(for the picture ID pass)
 
             switch(creature_index) {
                 case 0: {
@@ -188,6 +195,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = FLO_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = FLO_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = FLO_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = FLO_banims->positions.data();
                     break;
                 }
                 case 1: {
@@ -195,6 +203,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = MEP_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = MEP_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = MEP_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = MEP_banims->positions.data();
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = MEP_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = MEP_banims->mesh.count;
                     break;
@@ -204,6 +213,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = TAN_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = TAN_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = TAN_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = TAN_banims->positions.data();
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = TAN_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = TAN_banims->mesh.count;
                     break;
@@ -213,6 +223,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = TRI_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = TRI_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = TRI_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = TRI_banims->positions.data();
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = TRI_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = TRI_banims->mesh.count;
                     break;
@@ -222,6 +233,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = SNA_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = SNA_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = SNA_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = SNA_banims->positions.data();
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = SNA_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = SNA_banims->mesh.count;
                     break;
@@ -231,6 +243,7 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = PEN_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = PEN_banims->mesh.count;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = PEN_banims_for_bone_shadow_program;
+                    drawable.cpu_positions = PEN_banims->positions.data();
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = PEN_banims->mesh.start;
                     drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = PEN_banims->mesh.count;
                     break;
@@ -245,37 +258,45 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault] = lit_color_texture_program_pipeline;
 
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault].vao = main_meshes_for_lit_color_texture_program;
+            drawable.pipeline[Scene::Drawable::ProgramTypeDefault].instanced_vao = main_meshes_for_instanced_lit_color_texture_program;
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault].type = mesh.type;
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault].start = mesh.start;
             drawable.pipeline[Scene::Drawable::ProgramTypeDefault].count = mesh.count;
 
-            //set roughnesses, possibly should be from csv??
-            drawable.roughness = 0.9f;
-            drawable.pipeline[Scene::Drawable::ProgramTypeDefault].set_uniforms = [drawable](){
-                glUniform1f(lit_color_texture_program->ROUGHNESS_float, drawable.roughness);
-            };
-
             //Set up depth program
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].program = shadow_program_pipeline.program;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].vao = main_meshes_for_depth_program;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].type = mesh.type;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].start = mesh.start;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].count = mesh.count;
+            drawable.cpu_positions = main_meshes->positions.data();
 
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_TO_CLIP_mat4 = shadow_program_pipeline.OBJECT_TO_CLIP_mat4;
             drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_TO_LIGHT_mat4x3 = shadow_program_pipeline.OBJECT_TO_LIGHT_mat4x3;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].OBJECT_ID_uint = shadow_program_pipeline.OBJECT_ID_uint; //(for the picture ID pass)
+
+            //instanced variant, for copies of the same mesh:
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].instanced_program = shadow_program_pipeline.instanced_program;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].instanced_vao = main_meshes_for_instanced_depth_program;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].WORLD_TO_CLIP_mat4 = shadow_program_pipeline.WORLD_TO_CLIP_mat4;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].WORLD_TO_LIGHT_mat4x3 = shadow_program_pipeline.WORLD_TO_LIGHT_mat4x3;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].BATCHED_bool = shadow_program_pipeline.BATCHED_bool;
+            drawable.pipeline[Scene::Drawable::ProgramTypeShadow].SLOTS_BASE_int = shadow_program_pipeline.SLOTS_BASE_int;
         }
 
         // load texture for object if one exists, supports only 1 texture for now
 		// texture must share name with transform in scene ( "assets/textures/{transform->name}.png" )
         // file existence check from https://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exists-using-standard-c-c11-14-17-c
 		std::string identifier = transform->name.substr(0, 6);
-        if (std::filesystem::exists(data_path("assets/textures/" + identifier + ".png"))) {
-            drawable.uses_vertex_color = false;
-        } else {
-            //no texture found, using vertex colors
-            drawable.uses_vertex_color = true;
-        }
+        Scene::Material material;
+        //set roughnesses, possibly should be from csv??
+        material.roughness = 0.9f;
+        //no texture found, using vertex colors
+        material.uses_vertex_color = !std::filesystem::exists(data_path("assets/textures/" + identifier + ".png"));
+        //material table is shared by all drawables, so lock it:
+        lock.lock();
+        drawable.material = scene.add_material(material);
+        lock.unlock();
     });
 });
 
@@ -312,8 +333,8 @@ Load< std::unordered_map<std::string, Sound::Sample> > audio_samples(LoadTagDefa
 
 
 //* -------- Mode initializationand cleanup ---------- */
-PlayMode::PlayMode() : scene(*main_scene) {
-	
+PlayMode::PlayMode() : scene(*main_scene), photo_writer(data_path("PhotoAlbum/")) {
+
     // Change depth buffer comparison function to be leq instead of less to correctly occlude in object detection
     glDepthFunc(GL_LEQUAL);
 
@@ -383,6 +404,8 @@ PlayMode::PlayMode() : scene(*main_scene) {
             if (trans.name == id_code) {
                 creature.transform = &trans;
                 creature.drawable = &draw;
+                //creatures move every frame, so keep them in the refit-only part of the scene's BVH:
+                draw.dynamic = true;
             }
 
             if (trans.name.length() >= 10 && trans.name.substr(7, 3) == "foc") {
@@ -422,10 +445,25 @@ PlayMode::PlayMode() : scene(*main_scene) {
             pair.second.original_pos = pair.second.transform->position;
         }
     }
+
+    //bake static scenery for the shadow and depth passes (after creatures are marked dynamic, so they're left out):
+    {
+        scene.baked.program = baked_shadow_program->program;
+        scene.baked.WORLD_TO_CLIP_mat4 = baked_shadow_program->WORLD_TO_CLIP_mat4;
+        scene.baked.WORLD_TO_LIGHT_mat4x3 = baked_shadow_program->WORLD_TO_LIGHT_mat4x3;
+        scene.bake_static(main_meshes_for_depth_program, main_meshes->positions, shadow_program_pipeline.textures[0].texture);
+    }
+
+    //bounding boxes for occlusion queries (F4 turns them on):
+    scene.occlusion_box.program = occlusion_box_program->program;
+    scene.occlusion_box.WORLD_TO_CLIP_mat4 = occlusion_box_program->WORLD_TO_CLIP_mat4;
+    scene.occlusion_box.BOX_MIN_vec3 = occlusion_box_program->BOX_MIN_vec3;
+    scene.occlusion_box.BOX_MAX_vec3 = occlusion_box_program->BOX_MAX_vec3;
 }
 
 PlayMode::~PlayMode() {
 	delete player;
+	picture_framebuffers.release();
     Sound::sample_map = nullptr;
 }
 
@@ -490,6 +528,32 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 			del.downs += 1;
 			del.pressed = true;
 		}
+		else if (evt.key.keysym.sym == SDLK_F3) {
+			print_render_stats = !print_render_stats;
+			render_stats_timer = 0.0f;
+			return true;
+		}
+		else if (evt.key.keysym.sym == SDLK_F4) {
+			scene.use_occlusion_queries = !scene.use_occlusion_queries;
+			std::cout << "occlusion queries " << (scene.use_occlusion_queries ? "on" : "off") << std::endl;
+			return true;
+		}
+		else if (evt.key.keysym.sym == SDLK_F5) {
+			player->player_camera->validate_soft_raster = !player->player_camera->validate_soft_raster;
+			std::cout << "soft raster validation " << (player->player_camera->validate_soft_raster ? "on" : "off") << std::endl;
+			return true;
+		}
+		else if (evt.key.keysym.sym == SDLK_F6) {
+			framebuffers.dof_pyramid = !framebuffers.dof_pyramid;
+			std::cout << "depth of field " << (framebuffers.dof_pyramid ? "half/quarter size pyramid" : "full size blur") << std::endl;
+			return true;
+		}
+		else if (evt.key.keysym.sym == SDLK_F7) {
+			dynamic_resolution.enabled = !dynamic_resolution.enabled;
+			if (!dynamic_resolution.enabled) dynamic_resolution.set_scale(dynamic_resolution.max_scale);
+			std::cout << "dynamic resolution " << (dynamic_resolution.enabled ? "on" : "off") << std::endl;
+			return true;
+		}
 	} else if (evt.type == SDL_KEYUP) {
 		if (evt.key.keysym.sym == SDLK_a) {
 			left.pressed = false;
@@ -582,6 +646,7 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 void PlayMode::update(float elapsed) {
 
 	time_of_day += elapsed * time_scale * time_scale_debug;
+	render_stats_timer += elapsed;
 
 	switch (cur_state) {
 		case menu:
@@ -598,6 +663,14 @@ void PlayMode::update(float elapsed) {
 			break;
 	}
 
+	// Report pics the photo writer has finished with
+	for (auto const &result : photo_writer.poll()) {
+		save_status = (result.ok ? "Saved " : "Couldn't save ") + result.filename;
+		save_status_timer = 3.0f;
+		std::cout << save_status << " (" << result.ms << " ms on the writer thread)" << std::endl;
+	}
+	save_status_timer = std::max(0.0f, save_status_timer - elapsed);
+
 	// Loop day timer
 	if (time_of_day > day_length) {
 		time_of_day = 0.0f;
@@ -627,39 +700,57 @@ void PlayMode::update(float elapsed) {
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
+	// A frame a picture is taken from is drawn at full size, and left out of dynamic_resolution's timing (it'd look slow):
+	bool take_picture = picture_requested && cur_state == playing && player->in_cam_view;
+	picture_requested = false;
+	if (!take_picture) dynamic_resolution.begin_frame();
+
+	// The 3D view is drawn at render_size (the window's size, unless dynamic_resolution has scaled it down):
+	glm::uvec2 render_size = dynamic_resolution.render_size(drawable_size);
+
+	// ...if it has, a picture's frame is drawn into picture_framebuffers instead, so neither set is resized:
+	bool picture_targets = (take_picture && render_size != drawable_size);
+	if (picture_targets) {
+		render_size = drawable_size;
+		picture_framebuffers.msaa_samples = framebuffers.msaa_samples;
+		picture_framebuffers.dof_pyramid = framebuffers.dof_pyramid;
+		picture_framebuffers.time_passes = framebuffers.time_passes;
+		std::swap(framebuffers, picture_framebuffers);
+		picture_framebuffers_idle = 0;
+	} else if (picture_framebuffers.size != glm::uvec2(0) && ++picture_framebuffers_idle > Framebuffers::TransientIdleRuns) {
+		picture_framebuffers.release();
+	}
 
 	// Update camera aspect ratios for drawable
 	{
 		active_camera->aspect = float(drawable_size.x) / float(drawable_size.y);
-		active_camera->drawable_size = drawable_size;
+		active_camera->drawable_size = render_size; //(pictures are taken at this size)
 
         // Based on: https://github.com/15-466/15-466-f20-framebuffer
-        // Make sure framebuffers are the same size as the window:
-        framebuffers.realloc(drawable_size, glm::vec2(1024, 1024));
+        // Make sure framebuffers are the same size as the 3D view:
+        framebuffers.realloc(render_size, glm::vec2(1024, 1024));
 	}
 
+	// Rebuild world matrices once, parents first, so the passes below only hit the cache:
+	scene.transforms.update_world_matrices();
+	// ...and the world-space bounds used for frustum culling:
+	scene.update_world_bounds();
+	for (auto &stats : scene.pass_stats) stats = Scene::PassStats();
+
+	// Passes are declared to a frame graph, which skips the ones nothing uses and shares transient targets between them (see FrameGraph)
+	FrameGraph graph;
+
 	// Handle scene lighting, forward lighting based on https://github.com/15-466/15-466-f19-base6/blob/master/DemoLightingForwardMode.cpp
 	{
         glm::vec3 eye = active_camera->transform->make_local_to_world()[3];
 
-        // Compute light uniforms:
-        GLsizei lights = uint32_t(scene.lights.size() + 2);
-        // Clamp lights to maximum lights allowed by shader:
-        lights = std::min< uint32_t >(lights, LitColorTextureProgram::MaxLights);
-
-        // Lighting information vectors
-        std::vector< int32_t > light_type; light_type.reserve(lights);
-        std::vector< glm::vec3 > light_location; light_location.reserve(lights);
-        std::vector< glm::vec3 > light_direction; light_direction.reserve(lights);
-        std::vector< glm::vec3 > light_energy; light_energy.reserve(lights);
-        std::vector< float > light_cutoff; light_cutoff.reserve(lights);
-
+        // Sky and sun lights change with the time of day, so they are recomputed every frame
+        // (scene lights follow them in the Lights block; see Scene::upload_lights):
+        std::vector< Scene::LightData > sky_lights(2);
         // Hemisphere light is 1
-        light_type.emplace_back(1);
-        light_cutoff.emplace_back(1.0f);
-        // Sun/Moon is 2
-        light_type.emplace_back(3);
-        light_cutoff.emplace_back(1.0f);
+        sky_lights[0].type = 1;
+        // Sun/Moon is 3
+        sky_lights[1].type = 3;
 
 		// Calculate brightness of sun/moon based in time of day
         // Fix "jump" at day/night switch over, by letting brightnesses reach zero and turning up ambient lighting
@@ -702,136 +793,107 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
         fog_intensity = 0.6f + 0.4f * (1 - brightness);
         fog_color = glm::vec3(0.4f) + 0.6f * sky_color;
 
-        // Push calculated sky lighting uniforms
-        light_direction.emplace_back(glm::vec3(0, 0, -1.f));
-        light_energy.emplace_back(ambient_color);
-        light_location.emplace_back(glm::vec3(0, 0, 100));
-        // Push calculated sun lighting uniforms
-        light_direction.emplace_back(sun_angle);
-        light_energy.emplace_back(sun_color);
-        light_location.emplace_back(player->transform->position - sun_angle * 50.f);
-
-        // Other lights setup
-        for (auto const &light : scene.lights) {
-            if (light.type == Scene::Light::Hemisphere || light.type == Scene::Light::Directional) {
-				std::cout << "Only one hemisphere & directional light is allowed! Not adding this one!" << std::endl;
-                continue;
-            }
+        // Sky lighting
+        sky_lights[0].direction = glm::vec3(0, 0, -1.f);
+        sky_lights[0].energy = ambient_color;
+        sky_lights[0].location = glm::vec3(0, 0, 100);
+        // Sun lighting
+        sky_lights[1].direction = sun_angle;
+        sky_lights[1].energy = sun_color;
+        sky_lights[1].location = player->transform->position - sun_angle * 50.f;
 
-            glm::mat4 light_to_world = light.transform->make_local_to_world();
-            // Set up lighting information for this light:
-            light_location.emplace_back(glm::vec3(light_to_world[3]));
-            light_direction.emplace_back(glm::vec3(-light_to_world[2]));
-            light_energy.emplace_back(light.energy);
-
-            if (light.type == Scene::Light::Point) {
-                light_type.emplace_back(0);
-                light_cutoff.emplace_back(1.0f);
-            } else if (light.type == Scene::Light::Spot) {
-                light_type.emplace_back(2);
-                light_cutoff.emplace_back(std::cos(0.5f * light.spot_fov));
-            }
-
-            // Skip remaining lights if maximum light count reached:
-			if (light_type.size() == (uint32_t)lights) {
-				std::cout << "Max light count reached!" << std::endl;
-				break;
-			}
-        }
-
-        // Set up sky lighting uniforms for lit_color_texture_program:
-        glUseProgram(lit_color_texture_program->program);
-
-        glUniform3fv(lit_color_texture_program->EYE_vec3, 1, glm::value_ptr(eye));
-        glUniform1ui(lit_color_texture_program->LIGHTS_uint, (GLuint) lights);
-        glUniform1iv(lit_color_texture_program->LIGHT_TYPE_int_array, lights, light_type.data());
-        glUniform3fv(lit_color_texture_program->LIGHT_LOCATION_vec3_array, lights, glm::value_ptr(light_location[0]));
-        glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3_array, lights, glm::value_ptr(light_direction[0]));
-        glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3_array, lights, glm::value_ptr(light_energy[0]));
-        glUniform1fv(lit_color_texture_program->LIGHT_CUTOFF_float_array, lights, light_cutoff.data());
-
-        // Bone textures
-        glUseProgram(bone_lit_color_texture_program->program);
-        glUniform3fv(bone_lit_color_texture_program->EYE_vec3, 1, glm::value_ptr(eye));
-        glUniform1ui(bone_lit_color_texture_program->LIGHTS_uint, (GLuint) lights);
-        glUniform1iv(bone_lit_color_texture_program->LIGHT_TYPE_int_array, lights, light_type.data());
-        glUniform3fv(bone_lit_color_texture_program->LIGHT_LOCATION_vec3_array, lights, glm::value_ptr(light_location[0]));
-        glUniform3fv(bone_lit_color_texture_program->LIGHT_DIRECTION_vec3_array, lights, glm::value_ptr(light_direction[0]));
-        glUniform3fv(bone_lit_color_texture_program->LIGHT_ENERGY_vec3_array, lights, glm::value_ptr(light_energy[0]));
-        glUniform1fv(bone_lit_color_texture_program->LIGHT_CUTOFF_float_array, lights, light_cutoff.data());
+        // One upload of the Lights block, shared by every lit program:
+        scene.upload_lights(eye, sky_lights);
 
         GL_ERRORS();
 
-        //Draw scene to shadow map for spotlight, adapted from https://github.com/ixchow/15-466-f18-base3
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.shadow_fb);
-        glViewport(0, 0, framebuffers.shadow_size.x, framebuffers.shadow_size.y);
-
-        glClearColor(1.0f, 0.0f, 1.0f, 0.0f); //clear color for shadow buffer
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_BLEND);
-        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-
-        //render only back faces to shadow map (prevent shadow speckles on fronts of objects):
-        glCullFace(GL_FRONT);
-        glEnable(GL_CULL_FACE);
-
-        //get sun "position" to be the sun's angle away from the player in order to use it to create transformation matrix
-        //from https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
-        glm::vec3 sun_pos = player->transform->position - glm::normalize(sun_angle) * 100.f;
-        glm::mat4 lightView = glm::lookAt(sun_pos, player->transform->position, glm::vec3(0.f, 1.f, 0.f));//TODO: set sun distance correctly, check if correct firection & probably change angle
-        glm::mat4 orthographic_projection = glm::ortho(-20.f, 20.f, -20.f, 20.f, 0.01f, 500.f);
-        glm::mat4 const world_to_clip = orthographic_projection * lightView;
-
-        glm::mat4 world_to_spot =
-                //This matrix converts from the spotlight's clip space ([-1,1]^3) into depth map texture coordinates ([0,1]^2) and depth map Z values ([0,1]):
-                glm::mat4(
-                        0.5f, 0.0f, 0.0f, 0.0f,
-                        0.0f, 0.5f, 0.0f, 0.0f,
-                        0.0f, 0.0f, 0.5f, 0.0f,
-                        0.5f, 0.5f, 0.5f+0.00001f /* <-- bias */, 1.0f
-                )
-                //this is the world-to-clip matrix used when rendering the shadow map:
-                * world_to_clip;
-        glUseProgram(lit_color_texture_program->program);
-        glUniformMatrix4fv(lit_color_texture_program->LIGHT_TO_SPOT_mat4, 1, GL_FALSE, glm::value_ptr(world_to_spot));
-
-        glUseProgram(bone_lit_color_texture_program->program);
-        glUniformMatrix4fv(bone_lit_color_texture_program->LIGHT_TO_SPOT_mat4, 1, GL_FALSE, glm::value_ptr(world_to_spot));
-        glUseProgram(0);
-
-        scene.draw(Scene::Drawable::PassTypeShadow, world_to_clip, glm::mat4x3(1.0f));
-
-        glDisable(GL_CULL_FACE);
-        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        GL_ERRORS(); //now texture is already in framebuffers.shadow_depth_tex
+        graph.add("shadow", {}, {Framebuffers::ShadowDepth}, [this, sun_angle]() {
+            //Draw scene to shadow map for spotlight, adapted from https://github.com/ixchow/15-466-f18-base3
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.shadow_fb);
+            glViewport(0, 0, framebuffers.shadow_size.x, framebuffers.shadow_size.y);
+
+            glClearColor(1.0f, 0.0f, 1.0f, 0.0f); //clear color for shadow buffer
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+            //render only back faces to shadow map (prevent shadow speckles on fronts of objects):
+            glCullFace(GL_FRONT);
+            glEnable(GL_CULL_FACE);
+
+            //get sun "position" to be the sun's angle away from the player in order to use it to create transformation matrix
+            //from https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
+            glm::vec3 sun_pos = player->transform->position - glm::normalize(sun_angle) * 100.f;
+            glm::mat4 lightView = glm::lookAt(sun_pos, player->transform->position, glm::vec3(0.f, 1.f, 0.f));//TODO: set sun distance correctly, check if correct firection & probably change angle
+            glm::mat4 orthographic_projection = glm::ortho(-20.f, 20.f, -20.f, 20.f, 0.01f, 500.f);
+            glm::mat4 const world_to_clip = orthographic_projection * lightView;
+
+            glm::mat4 world_to_spot =
+                    //This matrix converts from the spotlight's clip space ([-1,1]^3) into depth map texture coordinates ([0,1]^2) and depth map Z values ([0,1]):
+                    glm::mat4(
+                            0.5f, 0.0f, 0.0f, 0.0f,
+                            0.0f, 0.5f, 0.0f, 0.0f,
+                            0.0f, 0.0f, 0.5f, 0.0f,
+                            0.5f, 0.5f, 0.5f+0.00001f /* <-- bias */, 1.0f
+                    )
+                    //this is the world-to-clip matrix used when rendering the shadow map:
+                    * world_to_clip;
+            glUseProgram(lit_color_texture_program->program);
+            glUniformMatrix4fv(lit_color_texture_program->LIGHT_TO_SPOT_mat4, 1, GL_FALSE, glm::value_ptr(world_to_spot));
+
+            glUseProgram(instanced_lit_color_texture_program->program);
+            glUniformMatrix4fv(instanced_lit_color_texture_program->LIGHT_TO_SPOT_mat4, 1, GL_FALSE, glm::value_ptr(world_to_spot));
+
+            glUseProgram(bone_lit_color_texture_program->program);
+            glUniformMatrix4fv(bone_lit_color_texture_program->LIGHT_TO_SPOT_mat4, 1, GL_FALSE, glm::value_ptr(world_to_spot));
+            glUseProgram(0);
+
+            scene.draw(Scene::Drawable::PassTypeShadow, world_to_clip, glm::mat4x3(1.0f));
+
+            glDisable(GL_CULL_FACE);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+            GL_ERRORS(); //now texture is already in framebuffers.shadow_depth_tex
+        });
 	}
 
-    // Run depth pre-pass for occlusion query, and write position buffer for post-processing
-    {
+    // Run depth pre-pass for occlusion query (depth of field also reconstructs positions from it)
+    // static drawables first, so the hi-z pyramid is built from those alone (moving ones would leave stale occluders in it):
+    glm::mat4 world_to_clip = active_camera->make_projection() * glm::mat4(active_camera->transform->make_world_to_local());
+    graph.add("prepass", {}, {Framebuffers::PrepassDepth}, [this, render_size, world_to_clip]() {
         // run query for each drawable
-        glViewport(0, 0, drawable_size.x, drawable_size.y);
+        glViewport(0, 0, render_size.x, render_size.y);
         // bind renderbuffers for rendering
         glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.oc_fb);
 
         // set clear depth, testing criteria, and the like
         glClearDepth(1.0f); // 1.0 is the default value to clear the depth buffer to, but you can change it
-        //set sky bits to be far away from the camera
-        //glm::vec4 distant = active_camera->transform->make_local_to_world() * glm::vec4(active_camera->transform->position, 1.0f) + glm::vec4(1000.f, 1000.f, 1000.f, 0.0f);
-        //glclearcolor(distant.r, distant.g, distant.b, distant.a);
-        glClearColor(0, 0, 0, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clears currently bound framebuffer's color and depth info to clearColor set above (0, 0 ,0 1) and clearDepth set above (1.0)
+        glClear(GL_DEPTH_BUFFER_BIT); // clears currently bound framebuffer's depth info to clearDepth set above (1.0)
         glEnable(GL_DEPTH_TEST); // enable depth testing
         glDepthFunc(GL_LEQUAL); // set criteria for depth test
         glDisable(GL_BLEND);
         GL_ERRORS();
 
         // render with occlusion pass
-        scene.draw(*active_camera, Scene::Drawable::PassTypePrepass);
-    }
+        scene.draw(Scene::Drawable::PassTypePrepass, world_to_clip, glm::mat4x3(1.0f), Scene::DrawStatic);
+    });
+    graph.add("hi-z", {Framebuffers::PrepassDepth}, {Framebuffers::HiZ}, [this, world_to_clip]() {
+        // build the depth pyramid later frames' shaded passes are occlusion culled against
+        framebuffers.build_hiz();
+        scene.read_hiz(world_to_clip);
+    }, true); //(read back for later frames)
+    graph.add("prepass dynamic", {Framebuffers::PrepassDepth}, {Framebuffers::PrepassDepth}, [this, render_size, world_to_clip]() {
+        // ...then the moving drawables, into the same depth (build_hiz left its own framebuffer and viewport bound)
+        glViewport(0, 0, render_size.x, render_size.y);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.oc_fb);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LEQUAL);
+        glDisable(GL_BLEND);
+        scene.draw(Scene::Drawable::PassTypePrepass, world_to_clip, glm::mat4x3(1.0f), Scene::DrawDynamic);
+    });
 
     // Run occlusion query using prepass sample buffer
 //    {
@@ -854,11 +916,11 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 //    }
 	
 	// Draw scene to multisampled framebuffer
-	{
+	graph.add("main", {Framebuffers::ShadowDepth}, {Framebuffers::MSColor, Framebuffers::MSDepth}, [this, render_size]() {
 		// Based on: https://github.com/15-466/15-466-f20-framebuffer
 
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.ms_fb);
-        glViewport(0, 0, drawable_size.x, drawable_size.y);
+        glViewport(0, 0, render_size.x, render_size.y);
         // Set "sky" (clear color)
         glClearColor(sky_color.x, sky_color.y, sky_color.z, 1.0f);
 
@@ -888,7 +950,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
         // Unbind textures
         glActiveTexture(GL_TEXTURE5);
         glBindTexture(GL_TEXTURE_2D, 0);
-	}
+	});
 
 	// Debugging code for printing all visible objects and visualizing walk mesh
 	/*
@@ -919,33 +981,64 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	*/
 
     // Resolve multisampled buffer to screen
-    {
+    graph.add("resolve", {Framebuffers::MSColor}, {Framebuffers::Screen}, [render_size]() {
         // blit multisampled buffer to the normal, intermediate post_processing buffer. Image is stored in screen_texture, depth in pp_depth
         glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers.ms_fb);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers.pp_fb);
 
-        glBlitFramebuffer(0, 0, drawable_size.x, drawable_size.y, 0, 0, drawable_size.x, drawable_size.y, GL_COLOR_BUFFER_BIT, GL_LINEAR); // Bilinear interpolation for anti aliasing
+        glBlitFramebuffer(0, 0, render_size.x, render_size.y, 0, 0, render_size.x, render_size.y, GL_COLOR_BUFFER_BIT, GL_LINEAR); // Bilinear interpolation for anti aliasing
 
         glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         GL_ERRORS();
-    }
+    });
 
 	// Postprocessing
-    { 
-        // Add fog, fog uses original multisampled depth buffer so no aliasing
-        framebuffers.add_depth_effects(fog_intensity, 1300.0f, fog_color);
+    {
+        // (positions are reconstructed from depth with the view it was drawn from)
+        framebuffers.post.world_to_clip = active_camera->make_projection() * glm::mat4(active_camera->transform->make_world_to_local());
+        framebuffers.post.eye = active_camera->transform->make_local_to_world()[3];
+        framebuffers.post.fog_intensity = fog_intensity;
+        framebuffers.post.fog_distance = 13.0f;
+        framebuffers.post.fog_color = fog_color;
+        framebuffers.post.focal_distance = player->player_camera->cur_focus;
+
+        // Depth of field only in camera view; its blur is the one pass that has to run before the rest
+        bool depth_of_field = player->in_cam_view;
+        std::vector< Framebuffers::Target > post_reads = {Framebuffers::Screen, Framebuffers::MSDepth};
+        if (depth_of_field) {
+            std::vector< Framebuffers::Target > blurred = add_depth_of_field_blur(graph);
+            post_reads.emplace_back(Framebuffers::PrepassDepth);
+            post_reads.insert(post_reads.end(), blurred.begin(), blurred.end());
+        }
 
-        if (player->in_cam_view) {
-            //add depth of field
-            framebuffers.add_depth_of_field(player->player_camera->cur_focus, active_camera->transform->make_local_to_world()[3]);
-            // Copy framebuffer to main window:
-            framebuffers.tone_map_to_screen(framebuffers.screen_texture);
-        } else {
-            framebuffers.tone_map_to_screen(framebuffers.depth_effect_tex);
+        // Depth of field, fog (from the original multisampled depth buffer, so no aliasing) and tone mapping, straight to the main window
+        // (or, if the 3D view is smaller than the window, to upscale_tex, which is then stretched to fit):
+        bool upscale = (render_size != drawable_size);
+        graph.add("post", post_reads, {upscale ? Framebuffers::Upscale : Framebuffers::Backbuffer}, [depth_of_field, upscale]() {
+            glBindFramebuffer(GL_FRAMEBUFFER, upscale ? framebuffers.upscale_fb : 0);
+            framebuffers.post_process(framebuffers.screen_texture, Framebuffers::PostFog | Framebuffers::PostToneMap | (depth_of_field ? Framebuffers::PostDepthOfField : 0));
+        });
+        if (upscale) {
+            graph.add("upscale", {Framebuffers::Upscale}, {Framebuffers::Backbuffer}, [render_size, drawable_size]() {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers.upscale_fb);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+                glBlitFramebuffer(0, 0, render_size.x, render_size.y, 0, 0, drawable_size.x, drawable_size.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                GL_ERRORS();
+            });
         }
+
+        // Pictures (Scene::begin_picture, before the next frame) post-process screen_texture again and test against both depth buffers:
+        if (depth_of_field) graph.exports = {Framebuffers::Screen, Framebuffers::PrepassDepth, Framebuffers::MSDepth};
 	}
+
+    graph.run();
+
+	// (the passes above left the viewport at render_size)
+	glViewport(0, 0, drawable_size.x, drawable_size.y);
 	
 	// Draw UI
 	{
@@ -963,8 +1056,57 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 				night_draw_ui(drawable_size);
 				break;
 		}
+		if (save_status_timer > 0.0f && cur_state != menu) {
+			body_text->draw(save_status, 0.025f * float(drawable_size.x), 0.95f * float(drawable_size.y), 0.5f, glm::vec3(1.0f, 1.0f, 1.0f), float(drawable_size.x), float(drawable_size.y));
+		}
 	}
 	GL_ERRORS();
+
+	// (begin_picture post-processes this frame's screen_texture again, so pictures come out at the window's size)
+	if (take_picture) player->player_camera->TakePicture(scene);
+	if (picture_targets) std::swap(framebuffers, picture_framebuffers);
+
+	dynamic_resolution.end_frame(); //(does nothing if begin_frame wasn't called)
+
+	if (print_render_stats && render_stats_timer >= 1.0f) {
+		render_stats_timer = 0.0f;
+		log_render_stats();
+	}
+}
+
+void PlayMode::log_render_stats() {
+	static char const *pass_names[Scene::Drawable::PassTypes] = {"default", "in-camera", "shadow", "occlusion", "prepass"};
+	std::cout << "--- render stats ---" << std::endl;
+	for (uint32_t p = 0; p < Scene::Drawable::PassTypes; ++p) {
+		Scene::PassStats const &stats = scene.pass_stats[p];
+		if (stats.submitted + stats.culled + stats.occluded == 0) continue;
+		std::cout << "  " << pass_names[p] << ": " << stats.submitted << " submitted, " << stats.culled << " frustum culled, " << stats.occluded << " occluded (hi-z)" << std::endl;
+		std::cout << "    binds (sorted / unsorted): program " << stats.program_binds << " / " << stats.unsorted_program_binds
+		          << ", vao " << stats.vao_binds << " / " << stats.unsorted_vao_binds
+		          << ", texture " << stats.texture_binds << " / " << stats.unsorted_texture_binds
+		          << ", material " << stats.material_changes << " / " << stats.unsorted_material_changes << std::endl;
+		std::cout << "    " << stats.draw_calls << " draw calls (" << stats.instanced << " drawables instanced, " << stats.batched << " batched, " << stats.baked_chunks << " baked chunks)" << std::endl;
+		if (stats.proxy_queries) {
+			std::cout << "    " << stats.proxy_queries << " occlusion queries, " << stats.conditional << " drawables hidden last frame drawn conditionally" << std::endl;
+		}
+	}
+	std::cout << "  gpu ms:";
+	for (auto const &pair : framebuffers.pass_timers) {
+		if (pair.second.last_run + 4 < framebuffers.graph_runs) continue;
+		std::cout << " " << pair.first << " " << pair.second.average_ms << ";";
+	}
+	std::cout << std::endl;
+	if (player->in_cam_view) {
+		std::cout << "  depth of field blur (" << (framebuffers.dof_pyramid ? "pyramid" : "full size") << ", F6 to switch): "
+		          << framebuffers.pass_ms({"dof blur 1/2", "dof blur 1/4", "dof blur"}) << " ms, then post " << framebuffers.pass_ms({"post"}) << " ms" << std::endl;
+	}
+	std::cout << "  dynamic resolution (" << (dynamic_resolution.enabled ? "on" : "off") << ", F7 to switch): scale " << dynamic_resolution.scale
+	          << " (" << framebuffers.size.x << "x" << framebuffers.size.y << "), " << dynamic_resolution.average_ms << " gpu ms per frame (budget " << dynamic_resolution.budget_ms << ")" << std::endl;
+	std::cout << "  render targets: " << (framebuffers.persistent_bytes() >> 20) << " MB persistent + " << (framebuffers.transient_bytes() >> 20) << " MB transient (" << framebuffers.transients.size() << " pooled textures)" << std::endl;
+	if (!thumbnail_atlas.slot_sizes.empty()) {
+		uint32_t slots = uint32_t(thumbnail_atlas.slot_sizes.size());
+		std::cout << "  thumbnail atlas: " << (slots - thumbnail_atlas.free_slots.size()) << " / " << slots << " slots, " << thumbnail_atlas.copies << " thumbnails copied in and " << thumbnail_atlas.uploads << " vertex uploads so far" << std::endl;
+	}
 }
 
 
@@ -1109,9 +1251,12 @@ void PlayMode::playing_update(float elapsed) {
 		}
 
 		// Snap a pic on left click, if in camera view and has remaining battery
+		// (the picture is taken at the end of the next draw, so it isn't stuck at dynamic_resolution's scale)
 		if (player->in_cam_view && lmb.downs == 1 && player->player_camera->cur_battery > 0) {
-			player->player_camera->TakePicture(scene);
+			picture_requested = true;
 		}
+		// ...and score pictures whose results have come back from the GPU
+		player->player_camera->UpdatePictures(scene);
 	}
 
     //creature movement updates
@@ -1248,6 +1393,7 @@ void PlayMode::journal_draw_ui(glm::uvec2 const& drawable_size) {
 //	}
 
     uint32_t total_score = 0;
+    std::vector<ThumbnailAtlas::Quad> thumbnails;
 
 	for (auto c = Creature::creature_stats_map.begin(); c != Creature::creature_stats_map.end(); ++c) {
 		// Creature name
@@ -1265,9 +1411,17 @@ void PlayMode::journal_draw_ui(glm::uvec2 const& drawable_size) {
                                    y - 0.1f * float(drawable_size.y), 0.5f, journal_text_color,
                                    float(drawable_size.x), float(drawable_size.y));
 
-            //draw pic
-		    DrawPicture pic(*c->second.best_picture, drawable_size);
-            pic.draw(glm::vec2(x + 0.233f * float(drawable_size.x), y - (offset / 4) * float(drawable_size.y)), 0.16f);
+            //draw pic (all of them at once from the thumbnail atlas, below, unless it was full)
+            Picture const &best = *c->second.best_picture;
+            glm::vec2 center = glm::vec2(x + 0.233f * float(drawable_size.x), y - (offset / 4) * float(drawable_size.y));
+            uint32_t slot = thumbnail_atlas.acquire(best);
+            if (slot != -1U) {
+                glm::vec2 radius = 0.5f * 0.16f * glm::vec2(float(drawable_size.x), float(drawable_size.x) * best.dimensions.y / best.dimensions.x);
+                thumbnails.emplace_back(ThumbnailAtlas::Quad{slot, center - radius, center + radius});
+            } else {
+                DrawPicture pic(best, drawable_size);
+                pic.draw(center, 0.16f);
+            }
 
         } else {
             handwriting_text->draw("?????", x,
@@ -1280,6 +1434,7 @@ void PlayMode::journal_draw_ui(glm::uvec2 const& drawable_size) {
             i = 1;
         }
 	}
+    thumbnail_atlas.draw(thumbnails, drawable_size);
 
     handwriting_text->draw("Total score: " + std::to_string(total_score), (0.2f + 0.34f) * float(drawable_size.x), 0.85f * float(drawable_size.y), 1.0f, journal_text_color, float(drawable_size.x), float(drawable_size.y));
 
@@ -1310,11 +1465,14 @@ void PlayMode::night_update(float elapsed) {
 			// save pic being reviewed on enter
 			if (enter.downs > 0) {
 				saved_pictures.push_back(player->pictures[cur_pic_to_review]);
-				player->pictures[cur_pic_to_review]->save_picture_png();
+				player->pictures[cur_pic_to_review]->save_picture_png(photo_writer);
+				// (the writer holds on to the pixels it needs, so only the thumbnail has to stay for the journal)
+				player->pictures[cur_pic_to_review]->compact();
 				cur_pic_to_review++;
 			}
 			// skip pic being reviewed on delete or backspace
 			else if (del.downs > 0 || backspace.downs > 0) {
+				player->pictures[cur_pic_to_review]->compact();
 				cur_pic_to_review++;
 			}
 		}
@@ -1,6 +1,7 @@
 #include "Mode.hpp"
 
 #include "Scene.hpp"
+#include "Load.hpp"
 #include "WalkMesh.hpp"
 #include "BoneAnimation.hpp"
 #include "Sound.hpp"
@@ -8,6 +9,8 @@
 #include "Player.hpp"
 #include "Picture.hpp"
 #include "GameObjects.hpp"
+#include "DynamicResolution.hpp"
+#include "Framebuffers.hpp"
 
 #include <glm/glm.hpp>
 
@@ -15,6 +18,9 @@
 #include <deque>
 #include <map>
 
+//the game's world (also drawn by the "draw_calls" benchmark):
+extern Load< Scene > main_scene;
+
 #define TIME_SCALE_DEFAULT 1.25f
 #define MUSIC_VOLUME 0.4f
 
@@ -120,10 +126,29 @@ struct PlayMode : Mode {
 	bool started_reviewing_pics = false;
 	bool finished_reviewing_pics = false;
 
+	// Saved pics are written to the album in the background; save_status shows the latest one for a few seconds
+	PhotoWriter photo_writer;
+	std::string save_status;
+	float save_status_timer = 0.0f;
+
     //Audio
     float time_since_last_footstep = 1.0f;
     const float footstep_time = 2.5f;
 
 	Scene::Camera* overhead_cam = nullptr;
 	float overhead_cam_timer = 0.0f;
+
+	// The 3D view is drawn at a fraction of the window's size when the GPU can't keep up (F7 toggles it)
+	DynamicResolution dynamic_resolution;
+	// Set by a click in camera view; the next draw() renders at the window's full size (untimed) and takes the picture after it
+	bool picture_requested = false;
+	// Full-size targets for that frame when dynamic_resolution has scaled the view down (swapped with 'framebuffers' for the frame,
+	// so the shared targets keep their size); released after Framebuffers::TransientIdleRuns frames without a picture
+	Framebuffers picture_framebuffers;
+	uint32_t picture_framebuffers_idle = 0;
+
+	// Debug: F3 toggles printing per-pass render counters about once a second (F4 toggles Scene::use_occlusion_queries, F5 toggles PlayerCamera::validate_soft_raster)
+	bool print_render_stats = false;
+	float render_stats_timer = 0.0f;
+	void log_render_stats();
 };
@@ -11,6 +11,8 @@
 #include <map>
 #include <set>
 #include <filesystem>
+#include <cassert>
+#include <utility>
 
 // PlayerCamera
 //========================================
@@ -29,98 +31,161 @@ PlayerCamera::~PlayerCamera() {
 }
 
 void PlayerCamera::TakePicture(Scene &scene) {
+    auto before = std::chrono::high_resolution_clock::now();
 
     Sound::play(Sound::sample_map->at("CameraClick"));
 
-    PictureInfo stats;
-    stats.data = std::make_shared<std::vector<GLfloat>>(3 * scene_camera->drawable_size.x * scene_camera->drawable_size.y);
+    pending_pictures.emplace_back();
+    PendingPicture &pending = pending_pictures.back();
+
+    PictureInfo &stats = pending.stats;
     stats.dimensions = scene_camera->drawable_size;
     //I have no idea why this is correct. If someone could tell me that would be great. -w
     stats.angle = scene_camera->transform->get_world_rotation() * glm::vec3(0.0f, 0.0f, -1.0f);
     stats.focal_distance = cur_focus;
 
-    //get fragment counts for each drawable
-    scene.render_picture(*scene_camera, stats.frag_counts, *stats.data);
+    //which creatures are in frame isn't known until the fragment counts come back, so test every creature's focal points now
+    for (auto &pair : Creature::creature_map) {
+        Creature &creature = pair.second;
+        if (!creature.transform) continue;
+        pending.subjects.emplace_back(PendingPicture::Subject{&creature, pending.focal_points.size(), creature.transform->make_local_to_world()[3]});
+        pending.focal_points.insert(pending.focal_points.end(), creature.focal_points.begin(), creature.focal_points.end());
+    }
+    pending.camera_position = scene_camera->transform->make_local_to_world()[3];
+    pending.player_position = player->transform->position;
 
-    //sort by frag count
-    auto sort_by_frag_count = [&](std::pair<Scene::Drawable &, GLuint> a, std::pair<Scene::Drawable &, GLuint> b) {
-        return a.second > b.second;
-    };
-    stats.frag_counts.sort(sort_by_frag_count);
-    stats.total_frag_count = 0;
-    std::for_each(stats.frag_counts.begin(), stats.frag_counts.end(), [&](auto pair) {
-        stats.total_frag_count += pair.second;
-    });
-
-    //Set of creatures in frame, because there will be duplicates for body parts
-    std::set< std::string > creature_set;
-    for (auto &pair : stats.frag_counts) {
-        if((float)pair.second/(float)stats.total_frag_count > 0.0012f) { //don't count tiny amounts of frags
-            std::string name = pair.first.transform->name;
-            std::string code_id = name.substr(0, 6);
-            if (Creature::creature_map.count(code_id)) {
-                creature_set.insert(code_id);
-            } else if (code_id.substr(0, 3) == "PLT") {
-                stats.plant_set.insert(code_id);
-            }
-//            std::cout << pair.first.transform->name << "in: " << (float)pair.second << std::endl;
-        } else {
-//            std::cout << pair.first.transform->name << " out: " << (float)pair.second << std::endl;
-        }
+    //get fragment counts for each drawable (results are collected by UpdatePictures)
+    scene.begin_picture(*scene_camera, pending.focal_points, &pending.capture);
+
+    if (validate_soft_raster) {
+        auto soft_before = std::chrono::high_resolution_clock::now();
+        scene.soft_picture(*scene_camera, pending.focal_points, &soft_raster, pending.soft_frag_counts, pending.soft_focal_results);
+        pending.soft_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - soft_before).count();
     }
 
-    //list of creatures & focal point visibilities
-    for (auto &code_id : creature_set) {
-        stats.creatures_in_frame.emplace_back();
-        stats.creatures_in_frame.back().creature = &Creature::creature_map[code_id];
+    cur_battery -= 1;
+
+    auto after = std::chrono::high_resolution_clock::now();
+    pending.taken = after;
+    pending.shutter_ms = std::chrono::duration< float, std::milli >(after - before).count();
+}
+
+// Print how the CPU rasterizer's counts for a picture compare with the GPU's (see PlayerCamera::validate_soft_raster)
+static void print_soft_comparison(PendingPicture const &pending, glm::uvec2 soft_size, std::vector< bool > const &focal_results) {
+    // fraction of the picture each creature covers, from either set of counts:
+    auto coverage = [](std::list< std::pair< Scene::Drawable &, GLuint > > const &frag_counts, float pixels) {
+        std::map< std::string, float > ret;
+        for (auto const &pair : frag_counts) {
+            std::string code_id = pair.first.transform->name.substr(0, 6);
+            if (Creature::creature_map.count(code_id)) ret[code_id] += float(pair.second) / pixels;
+        }
+        return ret;
+    };
+    std::map< std::string, float > gpu = coverage(pending.stats.frag_counts, float(pending.capture.size.x) * float(pending.capture.size.y));
+    std::map< std::string, float > cpu = coverage(pending.soft_frag_counts, float(soft_size.x) * float(soft_size.y));
+    std::set< std::string > codes;
+    for (auto const &pair : gpu) codes.insert(pair.first);
+    for (auto const &pair : cpu) codes.insert(pair.first);
+
+    std::cout << "soft raster (" << soft_size.x << "x" << soft_size.y << ", " << pending.soft_ms << " ms):" << std::endl;
+    for (auto const &code_id : codes) {
+        std::cout << "  " << code_id << " coverage gpu " << 100.0f * gpu[code_id] << "% / cpu " << 100.0f * cpu[code_id] << "%" << std::endl;
+    }
+    uint32_t focal_matches = 0;
+    for (size_t i = 0; i < focal_results.size() && i < pending.soft_focal_results.size(); ++i) {
+        if (focal_results[i] == pending.soft_focal_results[i]) focal_matches += 1;
     }
+    std::cout << "  focal points agree: " << focal_matches << " / " << focal_results.size() << std::endl;
+}
 
-    // Populate creature infos
-    for (auto &creature_info : stats.creatures_in_frame) {
-        // Get focal point vector - indices of bools map to indices of focal points in creature
-        scene.test_focal_points(*scene_camera, creature_info.creature->focal_points, creature_info.are_focal_points_in_frame);
-        // Populate frag counts by summing over all labeled parts
-        creature_info.frag_count = 0;
+void PlayerCamera::UpdatePictures(Scene &scene) {
+    while (!pending_pictures.empty()) {
+        //pictures finish in order, so only the oldest needs checking:
+        PendingPicture &pending = pending_pictures.front();
+        if (!pending.capture.ready()) {
+            pending.polls += 1;
+            return;
+        }
+        PictureInfo &stats = pending.stats;
+
+        std::vector< bool > focal_results;
+        scene.finish_picture(&pending.capture, stats.frag_counts, &focal_results);
+        //the picture itself stays on the GPU:
+        stats.texture = std::exchange(pending.capture.texture, 0);
+        stats.thumbnail_tex = std::exchange(pending.capture.thumbnail, 0);
+        stats.thumbnail_size = pending.capture.thumbnail_size;
+
+        //sort by frag count
+        auto sort_by_frag_count = [&](std::pair<Scene::Drawable &, GLuint> a, std::pair<Scene::Drawable &, GLuint> b) {
+            return a.second > b.second;
+        };
+        stats.frag_counts.sort(sort_by_frag_count);
+        stats.total_frag_count = 0;
         std::for_each(stats.frag_counts.begin(), stats.frag_counts.end(), [&](auto pair) {
-            if (pair.first.transform->name.substr(0, 6)
-                    == creature_info.creature->get_code_and_number()) {
-            creature_info.frag_count += pair.second;
-            }
+            stats.total_frag_count += pair.second;
         });
-        // Vector from player to creature
-        glm::vec3 worldpos = creature_info.creature->transform->make_local_to_world()[3];
-        glm::vec3 camera_worldpos = player->player_camera->scene_camera->transform->make_local_to_world()[3];
-        //std::cout << glm::to_string(creature_info.creature->transform->make_local_to_world()) <<std::endl;
-        //std::cout << glm::to_string(glm::vec4(creature_info.creature->transform->position, 1.0f)) <<std::endl;
-        //std::cout << glm::to_string(camera_worldpos) <<std::endl;
-        //std::cout << glm::to_string(worldpos) <<std::endl;
-        creature_info.player_to_creature = worldpos - camera_worldpos;
-        //std::cout << glm::to_string(creature_info.player_to_creature) <<std::endl;
-        //std::cout << glm::to_string(worldpos) << ",  " << glm::to_string(camera_worldpos);
-    }
 
-    // Debug: print how many focal points are in frame
-	/*
-    for (auto &pair : creatures_in_frame) {
-        auto pred = [&](bool b) {
-            return b;
-        };
-        std::cout << pair.first->name << " detected, focal point count: " << std::count_if((*pair.second).begin(),
-                                                                                           (*pair.second).end(), pred) << std::endl;
-    }
-	*/
+        //Set of creatures in frame, because there will be duplicates for body parts
+        std::set< std::string > creature_set;
+        for (auto &pair : stats.frag_counts) {
+            if((float)pair.second/(float)stats.total_frag_count > 0.0012f) { //don't count tiny amounts of frags
+                std::string name = pair.first.transform->name;
+                std::string code_id = name.substr(0, 6);
+                if (Creature::creature_map.count(code_id)) {
+                    creature_set.insert(code_id);
+                } else if (code_id.substr(0, 3) == "PLT") {
+                    stats.plant_set.insert(code_id);
+                }
+            }
+        }
 
-	auto temp = std::make_shared<Picture>(stats, player->transform->position);
+        //list of creatures & focal point visibilities
+        for (auto &code_id : creature_set) {
+            stats.creatures_in_frame.emplace_back();
+            stats.creatures_in_frame.back().creature = &Creature::creature_map[code_id];
+        }
 
-    player->pictures.push_back(temp);
-    std::shared_ptr<Picture> picture = player->pictures.back();
-    //update creature stats map
-    if (picture->subject_info.creature) {
-        Creature::creature_stats_map.at(picture->subject_info.creature->code).on_picture_taken(picture);
-    }
-	std::cout << picture->get_scoring_string() << std::endl;
+        // Populate creature infos
+        for (auto &creature_info : stats.creatures_in_frame) {
+            auto subject = std::find_if(pending.subjects.begin(), pending.subjects.end(), [&](PendingPicture::Subject const &s) {
+                return s.creature == creature_info.creature;
+            });
+            assert(subject != pending.subjects.end());
+            // Get focal point vector - indices of bools map to indices of focal points in creature
+            auto first = focal_results.begin() + subject->first_focal_point;
+            creature_info.are_focal_points_in_frame.assign(first, first + creature_info.creature->focal_points.size());
+            // Populate frag counts by summing over all labeled parts
+            creature_info.frag_count = 0;
+            std::for_each(stats.frag_counts.begin(), stats.frag_counts.end(), [&](auto pair) {
+                if (pair.first.transform->name.substr(0, 6)
+                        == creature_info.creature->get_code_and_number()) {
+                creature_info.frag_count += pair.second;
+                }
+            });
+            // Vector from player to creature (where both were when the picture was taken)
+            creature_info.player_to_creature = subject->position - pending.camera_position;
+        }
 
-	cur_battery -= 1;
+        if (pending.soft_ms >= 0.0f) {
+            print_soft_comparison(pending, soft_raster.size, focal_results);
+        }
+
+        auto temp = std::make_shared<Picture>(stats, pending.player_position);
+
+        player->pictures.push_back(temp);
+        std::shared_ptr<Picture> picture = player->pictures.back();
+        //update creature stats map
+        if (picture->subject_info.creature) {
+            Creature::creature_stats_map.at(picture->subject_info.creature->code).on_picture_taken(picture);
+        }
+        std::cout << picture->get_scoring_string() << std::endl;
+
+        float waited_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - pending.taken).count();
+        std::cout << "(shutter press took " << pending.shutter_ms << " ms; results arrived " << pending.polls << " frames / " << waited_ms << " ms later; "
+                  << pending.capture.occluded << " hidden drawables skipped)" << std::endl;
+
+        pending_pictures.pop_front();
+    }
 }
 
 // Akin to adjusting length of lens; affects focus (zooming in makes depth of field shallower)
@@ -7,9 +7,40 @@
 
 #include <glm/glm.hpp>
 #include <memory>
+#include <list>
+#include <chrono>
 
 struct Player;
 
+// A picture whose GPU results (pixels, fragment counts, focal point visibility) haven't arrived yet;
+// PlayerCamera::UpdatePictures scores it once they have (see Scene::begin_picture)
+struct PendingPicture {
+	PictureInfo stats;
+	Scene::PictureCapture capture;
+
+	// Every creature's focal points, tested at the shutter press (results are matched back up by creature):
+	std::vector< Scene::Drawable * > focal_points;
+	struct Subject {
+		Creature *creature;
+		size_t first_focal_point; // index into focal_points
+		glm::vec3 position; // creature world position at the shutter press
+	};
+	std::vector< Subject > subjects;
+
+	// Positions at the shutter press:
+	glm::vec3 camera_position;
+	glm::vec3 player_position;
+
+	// Same counts from the CPU rasterizer, if PlayerCamera::validate_soft_raster was on (soft_ms < 0 if not):
+	std::list< std::pair< Scene::Drawable &, GLuint > > soft_frag_counts;
+	std::vector< bool > soft_focal_results;
+	float soft_ms = -1.0f;
+
+	std::chrono::high_resolution_clock::time_point taken;
+	float shutter_ms = 0.0f; // time spent in TakePicture
+	uint32_t polls = 0; // frames spent waiting for the GPU
+};
+
 // Cameras for taking pictures
 struct PlayerCamera {
 
@@ -36,7 +67,12 @@ struct PlayerCamera {
 	uint8_t cur_battery = 20;
 	uint8_t max_battery = 20;
 
-	void TakePicture(Scene &scene); // Adds picture to player.pictures
+	void TakePicture(Scene &scene); // Starts a picture; it is added to player.pictures by UpdatePictures once the GPU is done with it
+	void UpdatePictures(Scene &scene); // Scores and adds any started pictures whose results are ready (call once per frame)
+	std::list< PendingPicture > pending_pictures;
+	// Also count each picture on the CPU and print how it compares with the GPU counts (toggled with F5):
+	bool validate_soft_raster = false;
+	SoftRaster soft_raster;
 	void AdjustZoom(bool increase); // zooms in if increase == true; also affects focus
     void AdjustFocus(bool increase);
 	void Reset(bool reset_battery); // resets zoom, focus, and battery to defaults if desired
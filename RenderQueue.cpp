@@ -0,0 +1,41 @@
+#include "RenderQueue.hpp"
+
+#include <cstring>
+
+void RenderQueue::sort() {
+	if (packets.size() < 2) return;
+	scratch.resize(packets.size());
+
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		uint32_t counts[256] = { 0 };
+		for (Packet const &packet : packets) {
+			counts[(packet.key >> shift) & 0xff] += 1;
+		}
+		//every key has the same digit here, so this pass wouldn't change the order:
+		if (counts[(packets[0].key >> shift) & 0xff] == packets.size()) continue;
+
+		uint32_t offset = 0;
+		for (uint32_t &count : counts) {
+			uint32_t c = count;
+			count = offset;
+			offset += c;
+		}
+		for (Packet const &packet : packets) {
+			scratch[counts[(packet.key >> shift) & 0xff]++] = packet;
+		}
+		packets.swap(scratch);
+	}
+}
+
+uint64_t RenderQueue::make_key(uint32_t pass, GLuint program, GLuint vao, GLuint texture, float depth) {
+	//non-negative floats order the same way as their bit patterns, so the top bits make a coarse depth:
+	if (!(depth > 0.0f)) depth = 0.0f;
+	uint32_t depth_bits;
+	std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+	return (uint64_t(pass & 0x7) << 61)
+	     | (uint64_t(program & 0x3ff) << 51)
+	     | (uint64_t(vao & 0x3ff) << 41)
+	     | (uint64_t(texture & 0xfff) << 29)
+	     | (uint64_t(depth_bits >> 16) << 13);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * "RenderQueue" collects draw packets -- a 64-bit sort key plus a caller-supplied id --
+ *  and sorts them so that packets sharing GL state end up next to each other.
+ *
+ * Key layout (most significant bits first):
+ *   pass (3) | program (10) | vao (10) | texture (12) | depth (16) | unused (13)
+ * GL object names are truncated to fit, which can only make the sort less effective;
+ *  whoever submits the packets must still compare real names when tracking state.
+ *
+ */
+
+#include "GL.hpp"
+
+#include <vector>
+#include <cstdint>
+
+struct RenderQueue {
+	struct Packet {
+		uint64_t key;
+		uint32_t id;
+	};
+
+	std::vector< Packet > packets;
+
+	void clear() { packets.clear(); }
+	void push(uint64_t key, uint32_t id) { packets.emplace_back(Packet{key, id}); }
+
+	//stable LSD radix sort of packets by key (byte digits that are the same in every key are skipped):
+	void sort();
+
+	//depth should be a view distance; smaller depths sort first (i.e., front-to-back) and negative depths are treated as zero:
+	static uint64_t make_key(uint32_t pass, GLuint program, GLuint vao, GLuint texture, float depth);
+
+private:
+	std::vector< Packet > scratch; //kept around to avoid reallocating every frame
+};
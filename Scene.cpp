@@ -6,11 +6,19 @@
 #include "Framebuffers.hpp"
 #include "data_path.hpp"
 #include "load_save_png.hpp"
+#include "IdHistogram.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <fstream>
+#include <map>
+#include <unordered_set>
+#include <tuple>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <type_traits>
 #include <algorithm>
 #include <future>
 
@@ -66,26 +74,77 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	);
 }
 
-glm::mat4x3 Scene::Transform::make_local_to_world() const {
+uint32_t Scene::Transform::world_cache_recomputes = 0;
+
+uint32_t Scene::Transform::update_world_cache() const {
+	//bring parent up to date first (this is what propagates changes down the hierarchy):
+	return refresh_world_cache(parent ? parent->update_world_cache() : 0);
+}
+
+uint32_t Scene::Transform::refresh_world_cache(uint32_t parent_version) const {
+	WorldCache &c = world_cache;
+
+	if (c.world_version != 0
+	 && c.parent == parent
+	 && c.parent_version == parent_version
+	 && c.position == position
+	 && c.rotation == rotation
+	 && c.scale == scale) {
+		return c.world_version;
+	}
+
+	c.position = position;
+	c.rotation = rotation;
+	c.scale = scale;
+	c.parent = parent;
+	c.parent_version = parent_version;
+
+	glm::mat3 rot = glm::mat3_cast(rotation);
 	if (!parent) {
-		return make_local_to_parent();
+		c.local_to_world = make_local_to_parent();
+		c.world_to_local = make_parent_to_local();
+		c.world_rotation = rot;
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		WorldCache const &p = parent->world_cache;
+		c.local_to_world = p.local_to_world * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		c.world_to_local = make_parent_to_local() * glm::mat4(p.world_to_local);
+		c.world_rotation = p.world_rotation * rot;
 	}
+
+	//skip 0 on wrap-around so the cache never looks uncomputed:
+	c.world_version += 1;
+	if (c.world_version == 0) c.world_version = 1;
+	world_cache_recomputes += 1;
+
+	return c.world_version;
+}
+
+glm::mat4x3 Scene::Transform::make_local_to_world() const {
+	update_world_cache();
+	return world_cache.local_to_world;
 }
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
+	update_world_cache();
+	return world_cache.world_to_local;
+}
+
+glm::mat3x3 Scene::Transform::get_world_rotation() const {
+	update_world_cache();
+	return world_cache.world_rotation;
+}
+
+glm::mat4x3 Scene::Transform::make_local_to_world_uncached() const {
 	if (!parent) {
-		return make_parent_to_local();
+		return make_local_to_parent();
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		return parent->make_local_to_world_uncached() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
 	}
 }
-
-glm::mat3x3 Scene::Transform::get_world_rotation() const {
+glm::mat4x3 Scene::Transform::make_world_to_local_uncached() const {
 	if (!parent) {
-		return glm::mat3_cast(rotation);
+		return make_parent_to_local();
 	} else {
-		return parent->get_world_rotation() * glm::mat3_cast(rotation);
+		return make_parent_to_local() * glm::mat4(parent->make_world_to_local_uncached()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
 	}
 }
 
@@ -95,6 +154,116 @@ glm::vec3 Scene::Transform::get_front_direction() const {
 
 //-------------------------
 
+Scene::Transform &Scene::TransformStore::emplace_back() {
+	uint32_t index = uint32_t(handles.size());
+	if (index / BlockSize >= blocks.size()) {
+		blocks.emplace_back(std::make_unique< Block >());
+	}
+	Block &block = *blocks[index / BlockSize];
+	uint32_t slot = index % BlockSize;
+	block.position[slot] = glm::vec3(0.0f, 0.0f, 0.0f);
+	block.rotation[slot] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
+	block.scale[slot] = glm::vec3(1.0f, 1.0f, 1.0f);
+	block.parent[slot] = nullptr;
+	handles.emplace_back(index, block.position[slot], block.rotation[slot], block.scale[slot], block.parent[slot]);
+	//(unparented, so it can go last in update order, if that is up to date)
+	if (order.size() == index) {
+		rank.emplace_back(index);
+		order.emplace_back(index);
+	}
+	return handles.back();
+}
+
+void Scene::TransformStore::clear() {
+	handles.clear();
+	blocks.clear();
+	order.clear();
+	rank.clear();
+}
+
+void Scene::TransformStore::copy_from(TransformStore const &other) {
+	static_assert(std::is_trivially_copyable< Block >::value, "Blocks can be copied with memcpy.");
+	assert(&other != this);
+
+	clear();
+
+	blocks.reserve(other.blocks.size());
+	for (auto const &b : other.blocks) {
+		blocks.emplace_back(std::make_unique< Block >());
+		std::memcpy(blocks.back().get(), b.get(), sizeof(Block));
+	}
+
+	for (Transform const &t : other.handles) {
+		Block &block = *blocks[t.index / BlockSize];
+		uint32_t slot = t.index % BlockSize;
+		handles.emplace_back(t.index, block.position[slot], block.rotation[slot], block.scale[slot], block.parent[slot]);
+		handles.back().name = t.name;
+	}
+
+	//parents were copied as pointers into 'other'; point them at the same index in this store:
+	for (Transform &t : handles) {
+		if (t.parent) {
+			assert(t.parent->index < other.handles.size() && &other.handles[t.parent->index] == t.parent);
+			t.parent = &handles[t.parent->index];
+		}
+	}
+	order = other.order;
+	rank = other.rank;
+}
+
+void Scene::TransformStore::update_world_matrices() const {
+	if (order.size() != handles.size()) sort_order();
+
+	bool sorted = true;
+	for (uint32_t i : order) {
+		Transform const &t = handles[i];
+		uint32_t parent_version = 0;
+		if (t.parent) {
+			//parents come first in 'order', unless re-parented since it was sorted (e.g. Player adopting the scene's camera):
+			if (rank[t.parent->index] < rank[i]) {
+				parent_version = t.parent->world_cache.world_version;
+			} else {
+				parent_version = t.parent->update_world_cache();
+				sorted = false;
+			}
+		}
+		t.refresh_world_cache(parent_version);
+	}
+
+	if (!sorted) sort_order();
+}
+
+uint32_t Scene::TransformStore::out_of_order() const {
+	if (order.size() != handles.size()) return 0; //(will be sorted first)
+	uint32_t count = 0;
+	for (Transform const &t : handles) {
+		if (t.parent && rank[t.parent->index] > rank[t.index]) count += 1;
+	}
+	return count;
+}
+
+void Scene::TransformStore::sort_order() const {
+	constexpr uint32_t Unplaced = -1U;
+	order.clear();
+	order.reserve(handles.size());
+	rank.assign(handles.size(), Unplaced);
+
+	//place each transform right after its unplaced ancestors (so in-order stores keep storage order):
+	std::vector< Transform const * > chain;
+	for (Transform const &t : handles) {
+		for (Transform const *a = &t; a && rank[a->index] == Unplaced; a = a->parent) {
+			chain.emplace_back(a);
+		}
+		while (!chain.empty()) {
+			rank[chain.back()->index] = uint32_t(order.size());
+			order.emplace_back(chain.back()->index);
+			chain.pop_back();
+		}
+	}
+}
+
+//-------------------------
+
 glm::mat4 Scene::Camera::make_projection() const {
 	return glm::infinitePerspective( fovy, aspect, near );
 }
@@ -108,49 +277,691 @@ void Scene::draw(Camera const &camera, Drawable::PassType pass_type) {
 	draw(pass_type, world_to_clip, world_to_light);
 }
 
-void Scene::draw(Drawable::PassType pass_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) {
+Scene::Frustum::Frustum(glm::mat4 const &world_to_clip) {
+	//Gribb/Hartmann plane extraction: -w <= x,y,z <= w in clip space
+	glm::mat4 m = glm::transpose(world_to_clip); //rows of world_to_clip
+	planes[0] = m[3] + m[0]; //left
+	planes[1] = m[3] - m[0]; //right
+	planes[2] = m[3] + m[1]; //bottom
+	planes[3] = m[3] - m[1]; //top
+	planes[4] = m[3] + m[2]; //near
+	planes[5] = m[3] - m[2]; //far
+}
+
+bool Scene::Frustum::intersects(glm::vec3 const &min, glm::vec3 const &max) const {
+	for (auto const &plane : planes) {
+		//corner of the box furthest along the plane normal:
+		glm::vec3 p = glm::vec3(
+			(plane.x >= 0.0f ? max.x : min.x),
+			(plane.y >= 0.0f ? max.y : min.y),
+			(plane.z >= 0.0f ? max.z : min.z)
+		);
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f) return false;
+	}
+	return true;
+}
+
+BVH::Overlap Scene::Frustum::classify(glm::vec3 const &min, glm::vec3 const &max) const {
+	BVH::Overlap overlap = BVH::Inside;
+	for (auto const &plane : planes) {
+		//distances (scaled by the plane normal's length) of the corners furthest along and furthest against the normal:
+		float along = plane.w, against = plane.w;
+		for (int a = 0; a < 3; ++a) {
+			float lo = plane[a] * min[a];
+			float hi = plane[a] * max[a];
+			along += std::max(lo, hi);
+			against += std::min(lo, hi);
+		}
+		if (along < 0.0f) return BVH::Outside;
+		if (against < 0.0f) overlap = BVH::Intersects;
+	}
+	return overlap;
+}
+
+void Scene::update_world_bounds() {
+	//(if the trees are being rebuilt anyway, moved drawables just go where their new boxes put them)
+	bool rebuilding = bvh_dirty;
+	uint32_t switched = 0;
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		Drawable &drawable = drawables[i];
+		if (!drawable.has_bounds()) continue;
+
+		//skip drawables whose transform hasn't changed since the box was computed:
+		uint32_t version = drawable.transform->update_world_cache();
+		if (version == drawable.world_bbox_version) continue;
+		drawable.world_bbox_version = version;
+
+		//transform center and (absolute) extents, which gives the tightest world-aligned box around the transformed box:
+		glm::mat4x3 const &to_world = drawable.transform->world_cache.local_to_world;
+		glm::vec3 center = to_world * glm::vec4(0.5f * (drawable.bbox_min + drawable.bbox_max), 1.0f);
+		glm::vec3 radius = 0.5f * (drawable.bbox_max - drawable.bbox_min);
+		glm::vec3 world_radius =
+			  glm::abs(to_world[0]) * radius.x
+			+ glm::abs(to_world[1]) * radius.y
+			+ glm::abs(to_world[2]) * radius.z;
+		drawable.world_bbox_min = center - world_radius;
+		drawable.world_bbox_max = center + world_radius;
+
+		//its baked vertices are out of date, so its chunk can't be used any more:
+		if (drawable.baked_chunk != -1U && version != drawable.baked_version) {
+			baked.chunks[drawable.baked_chunk].valid = false;
+		}
+
+		//a drawable in the static tree moved, so it belongs in the dynamic tree from now on:
+		// (and the hi-z pyramid may still show it where it was)
+		if (!drawable.dynamic) static_serial += 1;
+		if (!drawable.dynamic && !rebuilding) {
+			drawable.dynamic = true;
+			switched += 1;
+		}
+	}
+	//(every drawable that started moving this frame is switched over by one rebuild)
+	if (switched > 0) {
+		bvh_dirty = true;
+		instance_groups_dirty = true; //(groups don't mix static and dynamic drawables)
+	}
+
+	if (bvh_dirty) {
+		static_serial += 1; //(drawables were added, or a static one moved)
+		build_bvh();
+	} else {
+		dynamic_bvh.refit([this](uint32_t index, glm::vec3 *min, glm::vec3 *max){
+			*min = drawables[index].world_bbox_min;
+			*max = drawables[index].world_bbox_max;
+		});
+	}
+
+	if (instance_groups_dirty) build_instance_groups();
+	update_instance_groups();
+}
+
+void Scene::clear_baked() {
+	if (baked.vao) glDeleteVertexArrays(1, &baked.vao);
+	if (baked.buffer) glDeleteBuffers(1, &baked.buffer);
+	baked.vao = baked.buffer = 0;
+	baked.chunks.clear();
+	for (auto &drawable : drawables) {
+		drawable.baked_chunk = -1U;
+	}
+}
+
+void Scene::bake_static(GLuint vao, std::vector< glm::vec3 > const &positions, GLuint untextured, float chunk_size) {
+	clear_baked();
+
+	//anything below a dynamic drawable (e.g., a creature's parts) will move with it:
+	std::unordered_set< Transform const * > moving;
+	for (auto const &drawable : drawables) {
+		if (drawable.dynamic) moving.insert(drawable.transform);
+	}
+	auto attached_to_moving = [&](Transform const *transform) {
+		for (; transform; transform = transform->parent) {
+			if (moving.count(transform)) return true;
+		}
+		return false;
+	};
+
+	//sort drawables into chunks by the grid cell their center falls in:
+	std::map< std::tuple< int, int, int >, std::vector< uint32_t > > cells;
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		Drawable const &drawable = drawables[i];
+		Drawable::Pipeline const &pipeline = drawable.pipeline[Drawable::ProgramTypeShadow];
+		if (drawable.dynamic || !drawable.render_to_screen || !drawable.has_bounds()) continue;
+		if (pipeline.program == 0 || pipeline.vao != vao || pipeline.type != GL_TRIANGLES || pipeline.set_uniforms) continue;
+		//textured drawables are alpha-tested by the shadow program, which needs texture coordinates:
+		if (pipeline.textures[0].texture != untextured) continue;
+		if (pipeline.start + pipeline.count > positions.size()) continue;
+		if (attached_to_moving(drawable.transform)) continue;
+
+		glm::vec3 center = drawable.transform->make_local_to_world() * glm::vec4(0.5f * (drawable.bbox_min + drawable.bbox_max), 1.0f);
+		glm::ivec3 cell = glm::ivec3(glm::floor(center / chunk_size));
+		cells[std::make_tuple(cell.x, cell.y, cell.z)].emplace_back(i);
+	}
+
+	std::vector< glm::vec3 > data;
+	for (auto const &cell : cells) {
+		baked.chunks.emplace_back();
+		BakedChunk &chunk = baked.chunks.back();
+		chunk.first = GLint(data.size());
+		for (uint32_t index : cell.second) {
+			Drawable &drawable = drawables[index];
+			Drawable::Pipeline const &pipeline = drawable.pipeline[Drawable::ProgramTypeShadow];
+			drawable.baked_chunk = uint32_t(baked.chunks.size() - 1);
+			drawable.baked_version = drawable.transform->update_world_cache();
+			glm::mat4x3 const &to_world = drawable.transform->world_cache.local_to_world;
+			for (GLuint v = pipeline.start; v < pipeline.start + pipeline.count; ++v) {
+				data.emplace_back(to_world * glm::vec4(positions[v], 1.0f));
+				chunk.min = glm::min(chunk.min, data.back());
+				chunk.max = glm::max(chunk.max, data.back());
+			}
+		}
+		chunk.count = GLsizei(data.size() - chunk.first);
+	}
+	if (data.empty()) return;
+
+	glGenBuffers(1, &baked.buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, baked.buffer);
+	glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(glm::vec3), data.data(), GL_STATIC_DRAW);
+
+	glGenVertexArrays(1, &baked.vao);
+	glBindVertexArray(baked.vao);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLbyte *)0);
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GL_ERRORS();
+}
+
+//allocate a group's instance data buffer (contents are filled in by update_instance_groups()):
+static void allocate_instance_data(Scene::InstanceGroup &group) {
+	group.versions.assign(group.members.size(), 0); //(forces an upload)
+
+	glGenBuffers(1, &group.buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, group.buffer);
+	glBufferData(GL_TEXTURE_BUFFER, group.members.size() * Scene::InstanceTexels * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &group.texture);
+	glBindTexture(GL_TEXTURE_BUFFER, group.texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, group.buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void Scene::clear_instance_groups() {
+	for (auto &group : instance_groups) {
+		if (group.texture) glDeleteTextures(1, &group.texture);
+		if (group.buffer) glDeleteBuffers(1, &group.buffer);
+	}
+	instance_groups.clear();
+	for (auto &batch : static_batches) {
+		if (batch.texture) glDeleteTextures(1, &batch.texture);
+		if (batch.buffer) glDeleteBuffers(1, &batch.buffer);
+		if (batch.slots_texture) glDeleteTextures(1, &batch.slots_texture);
+		if (batch.slots_buffer) glDeleteBuffers(1, &batch.slots_buffer);
+	}
+	static_batches.clear();
+	for (auto &drawable : drawables) {
+		drawable.instance_group = -1U;
+		drawable.static_batch = -1U;
+	}
+}
+
+void Scene::build_instance_groups() {
+	clear_instance_groups();
+
+	//drawables can share a group if they would make the same draw call (other than transform) with every program,
+	// and can share a batch if they differ only in which vertices they draw:
+	std::map< std::vector< GLuint >, std::vector< uint32_t > > groups;
+	std::vector< std::vector< GLuint > > batch_keys(drawables.size());
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		Drawable &drawable = drawables[i];
+		drawable.instance_group = -1U;
+		drawable.static_batch = -1U;
+		if (!drawable.render_to_screen) continue;
+
+		std::vector< GLuint > key{drawable.material};
+		std::vector< GLuint > batch_key{drawable.material};
+		auto add = [&](std::initializer_list< GLuint > values) {
+			key.insert(key.end(), values);
+			batch_key.insert(batch_key.end(), values);
+		};
+		//(static and dynamic drawables are drawn by different halves of a split pass, so they never share a group)
+		key.emplace_back(drawable.dynamic ? 1 : 0);
+		bool instanceable = true;
+		bool batchable = !drawable.dynamic && drawable.pipeline[Drawable::ProgramTypeDefault].program != 0;
+		Drawable::Pipeline const *first = nullptr;
+		for (auto const &pipeline : drawable.pipeline) {
+			if (pipeline.program == 0) continue;
+			//per-drawable uniforms (e.g., bones) can't be shared:
+			if (pipeline.instanced_program == 0 || pipeline.set_uniforms) {
+				instanceable = false;
+				break;
+			}
+			//batches map vertices to members, so every program must draw the same vertices:
+			if (!first) first = &pipeline;
+			if (pipeline.start != first->start || pipeline.count != first->count) batchable = false;
+			add({pipeline.program, pipeline.vao, pipeline.instanced_program, pipeline.instanced_vao, pipeline.type});
+			for (auto const &texture : pipeline.textures) {
+				add({texture.texture, texture.target});
+			}
+			key.insert(key.end(), {pipeline.start, pipeline.count});
+		}
+		if (!instanceable || !first) continue;
+		groups[key].emplace_back(i);
+		if (batchable) batch_keys[i] = std::move(batch_key);
+	}
+
+	std::map< std::vector< GLuint >, std::vector< uint32_t > > batches;
+	for (auto &entry : groups) {
+		if (entry.second.size() < 2) {
+			//nothing to share instances with, but maybe a batch:
+			uint32_t index = entry.second[0];
+			if (!batch_keys[index].empty()) batches[batch_keys[index]].emplace_back(index);
+			continue;
+		}
+		instance_groups.emplace_back();
+		InstanceGroup &group = instance_groups.back();
+		group.members = std::move(entry.second);
+		for (uint32_t index : group.members) {
+			drawables[index].instance_group = uint32_t(instance_groups.size() - 1);
+		}
+		allocate_instance_data(group);
+	}
+
+	for (auto &entry : batches) {
+		//map each member's vertices to the member's index in the batch:
+		GLuint begin = -1U, end = 0;
+		for (uint32_t index : entry.second) {
+			Drawable::Pipeline const &pipeline = drawables[index].pipeline[Drawable::ProgramTypeDefault];
+			begin = std::min(begin, pipeline.start);
+			end = std::max(end, pipeline.start + pipeline.count);
+		}
+		std::vector< uint32_t > slots(end - begin, -1U);
+		std::vector< uint32_t > members;
+		for (uint32_t index : entry.second) {
+			Drawable::Pipeline const &pipeline = drawables[index].pipeline[Drawable::ProgramTypeDefault];
+			auto first = slots.begin() + (pipeline.start - begin);
+			auto last = first + pipeline.count;
+			//(identical vertex ranges went to instance groups, but partly overlapping ones would need two slots)
+			if (std::any_of(first, last, [](uint32_t slot){ return slot != -1U; })) continue;
+			std::fill(first, last, uint32_t(members.size()));
+			members.emplace_back(index);
+		}
+		if (members.size() < 2) continue; //(a batch of one is just a draw)
+
+		static_batches.emplace_back();
+		StaticBatch &batch = static_batches.back();
+		batch.members = std::move(members);
+		batch.slots_base = GLint(begin);
+		for (uint32_t index : batch.members) {
+			drawables[index].static_batch = uint32_t(static_batches.size() - 1);
+		}
+		allocate_instance_data(batch);
+
+		glGenBuffers(1, &batch.slots_buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, batch.slots_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, slots.size() * sizeof(uint32_t), slots.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glGenTextures(1, &batch.slots_texture);
+		glBindTexture(GL_TEXTURE_BUFFER, batch.slots_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, batch.slots_buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	GL_ERRORS();
+
+	instance_groups_dirty = false;
+}
+
+void Scene::update_instance_groups() {
+	std::vector< glm::vec4 > data;
+	auto update = [&](InstanceGroup &group) {
+		//only rebuild groups with a member whose transform changed since the last upload:
+		bool changed = false;
+		for (uint32_t m = 0; m < group.members.size(); ++m) {
+			uint32_t version = drawables[group.members[m]].transform->update_world_cache();
+			if (version != group.versions[m]) {
+				group.versions[m] = version;
+				changed = true;
+			}
+		}
+		if (!changed) return;
+
+		data.clear();
+		data.reserve(group.members.size() * InstanceTexels);
+		for (uint32_t index : group.members) {
+			glm::mat4x3 const &to_world = drawables[index].transform->world_cache.local_to_world;
+			glm::mat3 normal_to_world = glm::inverse(glm::transpose(glm::mat3(to_world)));
+			//rows, so the shader can fetch them as vec4s:
+			glm::mat3x4 rows = glm::transpose(to_world);
+			glm::mat3 normal_rows = glm::transpose(normal_to_world);
+			data.emplace_back(rows[0]);
+			data.emplace_back(rows[1]);
+			data.emplace_back(rows[2]);
+			data.emplace_back(normal_rows[0], 0.0f);
+			data.emplace_back(normal_rows[1], 0.0f);
+			data.emplace_back(normal_rows[2], 0.0f);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, group.buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, data.size() * sizeof(glm::vec4), data.data());
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	};
+	for (auto &group : instance_groups) update(group);
+	for (auto &batch : static_batches) update(batch);
+	GL_ERRORS();
+}
+
+void Scene::build_bvh() {
+	std::vector< BVH::Item > static_items, dynamic_items;
+	unbounded_drawables.clear();
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		Drawable const &drawable = drawables[i];
+		if (!drawable.has_bounds() || drawable.world_bbox_version == 0) {
+			unbounded_drawables.emplace_back(i);
+		} else if (drawable.dynamic) {
+			dynamic_items.emplace_back(BVH::Item{i, drawable.world_bbox_min, drawable.world_bbox_max});
+		} else {
+			static_items.emplace_back(BVH::Item{i, drawable.world_bbox_min, drawable.world_bbox_max});
+		}
+	}
+	static_bvh.build(std::move(static_items));
+	dynamic_bvh.build(std::move(dynamic_items));
+	bvh_dirty = false;
+	bvh_builds += 1;
+}
+
+uint32_t Scene::for_each_in_frustum(Frustum const &frustum, std::function< void(Drawable &) > const &fn) {
+	auto test = [&frustum](glm::vec3 const &min, glm::vec3 const &max) {
+		return frustum.classify(min, max);
+	};
+
+	if (bvh_dirty) {
+		//trees are out of date (e.g., update_world_bounds() hasn't been called), so test drawables one at a time:
+		uint32_t culled = 0;
+		for (auto &drawable : drawables) {
+			if (drawable.world_bbox_version != 0 && !frustum.intersects(drawable.world_bbox_min, drawable.world_bbox_max)) {
+				culled += 1;
+			} else if (drawable.render_to_screen) {
+				fn(drawable);
+			}
+		}
+		return culled;
+	}
+
+	uint32_t visited = 0;
+	auto visit = [&](uint32_t index) {
+		visited += 1;
+		if (drawables[index].render_to_screen) fn(drawables[index]);
+	};
+	static_bvh.query(test, visit);
+	dynamic_bvh.query(test, visit);
+	for (uint32_t index : unbounded_drawables) {
+		if (drawables[index].render_to_screen) fn(drawables[index]);
+	}
+	return uint32_t(static_bvh.size() + dynamic_bvh.size()) - visited;
+}
+
+Scene::Drawable *Scene::ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_distance, float *distance) {
+	Drawable *closest = nullptr;
+	float closest_t = max_distance;
+	auto visit = [&](uint32_t index, float t) {
+		if (drawables[index].render_to_screen && t <= closest_t) {
+			closest = &drawables[index];
+			closest_t = t;
+		}
+	};
+
+	if (bvh_dirty) {
+		glm::vec3 inv_direction = 1.0f / direction;
+		for (uint32_t i = 0; i < drawables.size(); ++i) {
+			float t;
+			if (drawables[i].world_bbox_version != 0
+			 && BVH::ray_hits_box(origin, inv_direction, closest_t, drawables[i].world_bbox_min, drawables[i].world_bbox_max, &t)) {
+				visit(i, t);
+			}
+		}
+	} else {
+		static_bvh.ray_query(origin, direction, max_distance, visit);
+		dynamic_bvh.ray_query(origin, direction, max_distance, visit);
+	}
+
+	if (closest && distance) *distance = closest_t;
+	return closest;
+}
+
+uint32_t Scene::add_material(Material const &material) {
+	//(material tables are small, so a linear search is fine)
+	for (uint32_t i = 0; i < materials.size(); ++i) {
+		if (materials[i] == material) return i;
+	}
+	materials.emplace_back(material);
+	materials_dirty = true;
+	return uint32_t(materials.size() - 1);
+}
+
+void Scene::upload_materials() {
+	if (!materials_dirty) return;
+
+	//each slot is bound with glBindBufferRange, so slots must start at multiples of the offset alignment:
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, GLint(sizeof(MaterialData)));
+	materials_stride = (GLsizeiptr(sizeof(MaterialData)) + alignment - 1) / alignment * alignment;
+
+	std::vector< uint8_t > data(materials.size() * materials_stride, 0);
+	for (uint32_t i = 0; i < materials.size(); ++i) {
+		MaterialData slot;
+		slot.roughness = materials[i].roughness;
+		slot.uses_vertex_color = materials[i].uses_vertex_color ? 1 : 0;
+		std::memcpy(data.data() + i * materials_stride, &slot, sizeof(slot));
+	}
+
+	if (materials_buffer == 0) glGenBuffers(1, &materials_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, materials_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GL_ERRORS();
+
+	materials_dirty = false;
+}
+
+void Scene::upload_lights(glm::vec3 const &eye, std::vector< LightData > const &extra) {
+	if (lights_buffer == 0) {
+		glGenBuffers(1, &lights_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsHeader) + MaxLights * sizeof(LightData), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		lights_data.clear();
+		light_sources.clear();
+	}
+	//(bound every time, since another scene may have bound its own buffer -- or deleted it -- since)
+	glBindBufferBase(GL_UNIFORM_BUFFER, LightsBinding, lights_buffer);
+
+	//slots [0, dirty_end) are re-sent:
+	uint32_t dirty_end = 0;
+	auto pack = [&](uint32_t slot, LightData const &data) {
+		if (slot >= lights_data.size()) lights_data.resize(slot + 1);
+		lights_data[slot] = data;
+		dirty_end = std::max(dirty_end, slot + 1);
+	};
+
+	uint32_t count = std::min< uint32_t >(uint32_t(extra.size()), MaxLights);
+	for (uint32_t i = 0; i < count; ++i) {
+		pack(i, extra[i]);
+	}
+
+	bool fresh = (light_sources.size() != lights.size());
+	if (fresh) light_sources.assign(lights.size(), LightSource());
+	uint32_t source = 0;
+	for (auto const &light : lights) {
+		LightSource &cached = light_sources[source++];
+		if (light.type == Light::Hemisphere || light.type == Light::Directional) {
+			if (fresh) std::cout << "Only one hemisphere & directional light is allowed! Not adding this one!" << std::endl;
+			continue;
+		}
+		if (count == MaxLights) {
+			if (fresh) std::cout << "Max light count reached!" << std::endl;
+			break;
+		}
+		uint32_t slot = count++;
+
+		uint32_t version = light.transform->update_world_cache();
+		//(scene lights also move to other slots if the number of extra lights changes)
+		if (slot == cached.slot && version == cached.world_version && light.type == cached.type
+		 && light.energy == cached.energy && light.spot_fov == cached.spot_fov) continue;
+		cached.slot = slot;
+		cached.world_version = version;
+		cached.type = light.type;
+		cached.energy = light.energy;
+		cached.spot_fov = light.spot_fov;
+
+		glm::mat4x3 const &light_to_world = light.transform->world_cache.local_to_world;
+		LightData data;
+		data.location = light_to_world[3];
+		data.direction = -light_to_world[2];
+		data.energy = light.energy;
+		if (light.type == Light::Spot) {
+			data.type = 2;
+			data.cutoff = std::cos(0.5f * light.spot_fov);
+		}
+		pack(slot, data);
+	}
+
+	LightsHeader header;
+	header.eye = eye;
+	header.count = count;
+
+	//one upload, from the header through the last slot that changed:
+	static std::vector< uint8_t > staging;
+	staging.resize(sizeof(LightsHeader) + dirty_end * sizeof(LightData));
+	std::memcpy(staging.data(), &header, sizeof(header));
+	if (dirty_end) std::memcpy(staging.data() + sizeof(header), lights_data.data(), dirty_end * sizeof(LightData));
+	glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	lights_uploaded = uint32_t(staging.size());
+	GL_ERRORS();
+}
+
+void Scene::draw(Drawable::PassType pass_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, DrawSubset subset) {
     assert(pass_type < Scene::Drawable::PassTypes);
+    upload_materials();
+
+    //all passes draw from a view volume given by world_to_clip (perspective camera or orthographic sun), so cull against it:
+    Frustum frustum(world_to_clip);
+    PassStats &stats = pass_stats[pass_type];
+    if (subset != DrawDynamic) stats = PassStats();
+
+    //default and in-camera passes shade drawables; the shadow, occlusion, and prepass passes
+    // only need depth (and vertex positions), so use the shadow program to avoid shader effects:
+    Drawable::ProgramType program_type = Drawable::ProgramTypeShadow;
+    if (pass_type == Drawable::PassTypeDefault || pass_type == Drawable::PassTypeInCamera) {
+        program_type = Drawable::ProgramTypeDefault;
+    }
 
-    if (pass_type == Drawable::PassTypeDefault || pass_type == Drawable::PassTypeInCamera){
-        //Iterate through all drawables that aren't marked as occluded, sending each one to OpenGL:
-        for (auto const &drawable: drawables) {
-            if (drawable.render_to_screen /*&& drawable.frag_count*/) {
-                render_drawable(drawable, Drawable::ProgramTypeDefault, world_to_clip, world_to_light);
-//                std::cout << "drawing " << drawable.transform->name << std::endl;
-            }
+    //position-only passes draw baked scenery in world-space chunks (and skip the drawables those replace):
+    bool use_chunks = use_baked && baked.program != 0 && (pass_type == Drawable::PassTypeShadow || pass_type == Drawable::PassTypePrepass);
+    if (subset == DrawDynamic) use_chunks = false; //(chunks are static scenery)
+
+    //shaded passes skip drawables hidden behind an earlier prepass, if it still shows this frame:
+    // (the pyramid only holds static drawables, so it says nothing about where moving ones are, and those are always drawn)
+    bool test_hiz = (pass_type == Drawable::PassTypeDefault || pass_type == Drawable::PassTypeInCamera) && hiz_current(world_to_clip);
+
+    //the default pass can also cull with last frame's occlusion queries (see use_occlusion_queries):
+    bool test_queries = use_occlusion_queries && occlusion_box.program != 0 && pass_type == Drawable::PassTypeDefault;
+    static std::vector< Drawable * > occlusion_tested, occlusion_hidden;
+    occlusion_tested.clear();
+    occlusion_hidden.clear();
+
+    //queue up visible drawables, keyed by the state they need and (roughly) their distance from the viewer:
+    // (instance groups are queued once, when their first visible member is found, and drawn whole;
+    //  static batches are also queued once, but draw only their visible members)
+    render_queue.clear();
+    queued_draws.clear();
+    draw_serial += 1;
+    stats.culled += for_each_in_frustum(frustum, [&](Drawable &drawable) {
+        if (subset == DrawStatic && drawable.dynamic) return;
+        if (subset == DrawDynamic && !drawable.dynamic) return;
+        if (use_chunks && drawable.baked_chunk != -1U && baked.chunks[drawable.baked_chunk].valid) return;
+        if (test_hiz && !drawable.dynamic && drawable.has_bounds() && hiz.occluded(drawable.world_bbox_min, drawable.world_bbox_max)) {
+            stats.occluded += 1;
+            return;
         }
-    } else if(pass_type == Drawable::PassTypeShadow) {
-        //Iterate through all drawables, to render depth map for shadows:
-        for (auto const &drawable: drawables) {
-            if (drawable.render_to_screen) {
-                render_drawable(drawable, Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
+        Drawable::Pipeline const &pipeline = drawable.pipeline[program_type];
+        //only drawables drawn on their own get queried (groups and batches are drawn whole):
+        if (test_queries && drawable.has_bounds()
+         && !(use_instancing && drawable.instance_group != -1U) && !(use_static_batches && drawable.static_batch != -1U)) {
+            //boxes that reach past the near plane would be clipped, so could look hidden when they aren't:
+            bool near = false;
+            for (uint32_t c = 0; c < 8 && !near; ++c) {
+                glm::vec4 clip = world_to_clip * glm::vec4(
+                    (c & 1 ? drawable.world_bbox_max.x : drawable.world_bbox_min.x),
+                    (c & 2 ? drawable.world_bbox_max.y : drawable.world_bbox_min.y),
+                    (c & 4 ? drawable.world_bbox_max.z : drawable.world_bbox_min.z),
+                    1.0f
+                );
+                near = (clip.z < -clip.w);
             }
-        }
-    } else if(pass_type == Drawable::PassTypeOcclusion) {
-        //Iterate through all drawables with quert
-        for(Drawable &drawable : drawables) {
-            if (drawable.render_to_screen) {
-                //drawable.queries.StartQuery();
-                //use shadow pass to ensure no shader effects
-                render_drawable(drawable, Scene::Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
-                //drawable.queries.EndQuery();
-
-//                std::optional<GLuint> result = drawable.queries.most_recent_query();
-
-//                if(result.has_value()) {
-//                    std::cout << "setting frag count for " << drawable.transform->name << "to " << result.value() << std::endl;
-//                    drawable.frag_count = result.value();
-//                }
+            if (!near) {
+                if (drawable.occlusion_slot == -1U) {
+                    drawable.occlusion_slot = uint32_t(occlusion_slots.size());
+                    occlusion_slots.emplace_back();
+                }
+                OcclusionSlot &slot = occlusion_slots[drawable.occlusion_slot];
+                //pick up whatever results have arrived, oldest first:
+                while (slot.pending > 0) {
+                    GLuint query = slot.queries[(slot.next + slot.queries.size() - slot.pending) % slot.queries.size()];
+                    GLuint available = GL_FALSE;
+                    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                    if (!available) break;
+                    GLuint passed = GL_FALSE;
+                    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+                    slot.visible = (passed != GL_FALSE);
+                    slot.pending -= 1;
+                }
+                //(with every query still in flight there is nothing to test it with, so it's drawn normally)
+                if (slot.pending < slot.queries.size()) {
+                    occlusion_tested.emplace_back(&drawable);
+                    if (!slot.visible) {
+                        occlusion_hidden.emplace_back(&drawable);
+                        return;
+                    }
+                }
             }
         }
-    } else if(pass_type == Drawable::PassTypePrepass) {
-        //Render all visible objects only to depth buffer & vertex buffer
-        for (auto const &drawable: drawables) {
-            if (drawable.render_to_screen /*&& drawable.frag_count*/) {
-                render_drawable(drawable, Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
+        float depth = 0.0f;
+        if (drawable.has_bounds()) {
+            glm::vec3 center = 0.5f * (drawable.world_bbox_min + drawable.world_bbox_max);
+            depth = (world_to_clip * glm::vec4(center, 1.0f)).w;
+        }
+        if (use_instancing && drawable.instance_group != -1U) {
+            InstanceGroup &group = instance_groups[drawable.instance_group];
+            if (group.queued == draw_serial) return;
+            group.queued = draw_serial;
+            render_queue.push(RenderQueue::make_key(pass_type, pipeline.instanced_program, pipeline.instanced_vao, pipeline.textures[0].texture, depth), uint32_t(queued_draws.size()));
+            queued_draws.emplace_back(QueuedDraw{&drawable, drawable.instance_group, -1U});
+        } else if (use_static_batches && drawable.static_batch != -1U) {
+            //batches gather the ranges of their visible members, and are drawn once:
+            StaticBatch &batch = static_batches[drawable.static_batch];
+            if (batch.queued != draw_serial) {
+                batch.queued = draw_serial;
+                batch.firsts.clear();
+                batch.counts.clear();
+                render_queue.push(RenderQueue::make_key(pass_type, pipeline.instanced_program, pipeline.instanced_vao, pipeline.textures[0].texture, depth), uint32_t(queued_draws.size()));
+                queued_draws.emplace_back(QueuedDraw{&drawable, -1U, drawable.static_batch});
             }
+            batch.firsts.emplace_back(GLint(pipeline.start));
+            batch.counts.emplace_back(GLsizei(pipeline.count));
+        } else {
+            render_queue.push(RenderQueue::make_key(pass_type, pipeline.program, pipeline.vao, pipeline.textures[0].texture, depth), uint32_t(queued_draws.size()));
+            queued_draws.emplace_back(QueuedDraw{&drawable, -1U, -1U});
+        }
+    });
+
+    //sorting groups draws that share a program/vao/texture, and draws those front-to-back:
+    render_queue.sort();
+
+    BoundState state;
+    state.stats = &stats;
+    //(chunks are big, so draw them first to fill in depth)
+    if (use_chunks) render_baked(frustum, world_to_clip, world_to_light, state);
+    for (RenderQueue::Packet const &packet : render_queue.packets) {
+        QueuedDraw const &queued = queued_draws[packet.id];
+        if (queued.instance_group != -1U) {
+            InstanceGroup const &group = instance_groups[queued.instance_group];
+            stats.submitted += uint32_t(group.members.size());
+            render_instances(group, program_type, world_to_clip, world_to_light, state);
+        } else if (queued.static_batch != -1U) {
+            StaticBatch const &batch = static_batches[queued.static_batch];
+            stats.submitted += uint32_t(batch.firsts.size());
+            render_static_batch(batch, program_type, world_to_clip, world_to_light, state);
+        } else {
+            stats.submitted += 1;
+            render_drawable(*queued.drawable, program_type, world_to_clip, world_to_light, &state);
         }
     }
+    //(everything drawn so far fills in the depth the queries test against)
+    if (!occlusion_tested.empty()) render_occlusion(occlusion_tested, occlusion_hidden, program_type, world_to_clip, world_to_light, state);
+    state.unbind_textures();
 
 	glUseProgram(0);
 	glBindVertexArray(0);
@@ -158,56 +969,379 @@ void Scene::draw(Drawable::PassType pass_type, glm::mat4 const &world_to_clip, g
 	GL_ERRORS();
 }
 
+void Scene::read_hiz(glm::mat4 const &world_to_clip) {
+    HiZReadback &readback = hiz_readback;
+
+    //pick up the previous read if it has finished:
+    if (readback.fence) {
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return; //(still in flight)
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+
+        hiz.levels.clear();
+        hiz.levels.emplace_back();
+        HiZ::Level &level = hiz.levels.back();
+        level.size = readback.size;
+        level.depth.resize(size_t(level.size.x) * level.size.y);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        void const *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(level.depth.size() * sizeof(float)), GL_MAP_READ_BIT);
+        if (mapped) {
+            std::memcpy(level.depth.data(), mapped, level.depth.size() * sizeof(float));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            hiz.world_to_clip = readback.world_to_clip;
+            hiz_static_serial = readback.static_serial;
+            hiz.build_levels();
+        } else {
+            hiz.levels.clear();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    //start reading the first level narrow enough to be cheap to copy and test against:
+    uint32_t level = 0;
+    while (level + 1 < framebuffers.hiz_levels && framebuffers.hiz_size(level).x > HiZReadWidth) ++level;
+    if (level >= framebuffers.hiz_levels) return;
+    readback.size = framebuffers.hiz_size(level);
+    readback.world_to_clip = world_to_clip;
+    readback.static_serial = static_serial;
+
+    if (readback.buffer == 0) glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(sizeof(float)) * readback.size.x * readback.size.y, nullptr, GL_STREAM_READ);
+    glBindTexture(GL_TEXTURE_2D, framebuffers.hiz_tex);
+    glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL_ERRORS();
+}
+
+bool Scene::hiz_current(glm::mat4 const &world_to_clip) const {
+    //(exact comparisons: an unchanged camera makes bit-identical matrices, and anything else might uncover what the pyramid hides)
+    return use_hiz && !hiz.empty() && hiz.world_to_clip == world_to_clip && hiz_static_serial == static_serial;
+}
+
 void Scene::render_picture(const Scene::Camera &camera, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector<GLfloat> &data) {
+    PictureCapture capture;
+    begin_picture(camera, {}, &capture);
+    finish_picture(&capture, occlusion_results);
+
+    data.resize(3 * size_t(capture.size.x) * capture.size.y);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, capture.texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, data.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    GL_ERRORS();
+}
+
+Scene::PictureCapture::~PictureCapture() {
+    if (fence) glDeleteSync(fence);
+    if (texture) glDeleteTextures(1, &texture);
+    if (thumbnail) glDeleteTextures(1, &thumbnail);
+    if (ids) glDeleteBuffers(1, &ids);
+    for (GLuint query : focal_points) {
+        if (query) glDeleteQueries(1, &query);
+    }
+}
+
+bool Scene::PictureCapture::ready() const {
+    if (!fence) return true;
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void Scene::begin_picture(Camera const &camera, std::vector< Drawable * > const &focal_points, PictureCapture *capture_) {
     assert(camera.transform);
+    assert(capture_);
+    PictureCapture &capture = *capture_;
     glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
     glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
+    upload_materials();
+
+    //picture_tex, id_tex (and the depth of field blur) are transient, so they only get (shared, pooled) textures for these passes:
+    FrameGraph graph;
+    std::vector< Framebuffers::Target > picture_reads = add_depth_of_field_blur(graph);
+    picture_reads.insert(picture_reads.end(), {Framebuffers::Screen, Framebuffers::MSDepth, Framebuffers::PrepassDepth, Framebuffers::Picture});
+    graph.add("picture", picture_reads, {Framebuffers::Picture}, [&]() {
+        //post-process the screen into picture_tex (rgb16f), with the settings the last frame used:
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.picture_fb);
+        framebuffers.post_process(framebuffers.screen_texture, Framebuffers::PostDepthOfField | Framebuffers::PostFog | Framebuffers::PostToneMap);
+
+        //...and copy it into textures of the picture's own, without it leaving the GPU:
+        capture.size = framebuffers.size;
+        auto make_texture = [](glm::uvec2 size, bool mipmaps) {
+            GLuint texture = 0;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return texture;
+        };
+        capture.texture = make_texture(capture.size, true);
+        capture.thumbnail_size.x = std::min< uint32_t >(PictureCapture::ThumbnailWidth, capture.size.x);
+        capture.thumbnail_size.y = std::max(1U, uint32_t(std::lround(double(capture.size.y) * capture.thumbnail_size.x / std::max(1U, capture.size.x))));
+        capture.thumbnail = make_texture(capture.thumbnail_size, false);
+
+        //(the float -> unorm conversion clamps to [0,1], as the png export always did)
+        GLuint copy_fbs[2] = {0, 0};
+        glGenFramebuffers(2, copy_fbs);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers.picture_fb);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copy_fbs[1]);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, capture.texture, 0);
+        glBlitFramebuffer(0, 0, capture.size.x, capture.size.y, 0, 0, capture.size.x, capture.size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, capture.texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        //thumbnail: a linear blit from the smallest mip level that is still at least as wide, so every texel gets averaged in:
+        uint32_t level = 0;
+        while ((capture.size.x >> (level + 1)) >= capture.thumbnail_size.x) level += 1;
+        glm::uvec2 level_size = glm::max(glm::uvec2(1), glm::uvec2(capture.size.x >> level, capture.size.y >> level));
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, copy_fbs[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, capture.texture, level);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, capture.thumbnail, 0);
+        glBlitFramebuffer(0, 0, level_size.x, level_size.y, 0, 0, capture.thumbnail_size.x, capture.thumbnail_size.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(2, copy_fbs);
+        GL_ERRORS();
+    }, true);
+    graph.add("ids", {Framebuffers::IDs, Framebuffers::IDDepth}, {Framebuffers::IDs, Framebuffers::IDDepth}, [&]() {
+        //ID pass: draw the depth and ids of everything in view with one pipeline (each drawable's own shadow program), so
+        // only the frontmost surface at each pixel keeps its id -- testing against the prepass's depth instead would have
+        // baked and instanced scenery (drawn there by other programs, so not to the same depths) fail at random
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.id_fb);
+        GLuint const clear_id[4] = {0, 0, 0, 0};
+        glClearBufferuiv(GL_COLOR, 1, clear_id);
+        glClearDepth(1.0f);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+
+        //(hidden drawables wouldn't write any ids, so skip them if the pyramid still shows this view)
+        bool test_hiz = hiz_current(world_to_clip);
+        Frustum frustum(world_to_clip);
+        BoundState state;
+        for (auto &drawable : drawables) {
+            //drawables on screen but not in pictures still hide what is behind them, so they are drawn with id 0 ("nothing"):
+            if (!drawable.render_to_picture && !drawable.render_to_screen) continue;
+            if (drawable.has_bounds() && !frustum.intersects(drawable.world_bbox_min, drawable.world_bbox_max)) continue;
+            if (test_hiz && !drawable.dynamic && drawable.has_bounds() && hiz.occluded(drawable.world_bbox_min, drawable.world_bbox_max)) {
+                if (drawable.render_to_picture) capture.occluded += 1;
+                continue;
+            }
+            Drawable::Pipeline const &pipeline = drawable.pipeline[Drawable::ProgramTypeShadow];
+            if (pipeline.program == 0 || pipeline.OBJECT_ID_uint == -1U) continue;
+            GLuint id = 0;
+            if (drawable.render_to_picture) {
+                capture.id_drawables.emplace_back(&drawable);
+                id = GLuint(capture.id_drawables.size());
+            }
+            state.use_program(pipeline.program);
+            glUniform1ui(pipeline.OBJECT_ID_uint, id);
+            render_drawable(drawable, Scene::Drawable::ProgramTypeShadow, world_to_clip, world_to_light, &state);
+        }
+        state.unbind_textures();
+
+        //...and read the whole ID image back at once:
+        glGenBuffers(1, &capture.ids);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.ids);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(sizeof(GLuint)) * capture.size.x * capture.size.y, nullptr, GL_STREAM_READ);
+        glBindTexture(GL_TEXTURE_2D, framebuffers.id_tex);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        GL_ERRORS();
+    }, true);
+    graph.run();
+
+    //focal points are tested against the main view's depth, without writing anything:
+    begin_focal_points(camera, focal_points, &capture.focal_points);
+
+    capture.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); //(so the fence actually gets to the GPU and can signal)
+    GL_ERRORS();
+}
 
-    //transform rgb16f texture to rgba8ui texture for export
-    //code modeled after this snippet https://stackoverflow.com/questions/48938930/pixel-access-with-glgetteximage
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.picture_fb);
-    framebuffers.tone_map_to_screen(framebuffers.screen_texture);
-    glBindTexture(GL_TEXTURE_2D, framebuffers.picture_tex);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, data.data());
-    glBindTexture(GL_TEXTURE_2D, 0);
+void Scene::finish_picture(PictureCapture *capture_, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector< bool > *focal_results) {
+    assert(capture_);
+    PictureCapture &capture = *capture_;
+    if (capture.fence) {
+        while (glClientWaitSync(capture.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) { }
+        glDeleteSync(capture.fence);
+        capture.fence = 0;
+    }
+
+    //fragment counts for every drawable from one histogram of the ID image:
+    if (capture.ids) {
+        size_t pixels = size_t(capture.size.x) * capture.size.y;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.ids);
+        GLuint const *mapped = reinterpret_cast< GLuint const * >(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(pixels * sizeof(GLuint)), GL_MAP_READ_BIT));
+        if (mapped) {
+            IdHistogram histogram;
+            histogram.count(mapped, pixels, uint32_t(capture.id_drawables.size() + 1));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            for (uint32_t i = 0; i < capture.id_drawables.size(); ++i) {
+                if (histogram.counts[i + 1] > 0) {
+                    occlusion_results.emplace_back(*capture.id_drawables[i], histogram.counts[i + 1]);
+                }
+            }
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &capture.ids);
+        capture.ids = 0;
+    }
+    capture.id_drawables.clear();
+
+    //(the fence came after the focal point queries, so this doesn't wait)
+
+    std::vector< bool > focal_visible;
+    finish_focal_points(&capture.focal_points, focal_results ? *focal_results : focal_visible);
     GL_ERRORS();
-    //run query for each drawable
-    glEnable(GL_DEPTH_TEST);
-//    //bind renderbuffers for rendering
-////    glBindRenderbuffer(GL_RENDERBUFFER, framebuffers.ms_depth_rb);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.oc_fb);
+}
 
-//    glClear(GL_COLOR_BUFFER_BIT);
+void Scene::soft_picture(Camera const &camera, std::vector< Drawable * > const &focal_points, SoftRaster *raster, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector< bool > &focal_results) {
+    assert(camera.transform);
+    assert(raster);
+    glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+    Frustum frustum(world_to_clip);
+
+    //(posed vertices for animated drawables; a list so earlier ones don't move)
+    std::list< std::vector< glm::vec3 > > posed;
+    auto add_mesh = [&](Drawable &drawable, uint32_t id, std::vector< SoftRaster::Mesh > *meshes) {
+        Drawable::Pipeline const &pipeline = drawable.pipeline[Drawable::ProgramTypeShadow];
+        if (pipeline.program == 0 || pipeline.type != GL_TRIANGLES) return false;
+        glm::vec3 const *positions = drawable.cpu_positions;
+        if (drawable.pose_positions) {
+            posed.emplace_back();
+            drawable.pose_positions(&posed.back());
+            if (posed.back().size() < pipeline.start + pipeline.count) return false;
+            positions = posed.back().data();
+        }
+        if (!positions) return false;
+        SoftRaster::Mesh mesh;
+        mesh.object_to_clip = world_to_clip * glm::mat4(drawable.transform->make_local_to_world());
+        mesh.positions = positions + pipeline.start;
+        mesh.count = pipeline.count;
+        mesh.id = id;
+        meshes->emplace_back(mesh);
+        return true;
+    };
+
+    //everything in view: picture drawables get id i + 1, the rest of the scenery only occludes (id 0, like the background):
+    std::vector< SoftRaster::Mesh > meshes;
+    std::vector< Drawable * > id_drawables;
+    for (auto &drawable : drawables) {
+        if (!drawable.render_to_picture && !drawable.render_to_screen) continue;
+        if (drawable.has_bounds() && !frustum.intersects(drawable.world_bbox_min, drawable.world_bbox_max)) continue;
+        if (!drawable.render_to_picture) {
+            add_mesh(drawable, 0, &meshes);
+        } else if (add_mesh(drawable, uint32_t(id_drawables.size() + 1), &meshes)) {
+            id_drawables.emplace_back(&drawable);
+        }
+    }
+    raster->render(meshes);
 
-    for(auto &drawable : drawables) {
-//        GLuint query = drawable.query;
-        if(!drawable.render_to_picture) {
-            continue;
+    IdHistogram histogram;
+    histogram.count(raster->ids.data(), raster->ids.size(), uint32_t(id_drawables.size() + 1));
+    for (uint32_t i = 0; i < id_drawables.size(); ++i) {
+        if (histogram.counts[i + 1] > 0) {
+            occlusion_results.emplace_back(*id_drawables[i], histogram.counts[i + 1]);
         }
-//        //query syntax from https://www.reddit.com/r/opengl/comments/1pv8qe/how_do_occlusion_queries_work/
-//        if(!glIsQuery(query)) {
-//            glGenQueries(1, &query);
-//        }
-//        glBeginQuery(GL_SAMPLES_PASSED, query);
-        drawable.queries.StartQuery();
-        render_drawable(drawable, Scene::Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
-        drawable.queries.EndQuery();
     }
 
-    //second loop for fetching to give gpu extra time to finish queries
-    for(auto &drawable : drawables) {
-        if(!drawable.render_to_picture) {
-            continue;
+    //focal points are tested against the depth drawn above, without writing anything:
+    std::vector< SoftRaster::Mesh > focal_meshes;
+    std::vector< uint32_t > focal_mesh(focal_points.size(), -1U);
+    for (uint32_t i = 0; i < focal_points.size(); ++i) {
+        if (add_mesh(*focal_points[i], 0, &focal_meshes)) focal_mesh[i] = uint32_t(focal_meshes.size() - 1);
+    }
+    std::vector< bool > visible;
+    raster->test(focal_meshes, &visible);
+    focal_results.assign(focal_points.size(), false);
+    for (uint32_t i = 0; i < focal_points.size(); ++i) {
+        if (focal_mesh[i] != -1U) focal_results[i] = visible[focal_mesh[i]];
+    }
+}
+
+void Scene::BoundState::use_program(GLuint program_) {
+    if (program == program_) return;
+    glUseProgram(program_);
+    program = program_;
+    if (stats) stats->program_binds += 1;
+}
+
+void Scene::BoundState::bind_vao(GLuint vao_) {
+    if (vao == vao_) return;
+    glBindVertexArray(vao_);
+    vao = vao_;
+    if (stats) stats->vao_binds += 1;
+}
+
+void Scene::BoundState::bind_textures(Drawable::Pipeline::TextureInfo const (&want)[Drawable::Pipeline::TextureCount]) {
+    for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+        Drawable::Pipeline::TextureInfo &bound = textures[i];
+        if (want[i].texture == bound.texture && (want[i].texture == 0 || want[i].target == bound.target)) continue;
+        glActiveTexture(GL_TEXTURE0 + i);
+        if (bound.texture != 0 && (want[i].texture == 0 || want[i].target != bound.target)) {
+            glBindTexture(bound.target, 0);
+            if (stats) stats->texture_binds += 1;
         }
-        GLuint results = drawable.queries.wait_for_query();
-        if (results > 0) {
-            occlusion_results.emplace_back(drawable, results);
+        if (want[i].texture != 0) {
+            glBindTexture(want[i].target, want[i].texture);
+            if (stats) stats->texture_binds += 1;
         }
+        bound = want[i];
     }
+}
 
+void Scene::BoundState::unbind_textures() {
+    for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+        if (textures[i].texture != 0) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(textures[i].target, 0);
+            textures[i].texture = 0;
+            if (stats) stats->texture_binds += 1;
+        }
+    }
+    if (instances != 0) {
+        glActiveTexture(GL_TEXTURE0 + InstancesTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        instances = 0;
+    }
+    if (slots != 0) {
+        glActiveTexture(GL_TEXTURE0 + SlotsTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        slots = 0;
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Scene::bind_material(uint32_t material, BoundState *state) const {
+    assert(material < materials.size());
+    assert(!materials_dirty && "call upload_materials() before rendering");
+    if (state && state->stats) state->stats->unsorted_material_changes += 1;
+    if (state && state->material == material) return;
+
+    //point the Material block at this material's slot in the material buffer:
+    glBindBufferRange(GL_UNIFORM_BUFFER, MaterialBinding, materials_buffer, material * materials_stride, sizeof(MaterialData));
+    if (state) {
+        state->material = material;
+        if (state->stats) state->stats->material_changes += 1;
+    }
 }
 
-void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState *state) const {
     //Reference to drawable's pipeline for convenience:
     Scene::Drawable::Pipeline const &pipeline = drawable.pipeline[program_type];
 
@@ -219,11 +1353,14 @@ void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::Pr
     if (pipeline.count == 0) return;
 
 
-    //Set shader program:
-    glUseProgram(pipeline.program);
-
-    //Set attribute sources:
-    glBindVertexArray(pipeline.vao);
+    //Set shader program and attribute sources:
+    if (state) {
+        state->use_program(pipeline.program);
+        state->bind_vao(pipeline.vao);
+    } else {
+        glUseProgram(pipeline.program);
+        glBindVertexArray(pipeline.vao);
+    }
 
     //Configure program uniforms:
 
@@ -251,13 +1388,8 @@ void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::Pr
         glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
     }
 
-    //set uses vertex color uniform
-    if (pipeline.USES_VERTEX_COLOR != -1U) {
-        GLuint uses_vertex_color = GL_FALSE;
-        if(drawable.uses_vertex_color) {
-            uses_vertex_color = GL_TRUE;
-        }
-        glUniform1ui(pipeline.USES_VERTEX_COLOR, uses_vertex_color);
+    if (pipeline.Material_block != -1U) {
+        bind_material(drawable.material, state);
     }
 
     //set any requested custom uniforms:
@@ -265,6 +1397,25 @@ void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::Pr
         pipeline.set_uniforms();
     }
 
+    if (state) {
+        if (state->stats) {
+            state->stats->unsorted_program_binds += 1;
+            state->stats->unsorted_vao_binds += 1;
+            for (auto const &texture : pipeline.textures) {
+                if (texture.texture != 0) state->stats->unsorted_texture_binds += 2;
+            }
+            state->stats->draw_calls += 1;
+        }
+
+        //set up textures, leaving them bound for the next drawable:
+        state->bind_textures(pipeline.textures);
+
+        //draw the object:
+        glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+        GL_ERRORS();
+        return;
+    }
+
     //set up textures:
     for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
         if (pipeline.textures[i].texture != 0) {
@@ -288,42 +1439,228 @@ void Scene::render_drawable(Scene::Drawable const &drawable, Scene::Drawable::Pr
 
 }
 
-void Scene::test_focal_points(const Camera &camera, std::vector< Scene::Drawable *> &focal_points, std::vector< bool > &results) {
+bool Scene::bind_instanced(InstanceGroup const &group, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state, uint32_t draws) const {
+    assert(!group.members.empty());
+    //members agree on everything but their transforms (and, in batches, vertex ranges), so any member's pipeline will do:
+    Drawable const &first = drawables[group.members[0]];
+    Drawable::Pipeline const &pipeline = first.pipeline[program_type];
+    if (pipeline.instanced_program == 0 || pipeline.instanced_vao == 0 || pipeline.count == 0) return false;
+
+    state.use_program(pipeline.instanced_program);
+    state.bind_vao(pipeline.instanced_vao);
+
+    //per-instance matrices are in the group's buffer, so only the shared world-space transforms are uniforms:
+    if (pipeline.WORLD_TO_CLIP_mat4 != -1U) {
+        glUniformMatrix4fv(pipeline.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+    }
+    if (pipeline.WORLD_TO_LIGHT_mat4x3 != -1U) {
+        glUniformMatrix4x3fv(pipeline.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+    }
+    if (pipeline.NORMAL_WORLD_TO_LIGHT_mat3 != -1U) {
+        glm::mat3 normal_world_to_light = glm::inverse(glm::transpose(glm::mat3(world_to_light)));
+        glUniformMatrix3fv(pipeline.NORMAL_WORLD_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_world_to_light));
+    }
+
+    if (pipeline.Material_block != -1U) {
+        bind_material(first.material, &state);
+    }
+
+    if (state.stats) {
+        //(what drawing the members one by one would have cost)
+        state.stats->unsorted_program_binds += draws;
+        state.stats->unsorted_vao_binds += draws;
+        for (auto const &texture : pipeline.textures) {
+            if (texture.texture != 0) state.stats->unsorted_texture_binds += 2 * draws;
+        }
+        if (pipeline.Material_block != -1U) state.stats->unsorted_material_changes += draws - 1;
+        state.stats->draw_calls += 1;
+    }
+
+    state.bind_textures(pipeline.textures);
+    if (state.instances != group.texture) {
+        glActiveTexture(GL_TEXTURE0 + InstancesTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, group.texture);
+        state.instances = group.texture;
+        if (state.stats) state.stats->texture_binds += 1;
+    }
+    return true;
+}
+
+void Scene::render_instances(InstanceGroup const &group, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const {
+    if (!bind_instanced(group, program_type, world_to_clip, world_to_light, state, uint32_t(group.members.size()))) return;
+    Drawable::Pipeline const &pipeline = drawables[group.members[0]].pipeline[program_type];
+
+    if (pipeline.BATCHED_bool != -1U) glUniform1ui(pipeline.BATCHED_bool, GL_FALSE);
+    if (state.stats) state.stats->instanced += uint32_t(group.members.size());
+
+    glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, GLsizei(group.members.size()));
+    GL_ERRORS();
+}
+
+void Scene::render_static_batch(StaticBatch const &batch, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const {
+    if (batch.firsts.empty()) return;
+    if (!bind_instanced(batch, program_type, world_to_clip, world_to_light, state, uint32_t(batch.firsts.size()))) return;
+    Drawable::Pipeline const &pipeline = drawables[batch.members[0]].pipeline[program_type];
+
+    //the shader looks up which member a vertex belongs to (there's no gl_DrawID in GL 3.3):
+    if (pipeline.BATCHED_bool != -1U) glUniform1ui(pipeline.BATCHED_bool, GL_TRUE);
+    if (pipeline.SLOTS_BASE_int != -1U) glUniform1i(pipeline.SLOTS_BASE_int, batch.slots_base);
+    if (state.slots != batch.slots_texture) {
+        glActiveTexture(GL_TEXTURE0 + SlotsTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, batch.slots_texture);
+        state.slots = batch.slots_texture;
+        if (state.stats) state.stats->texture_binds += 1;
+    }
+    if (state.stats) state.stats->batched += uint32_t(batch.firsts.size());
+
+    glMultiDrawArrays(pipeline.type, batch.firsts.data(), batch.counts.data(), GLsizei(batch.firsts.size()));
+    GL_ERRORS();
+}
+
+void Scene::render_baked(Frustum const &frustum, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const {
+    static std::vector< GLint > firsts;
+    static std::vector< GLsizei > counts;
+    firsts.clear();
+    counts.clear();
+    for (auto const &chunk : baked.chunks) {
+        if (!chunk.valid || !frustum.intersects(chunk.min, chunk.max)) continue;
+        firsts.emplace_back(chunk.first);
+        counts.emplace_back(chunk.count);
+    }
+    if (firsts.empty()) return;
+
+    state.use_program(baked.program);
+    state.bind_vao(baked.vao);
+    //vertices are already in world space:
+    if (baked.WORLD_TO_CLIP_mat4 != -1U) {
+        glUniformMatrix4fv(baked.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+    }
+    if (baked.WORLD_TO_LIGHT_mat4x3 != -1U) {
+        glUniformMatrix4x3fv(baked.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+    }
+    if (state.stats) {
+        state.stats->baked_chunks += uint32_t(firsts.size());
+        state.stats->draw_calls += 1;
+    }
+
+    glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), GLsizei(firsts.size()));
+    GL_ERRORS();
+}
+
+void Scene::clear_occlusion_slots() {
+    for (auto &slot : occlusion_slots) {
+        for (GLuint query : slot.queries) {
+            if (query) glDeleteQueries(1, &query);
+        }
+    }
+    occlusion_slots.clear();
+    for (auto &drawable : drawables) {
+        drawable.occlusion_slot = -1U;
+    }
+}
+
+void Scene::render_occlusion(std::vector< Drawable * > const &tested, std::vector< Drawable * > const &hidden, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) {
+    //unit cube, made on first use:
+    if (occlusion_box.vao == 0) {
+        std::vector< glm::vec3 > cube;
+        //two triangles for each face, at coordinate 'axis' == 'side':
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            for (float side : {0.0f, 1.0f}) {
+                auto corner = [&](float u, float v) {
+                    glm::vec3 p;
+                    p[axis] = side;
+                    p[(axis + 1) % 3] = u;
+                    p[(axis + 2) % 3] = v;
+                    return p;
+                };
+                cube.insert(cube.end(), {corner(0,0), corner(1,0), corner(1,1), corner(0,0), corner(1,1), corner(0,1)});
+            }
+        }
+        glGenBuffers(1, &occlusion_box.buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, occlusion_box.buffer);
+        glBufferData(GL_ARRAY_BUFFER, cube.size() * sizeof(glm::vec3), cube.data(), GL_STATIC_DRAW);
+        glGenVertexArrays(1, &occlusion_box.vao);
+        glBindVertexArray(occlusion_box.vao);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLbyte *)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        state.vao = 0; //(bound above, behind state's back)
+        GL_ERRORS();
+    }
+
+    //boxes only touch the query results:
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    state.use_program(occlusion_box.program);
+    state.bind_vao(occlusion_box.vao);
+    glUniformMatrix4fv(occlusion_box.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+    for (Drawable *drawable : tested) {
+        OcclusionSlot &slot = occlusion_slots[drawable->occlusion_slot];
+        assert(slot.pending < slot.queries.size()); //(draw() only tests drawables with a free query)
+        GLuint &query = slot.queries[slot.next];
+        if (query == 0) glGenQueries(1, &query);
+        glUniform3fv(occlusion_box.BOX_MIN_vec3, 1, glm::value_ptr(drawable->world_bbox_min));
+        glUniform3fv(occlusion_box.BOX_MAX_vec3, 1, glm::value_ptr(drawable->world_bbox_max));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        slot.next = (slot.next + 1) % slot.queries.size();
+        slot.pending += 1;
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    if (state.stats) {
+        state.stats->proxy_queries += uint32_t(tested.size());
+        state.stats->draw_calls += uint32_t(tested.size());
+    }
+
+    //the GPU waits for each query (the CPU doesn't), and skips the draw if the box was hidden:
+    for (Drawable *drawable : hidden) {
+        glBeginConditionalRender(occlusion_slots[drawable->occlusion_slot].latest(), GL_QUERY_WAIT);
+        render_drawable(*drawable, program_type, world_to_clip, world_to_light, &state);
+        glEndConditionalRender();
+    }
+    if (state.stats) {
+        state.stats->conditional += uint32_t(hidden.size());
+        state.stats->submitted += uint32_t(hidden.size());
+    }
+    GL_ERRORS();
+}
+
+void Scene::begin_focal_points(const Camera &camera, std::vector< Scene::Drawable *> const &focal_points, std::vector< GLuint > *queries) const {
     assert(camera.transform);
+    assert(queries);
+    if (focal_points.empty()) return;
     glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
     glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
 
-    results.resize(focal_points.size());
+    size_t first = queries->size();
+    queries->resize(first + focal_points.size());
+    glGenQueries(GLsizei(focal_points.size()), queries->data() + first);
 
     //bind renderbuffers for rendering
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.ms_fb);
+    glEnable(GL_DEPTH_TEST);
 
     //disable writing color & depth
     glDepthMask(GL_FALSE);
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-    for(size_t i = 0; i < focal_points.size(); i++) {
-        auto &drawable = focal_points.at(i);
-        drawable->queries.StartQuery();
+    //focal points of one creature share programs and meshes, so only bind what changes:
+    BoundState state;
+    for (size_t i = 0; i < focal_points.size(); i++) {
+        glBeginQuery(GL_SAMPLES_PASSED, (*queries)[first + i]);
         //use shadow to compute because doesn't require lighting
-        render_drawable(*drawable, Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
-        drawable->queries.EndQuery();
-
-
-        GLuint passed = drawable->queries.wait_for_query();
-
-//        GLuint has_finished;
-//        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &has_finished);
-//        std::cout << drawable.transform->name << "finished: " << has_finished << std::endl;
-
-        results.at(i) = passed;
+        render_drawable(*focal_points[i], Drawable::ProgramTypeShadow, world_to_clip, world_to_light, &state);
+        glEndQuery(GL_SAMPLES_PASSED);
     }
+    state.unbind_textures();
 
     //reenable writing color & depth
     glDepthMask(GL_TRUE);
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glUseProgram(0);
@@ -332,6 +1669,34 @@ void Scene::test_focal_points(const Camera &camera, std::vector< Scene::Drawable
     GL_ERRORS();
 }
 
+void Scene::finish_focal_points(std::vector< GLuint > *queries, std::vector< bool > &results) const {
+    assert(queries);
+    results.assign(queries->size(), false);
+    if (queries->empty()) return;
+
+    //queries finish in the order they were issued, so waiting on the last one waits for the whole batch:
+    GLuint samples = 0;
+    glGetQueryObjectuiv(queries->back(), GL_QUERY_RESULT, &samples);
+    results.back() = (samples > 0);
+    for (size_t i = 0; i + 1 < queries->size(); i++) {
+        glGetQueryObjectuiv((*queries)[i], GL_QUERY_RESULT, &samples);
+        results[i] = (samples > 0);
+    }
+
+    glDeleteQueries(GLsizei(queries->size()), queries->data());
+    queries->clear();
+
+    GL_ERRORS();
+}
+
+void Scene::test_focal_points(const Camera &camera, std::vector< Scene::Drawable *> const &focal_points, std::vector< bool > &results) {
+    upload_materials();
+
+    std::vector< GLuint > queries;
+    begin_focal_points(camera, focal_points, &queries);
+    finish_focal_points(&queries, results);
+}
+
 
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const, GLuint tex) > const &on_drawable) {
@@ -481,7 +1846,7 @@ void Scene::load(std::string const &filename,
     //load textures
     std::cout<<"loading textures..."<<std::endl;
     for(auto &drawable : drawables) {
-        if(drawable.uses_vertex_color) {
+        if(materials[drawable.material].uses_vertex_color) {
             continue;
         }
         GLuint tex;
@@ -515,9 +1880,18 @@ void Scene::load(std::string const &filename,
 
         drawable.pipeline[Scene::Drawable::ProgramTypeShadow].textures[0].texture = tex;
         drawable.pipeline[Scene::Drawable::ProgramTypeShadow].textures[0].target = GL_TEXTURE_2D;
+
+        //drawables with the same texture (and parameters) share a material:
+        Material material = materials[drawable.material];
+        material.texture = tex;
+        drawable.material = add_material(material);
     }
 
     tex_map.clear();
+    //new drawables need to go into the bounding volume hierarchies and instance groups:
+    bvh_dirty = true;
+    instance_groups_dirty = true;
+
 	//load any extra that a subclass wants:
 	load_extra(file, names, hierarchy_transforms);
 
@@ -537,57 +1911,82 @@ Scene::Scene(Scene const &other) {
 	set(other);
 }
 
+Scene::~Scene() {
+	//(every delete is guarded, since a scene that never drew -- e.g., the one Load<> keeps -- may outlive the GL context)
+	clear_instance_groups();
+	clear_baked();
+	clear_occlusion_slots();
+	if (occlusion_box.vao) glDeleteVertexArrays(1, &occlusion_box.vao);
+	if (occlusion_box.buffer) glDeleteBuffers(1, &occlusion_box.buffer);
+	if (materials_buffer) glDeleteBuffers(1, &materials_buffer);
+	if (lights_buffer) glDeleteBuffers(1, &lights_buffer);
+	if (hiz_readback.fence) glDeleteSync(hiz_readback.fence);
+	if (hiz_readback.buffer) glDeleteBuffers(1, &hiz_readback.buffer);
+}
+
 Scene &Scene::operator=(Scene const &other) {
 	set(other);
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
-
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
+void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
 
-	transform_to_transform.clear();
+	//GL objects made for this scene's old drawables go first (the rest are reused):
+	clear_instance_groups();
+	clear_baked();
+	clear_occlusion_slots();
 
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+	//Copy transforms (same storage order, so other's transform 'i' maps to our transform 'i'):
+	transforms.copy_from(other.transforms);
 
-	//Copy transforms and store mapping:
-	transforms.clear();
-	for (auto const &t : other.transforms) {
-		transforms.emplace_back();
-		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
+	//store mapping between transforms old and new, if requested:
+	if (transform_map) {
+		transform_map->clear();
+		//null transform maps to itself:
+		transform_map->insert(std::make_pair(nullptr, nullptr));
+		for (Transform const &t : other.transforms) {
+			transform_map->insert(std::make_pair(&t, &transforms[t.index]));
+		}
 	}
 
-	//update transform parents:
-	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
-	}
+	auto remap = [this](Transform *t) -> Transform * {
+		return t ? &transforms[t->index] : nullptr;
+	};
 
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+		d.transform = remap(d.transform);
+		d.instance_group = -1U; //(other's groups and batches aren't copied)
+		d.occlusion_slot = -1U; //(...nor are occlusion queries)
+		d.static_batch = -1U;
+		d.baked_chunk = -1U; //(...nor baked chunks)
 	}
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+		c.transform = remap(c.transform);
 	}
 
 	//copy other's lights, updating transform pointers:
 	lights = other.lights;
 	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+		l.transform = remap(l.transform);
 	}
+	light_sources.clear(); //(repack everything on the next upload_lights())
+
+	//the program that draws baked chunks carries over, but not the chunks (call bake_static again to have them):
+	baked.program = other.baked.program;
+	baked.WORLD_TO_CLIP_mat4 = other.baked.WORLD_TO_CLIP_mat4;
+	baked.WORLD_TO_LIGHT_mat4x3 = other.baked.WORLD_TO_LIGHT_mat4x3;
+
+	//copy other's materials (drawables refer to them by index; the buffer is uploaded on the next draw):
+	materials = other.materials;
+	materials_dirty = true;
+
+	//bounding volume hierarchies and instance groups are rebuilt on the next update_world_bounds():
+	bvh_dirty = true;
+	instance_groups_dirty = true;
 }
 
@@ -11,33 +11,49 @@
  */
 
 #include "GL.hpp"
-#include "FragCountQueryAsync.h"
+#include "BVH.hpp"
+#include "RenderQueue.hpp"
+#include "HiZ.hpp"
+#include "SoftRaster.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <array>
 #include <list>
+#include <deque>
 #include <memory>
 #include <functional>
 #include <string>
 #include <vector>
+#include <limits>
 #include <unordered_map>
 #include <mutex>
 #include <future>
 
+//slots in the "Lights" uniform block (build with -DSCENE_MAX_LIGHTS=N to change):
+#ifndef SCENE_MAX_LIGHTS
+#define SCENE_MAX_LIGHTS 128
+#endif
+
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
 		std::string name;
 
+		//Transforms live in a TransformStore (see below); this is the transform's slot, in creation order:
+		uint32_t const index;
+
 		//The core function of a transform is to store a transformation in the world:
-		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
-		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
-		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		// (these reference the store's structure-of-arrays blocks)
+		glm::vec3 &position; //defaults to (0,0,0)
+		glm::quat &rotation; //defaults to identity
+		glm::vec3 &scale; //defaults to (1,1,1)
 
 		//The transform above may be relative to some parent transform:
-		Transform *parent = nullptr;
+		// (a pointer into the same store, so copies remap it by index; see TransformStore::copy_from)
+		Transform *&parent; //defaults to nullptr
 
 		//It is often convenient to construct matrices representing this transformation:
 		// ..relative to its parent:
@@ -50,27 +66,138 @@ struct Scene {
 		glm::mat3x3 get_world_rotation() const;
 		//return the front direction(positive X) in world space
 		glm::vec3 get_front_direction() const;
+		//uncached versions of the above (walk the whole parent chain every call):
+		glm::mat4x3 make_local_to_world_uncached() const;
+		glm::mat4x3 make_world_to_local_uncached() const;
+
+		//world matrices are cached (per handle, not in the store's blocks) and only recomputed when this transform or an ancestor changes:
+		// (position/rotation/scale/parent are compared against the values the cache was built from,
+		//  and 'world_version' is bumped on every recompute so children notice parent changes)
+		struct WorldCache {
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(0.0f);
+			Transform const *parent = nullptr;
+			uint32_t parent_version = 0;
+			uint32_t world_version = 0; //0 => never computed
+
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+			glm::mat3 world_rotation = glm::mat3(1.0f);
+		};
+		mutable WorldCache world_cache;
+		//brings world_cache up to date; returns the (possibly new) world_version:
+		uint32_t update_world_cache() const;
+		//...assuming the parent's cache is already up to date (used for linear passes over storage order):
+		uint32_t refresh_world_cache(uint32_t parent_version) const;
+		//number of world matrix recomputes (summed over all transforms, for profiling):
+		static uint32_t world_cache_recomputes;
 
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
-		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
-		Transform() = default;
+		//transforms are created by TransformStore::emplace_back:
+		Transform(uint32_t index_, glm::vec3 &position_, glm::quat &rotation_, glm::vec3 &scale_, Transform *&parent_)
+			: index(index_), position(position_), rotation(rotation_), scale(scale_), parent(parent_) { }
+	};
+
+	//Transforms are stored in creation order as structure-of-arrays blocks, with a handle (Transform) per slot:
+	// - data for transform 'i' is in slot i % BlockSize of blocks[i / BlockSize]
+	// - blocks never move, so Transform pointers stay valid as transforms are added
+	// - copying a store is a memcpy of each block plus an index-based parent fixup
+	// - creation order is parent-before-child for loaded scenes (Scene::load requires it), but slots never move
+	//   (handles reference them), so a transform re-parented under a later one is out of storage order;
+	//   update_world_matrices() walks 'order' instead, and re-sorts it whenever it finds a parent after its child
+	struct TransformStore {
+		enum : uint32_t { BlockSize = 256 };
+		struct Block {
+			glm::vec3 position[BlockSize];
+			glm::quat rotation[BlockSize];
+			glm::vec3 scale[BlockSize];
+			Transform *parent[BlockSize];
+		};
+		std::vector< std::unique_ptr< Block > > blocks;
+		std::deque< Transform > handles; //handles[i].index == i
+
+		//slot indices with every parent before its children (otherwise in storage order), and each slot's position in it:
+		// (rebuilt by sort_order(); empty or stale until the next update_world_matrices())
+		mutable std::vector< uint32_t > order;
+		mutable std::vector< uint32_t > rank; //order[rank[i]] == i
+
+		//add a new (identity, unparented) transform at the end of storage order:
+		Transform &emplace_back();
+		void clear();
+
+		size_t size() const { return handles.size(); }
+		bool empty() const { return handles.empty(); }
+		Transform &back() { return handles.back(); }
+		Transform const &back() const { return handles.back(); }
+		Transform &operator[](uint32_t i) { return handles[i]; }
+		Transform const &operator[](uint32_t i) const { return handles[i]; }
+		std::deque< Transform >::iterator begin() { return handles.begin(); }
+		std::deque< Transform >::iterator end() { return handles.end(); }
+		std::deque< Transform >::const_iterator begin() const { return handles.begin(); }
+		std::deque< Transform >::const_iterator end() const { return handles.end(); }
+
+		//replace contents with a copy of 'other' (parents are remapped to this store):
+		void copy_from(TransformStore const &other);
+
+		//bring every transform's world matrix cache up to date in one pass over 'order':
+		// (parents re-parented since the last sort are brought up to date recursively when their children are reached,
+		//  then 'order' is re-sorted so the next pass is linear again)
+		void update_world_matrices() const;
+		//transforms the next update_world_matrices() will reach before their parent:
+		uint32_t out_of_order() const;
+		//rebuild 'order' and 'rank' from the current parents:
+		void sort_order() const;
+
+		TransformStore() = default;
+		TransformStore(TransformStore const &) = delete;
+		TransformStore &operator=(TransformStore const &) = delete;
+	};
+
+	//surface parameters shared between drawables (Drawable::material is an index into Scene::materials):
+	struct Material {
+		float roughness = 0.9f;
+		bool uses_vertex_color = false; //tint texture by vertex color (and don't load a texture)
+		GLuint texture = 0; //texture bound for the default program (filled in by load())
+		bool operator==(Material const &o) const {
+			return roughness == o.roughness && uses_vertex_color == o.uses_vertex_color && texture == o.texture;
+		}
 	};
 
 	struct Drawable {
 		//a 'Drawable' attaches attribute data to a transform:
-		explicit Drawable(Transform *transform_) : transform(transform_), queries(FragCountQueryAsync(5)) { assert(transform);  }
+		explicit Drawable(Transform *transform_) : transform(transform_) { assert(transform);  }
 		Transform * transform;
 
         //for occlusion testing
-        FragCountQueryAsync queries; //implements queue of queries to ensure no blocking
+        uint32_t occlusion_slot = -1U; //index into Scene::occlusion_slots, once occlusion queries have tested this drawable
 
         //conditional drawing
         bool render_to_screen = true;
         bool render_to_picture = true;
         GLuint frag_count = 0; //for later use in object occlusion
-        bool uses_vertex_color = false;
-        float roughness = 0.9f;
+        uint32_t material = 0; //index into Scene::materials
+        uint32_t instance_group = -1U; //index into Scene::instance_groups, if drawn instanced (set by build_instance_groups())
+        uint32_t static_batch = -1U; //index into Scene::static_batches, if drawn batched (set by build_instance_groups())
+        uint32_t baked_chunk = -1U; //index into Scene::baked.chunks, if baked for depth passes (set by bake_static())
+        uint32_t baked_version = 0; //transform world_version the baked vertices came from
+
+        //object-space bounding box (usually copied from the Mesh); drawables with an empty box are never culled:
+        glm::vec3 bbox_min = glm::vec3( std::numeric_limits< float >::infinity());
+        glm::vec3 bbox_max = glm::vec3(-std::numeric_limits< float >::infinity());
+        //world-space bounding box, refreshed by Scene::update_world_bounds():
+        glm::vec3 world_bbox_min = glm::vec3( std::numeric_limits< float >::infinity());
+        glm::vec3 world_bbox_max = glm::vec3(-std::numeric_limits< float >::infinity());
+        uint32_t world_bbox_version = 0; //transform world_version the box was computed from
+        //moving drawables (e.g., creatures) go in the refit-only BVH; static drawables that move get switched over automatically:
+        bool dynamic = false;
+        bool has_bounds() const { return bbox_min.x <= bbox_max.x; }
+
+        //CPU copy of the vertices the shadow pipeline draws (vertex i of its vao is at cpu_positions[i]), for Scene::soft_picture:
+        glm::vec3 const *cpu_positions = nullptr;
+        //...or, for animated drawables, something that fills in the currently posed vertices (indexed the same way):
+        std::function< void(std::vector< glm::vec3 > *) > pose_positions;
 
         //program info:
         enum ProgramType : uint32_t {
@@ -106,11 +233,20 @@ struct Scene {
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
             GLuint LIGHT_TO_SPOT_mat4 = -1U;
-            GLuint USES_VERTEX_COLOR = -1U;
+            GLuint Material_block = -1U; //uniform block index of "Material" (if the program reads Scene::materials)
+            GLuint OBJECT_ID_uint = -1U; //uniform location for the id written to framebuffers.id_fb (set by Scene::begin_picture)
 
-			std::function< void() > set_uniforms = [&] {
+			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms (e.g., bone matrices)
 
-            }; //(optional) function to set any other useful uniforms
+			//(optional) instanced variant of 'program' -- drawables that share everything but their transform are drawn
+			// together, and the variant reads object matrices from the INSTANCES texture buffer (see Scene::InstanceGroup):
+			GLuint instanced_program = 0;
+			GLuint instanced_vao = 0; //attrib->buffer mapping for instanced_program
+			GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location (in instanced_program) for world to clip space matrix
+			GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location (in instanced_program) for world to light space matrix
+			GLuint NORMAL_WORLD_TO_LIGHT_mat3 = -1U; //uniform location (in instanced_program) for world normal to light space matrix
+			GLuint BATCHED_bool = -1U; //uniform location (in instanced_program): find instance via SLOTS, not gl_InstanceID
+			GLuint SLOTS_BASE_int = -1U; //uniform location (in instanced_program): vertex index of SLOTS[0]
 
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
@@ -160,28 +296,343 @@ struct Scene {
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
-	std::list< Drawable > drawables;
-	std::list< Camera > cameras;
-	std::list< Light > lights;
+	// (deques keep element addresses stable as objects are added, like lists did, but store them in chunks)
+	TransformStore transforms;
+	std::deque< Drawable > drawables;
+	std::deque< Camera > cameras;
+	std::deque< Light > lights;
 
     //textures
     std::unordered_map < std::string, GLuint > tex_map;
 
+    //material table (material 0 is the default material):
+    std::vector< Material > materials = { Material() };
+    //index of a material equal to 'material', adding it to the table if needed:
+    // (not thread-safe; on_drawable callbacks run concurrently, so hold drawable_load_mutex)
+    uint32_t add_material(Material const &material);
+
+    //materials are uploaded to a uniform buffer, one std140 "Material" block per slot:
+    enum : GLuint { MaterialBinding = 0 }; //uniform buffer binding point used by Material blocks
+    struct MaterialData { //std140 layout of the "Material" block
+        float roughness;
+        uint32_t uses_vertex_color;
+    };
+    GLuint materials_buffer = 0;
+    GLsizeiptr materials_stride = 0; //bytes between slots (respects GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)
+    bool materials_dirty = true; //set when 'materials' changes; buffer is re-uploaded before the next draw
+    void upload_materials();
+
+    //lights are uploaded to a uniform buffer as one std140 "Lights" block, shared by all lit programs:
+    enum : GLuint { LightsBinding = 1 }; //uniform buffer binding point of the Lights block
+    enum : uint32_t { MaxLights = SCENE_MAX_LIGHTS };
+    struct LightData { //std140 layout of the block's "Light" struct
+        glm::vec3 location = glm::vec3(0.0f);
+        int32_t type = 0; //0: point, 1: hemisphere, 2: spot, 3: directional
+        glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+        float cutoff = 1.0f; //cosine of spot cone half-angle
+        glm::vec3 energy = glm::vec3(0.0f);
+        float padding_ = 0.0f;
+    };
+    static_assert(sizeof(LightData) == 48, "LightData matches std140 layout.");
+    struct LightsHeader { //std140 layout of the block's leading members
+        glm::vec3 eye;
+        uint32_t count;
+    };
+    GLuint lights_buffer = 0;
+    //what is in the buffer, and what each scene light looked like when packed:
+    std::vector< LightData > lights_data;
+    struct LightSource {
+        uint32_t slot = -1U;
+        uint32_t world_version = 0;
+        Light::Type type = Light::Point;
+        glm::vec3 energy = glm::vec3(0.0f);
+        float spot_fov = 0.0f;
+    };
+    std::vector< LightSource > light_sources;
+    uint32_t lights_uploaded = 0; //bytes sent by the most recent upload_lights() (for profiling)
+    //fill the Lights block with 'extra' lights (e.g., sky and sun, which change every frame), then scene lights:
+    // scene lights are only repacked when they or their transforms change, and everything that changed
+    // (always including the header) goes up in a single glBufferSubData
+    void upload_lights(glm::vec3 const &eye, std::vector< LightData > const &extra);
+
+    //view volume as six planes extracted from a world-to-clip matrix (works for perspective and ortho):
+    struct Frustum {
+        explicit Frustum(glm::mat4 const &world_to_clip);
+        //dot(plane, vec4(p, 1)) >= 0 for points inside; planes are not normalized
+        // (an infinite far plane comes out as (0,0,0,+w), which never rejects anything)
+        glm::vec4 planes[6];
+        //conservative test: false only if the box is entirely outside some plane
+        bool intersects(glm::vec3 const &min, glm::vec3 const &max) const;
+        //...also reporting boxes that are entirely inside all planes (for hierarchical culling):
+        BVH::Overlap classify(glm::vec3 const &min, glm::vec3 const &max) const;
+    };
+
+    //recompute world-space bounding boxes of drawables whose transforms changed, refit the dynamic BVH,
+    // and refresh instance data (see instance_groups, below):
+    // call once per frame after transforms have been updated
+    void update_world_bounds();
+    uint32_t static_serial = 0; //bumped by update_world_bounds() whenever a static drawable's world box changes (or drawables are added)
+
+    //bounding volume hierarchies over drawable world bounds (items are indices into 'drawables'):
+    // static drawables are in one tree built by build_bvh(); dynamic drawables are in a second, refit-only tree
+    BVH static_bvh;
+    BVH dynamic_bvh;
+    std::vector< uint32_t > unbounded_drawables; //drawables without bounds (never culled)
+    bool bvh_dirty = true; //set when drawables are added or a static drawable moves; next update_world_bounds() rebuilds
+    //rebuild both trees from scratch:
+    void build_bvh();
+    uint32_t bvh_builds = 0; //times build_bvh() has run
+
+    //call fn(Drawable &) for every drawable (with render_to_screen set) whose world bounds intersect 'frustum':
+    // returns the number of drawables rejected by the frustum
+    uint32_t for_each_in_frustum(Frustum const &frustum, std::function< void(Drawable &) > const &fn);
+
+    //closest drawable (with render_to_screen set) whose world bounding box is hit by a ray, or nullptr:
+    // n.b. this tests boxes, not triangles; *distance (if given) is where the ray enters the box
+    Drawable *ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_distance = std::numeric_limits< float >::infinity(), float *distance = nullptr);
+
+    //per-pass counters from the most recent draw() of each pass type (for profiling):
+    struct PassStats {
+        uint32_t submitted = 0; //drawables sent to render_drawable
+        uint32_t culled = 0; //drawables rejected by the view frustum
+        uint32_t occluded = 0; //drawables rejected by the hi-z test (see 'hiz')
+        uint32_t proxy_queries = 0; //bounding box occlusion queries issued (see 'use_occlusion_queries')
+        uint32_t conditional = 0; //drawables hidden last frame, drawn under conditional render
+        //GL binds actually issued while submitting the sorted queue:
+        uint32_t program_binds = 0;
+        uint32_t vao_binds = 0;
+        uint32_t texture_binds = 0; //including unbinds
+        uint32_t material_changes = 0;
+        uint32_t draw_calls = 0;
+        uint32_t instanced = 0; //drawables drawn as part of an instance group
+        uint32_t batched = 0; //drawables drawn as part of a static batch
+        uint32_t baked_chunks = 0; //baked chunks drawn
+        //...and what binding everything for every draw (then unbinding textures) would have issued:
+        uint32_t unsorted_program_binds = 0;
+        uint32_t unsorted_vao_binds = 0;
+        uint32_t unsorted_texture_binds = 0;
+        uint32_t unsorted_material_changes = 0;
+    };
+    PassStats pass_stats[Drawable::PassTypes];
+
+    //GL state left behind by previous render_drawable() calls, so queued draws only bind what changed:
+    struct BoundState {
+        GLuint program = 0;
+        GLuint vao = 0;
+        uint32_t material = -1U; //material bound to MaterialBinding (-1U if unknown)
+        Drawable::Pipeline::TextureInfo textures[Drawable::Pipeline::TextureCount];
+        GLuint instances = 0; //instance texture buffer bound to InstancesTextureUnit
+        GLuint slots = 0; //slots texture buffer bound to SlotsTextureUnit
+        PassStats *stats = nullptr; //(optional) bind counts go here
+        //bind if different from what is bound:
+        void use_program(GLuint program);
+        void bind_vao(GLuint vao);
+        void bind_textures(Drawable::Pipeline::TextureInfo const (&textures)[Drawable::Pipeline::TextureCount]);
+        //unbind any textures left bound:
+        void unbind_textures();
+    };
+
+    //drawables with the same mesh, material, and (instanced-capable) programs are drawn with one instanced draw call:
+    enum : uint32_t { InstanceTexels = 6 }; //RGBA32F texels per instance: object-to-world rows, then normal-to-world rows
+    enum : GLuint { InstancesTextureUnit = 6 }; //texture unit the INSTANCES buffer is bound to
+    struct InstanceGroup {
+        std::vector< uint32_t > members; //indices into 'drawables'
+        std::vector< uint32_t > versions; //member transform world_versions the instance data was built from
+        GLuint buffer = 0; //per-instance data
+        GLuint texture = 0; //GL_TEXTURE_BUFFER view of 'buffer'
+        uint32_t queued = 0; //draw_serial of the draw() that last queued this group
+    };
+    std::vector< InstanceGroup > instance_groups;
+
+    //static drawables left over (with distinct vertex ranges) that share a material and programs form a batch,
+    // which each pass draws with one glMultiDrawArrays of its visible members:
+    // the instanced programs find a vertex's member through SLOTS, a per-vertex member index, standing in for gl_DrawID
+    enum : GLuint { SlotsTextureUnit = 7 }; //texture unit the SLOTS buffer is bound to
+    struct StaticBatch : InstanceGroup {
+        GLuint slots_buffer = 0; //member index (R32UI) for each vertex, starting at vertex slots_base
+        GLuint slots_texture = 0; //GL_TEXTURE_BUFFER view of 'slots_buffer'
+        GLint slots_base = 0;
+        //vertex ranges of the members found visible by the current draw():
+        std::vector< GLint > firsts;
+        std::vector< GLsizei > counts;
+    };
+    std::vector< StaticBatch > static_batches;
+
+    bool instance_groups_dirty = true; //set when drawables are added; next update_world_bounds() regroups
+    //regroup drawables into instance groups and batches (n.b. render_to_screen is checked here, not per frame, for these):
+    void build_instance_groups();
+    //re-upload instance data for groups and batches whose members moved:
+    void update_instance_groups();
+    //delete all groups and batches (and their buffers):
+    void clear_instance_groups();
+    //(for comparisons) draw every drawable on its own:
+    bool use_instancing = true;
+    bool use_static_batches = true;
+
+    //static scenery pre-transformed to world space, for the passes that only need positions (shadow, prepass):
+    // vertices are grouped into spatial chunks, each drawn (if its box is in view) instead of its members
+    struct BakedChunk {
+        glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+        glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+        GLint first = 0; //range in 'buffer'
+        GLsizei count = 0;
+        bool valid = true; //cleared when a member moves (its members are then drawn normally)
+    };
+    struct Baked {
+        GLuint buffer = 0; //world-space positions (vec3), chunk after chunk
+        GLuint vao = 0; //'buffer' as attribute 0
+        std::vector< BakedChunk > chunks;
+        //position-only program that draws the chunks (see BakedShadowProgram):
+        GLuint program = 0;
+        GLuint WORLD_TO_CLIP_mat4 = -1U;
+        GLuint WORLD_TO_LIGHT_mat4x3 = -1U;
+    } baked;
+    //bake static, on-screen drawables whose shadow pipeline draws GL_TRIANGLES from 'vao' without per-drawable
+    // uniforms or textures (other than 'untextured'), where vertex i of 'vao' is at positions[i]:
+    // (drawables attached to dynamic drawables are left alone)
+    void bake_static(GLuint vao, std::vector< glm::vec3 > const &positions, GLuint untextured, float chunk_size = 16.0f);
+    //delete the baked chunks (and their buffer), leaving every drawable to be drawn on its own:
+    // (the program and its uniform locations are kept, so bake_static can be called again)
+    void clear_baked();
+    //(for comparisons) draw baked drawables one by one:
+    bool use_baked = true;
+
+    //occlusion culling: the default and in-camera passes skip drawables whose bounds are entirely behind
+    // the depth pyramid (framebuffers.hiz_tex) of an earlier frame's prepass, as seen from that frame's view:
+    // the pyramid is built from static drawables only (PlayMode draws the prepass in two halves, see DrawSubset),
+    // so moving drawables neither hide anything in it nor get culled by it;
+    // it arrives a frame or more late, so it is only trusted while the view is the same and no static drawable
+    // has moved since (see hiz_current) -- a moving camera draws without hi-z culling
+    HiZ hiz; //most recent pyramid to have arrived (empty if none yet)
+    uint32_t hiz_static_serial = 0; //static_serial when the pyramid's prepass was drawn
+    bool use_hiz = true;
+    //true if 'hiz' can be tested against for a view of 'world_to_clip' this frame:
+    bool hiz_current(glm::mat4 const &world_to_clip) const;
+    //(call after framebuffers.build_hiz(), with the view the prepass used) picks up a finished read of the pyramid,
+    // then starts reading back the current one (if none is still in flight):
+    void read_hiz(glm::mat4 const &world_to_clip);
+    enum : uint32_t { HiZReadWidth = 256 }; //widest pyramid level read back to the CPU
+
+    //temporal occlusion culling (default pass only): drawables visible last frame are drawn first to fill in depth,
+    // then every separately-drawn drawable's bounding box is drawn (no color or depth writes) inside an occlusion query,
+    // and drawables hidden last frame are drawn under conditional render on their query -- the GPU skips them if
+    // their box is still hidden, without the CPU ever waiting; the newest result to have arrived (usually a couple of
+    // frames old) decides which drawables count as hidden
+    // (on by default; F4 in PlayMode switches it off for comparison)
+    bool use_occlusion_queries = true;
+    struct OcclusionSlot {
+        //ring of GL_ANY_SAMPLES_PASSED queries, so results in flight aren't dropped by reissuing them (like FrameGraph's pass timers):
+        // if every query is still pending, the drawable isn't tested that frame (and is drawn as if visible)
+        std::array< GLuint, 3 > queries{};
+        uint32_t next = 0; //index of the next query to issue
+        uint32_t pending = 0; //queries issued but not yet read back
+        bool visible = true; //most recent result to arrive
+        //query issued most recently (the one hidden drawables are conditionally drawn on):
+        GLuint latest() const { return queries[(next + queries.size() - 1) % queries.size()]; }
+    };
+    std::vector< OcclusionSlot > occlusion_slots; //(drawables refer to these by index)
+    //delete every slot's queries (drawables get new slots as they are tested again):
+    void clear_occlusion_slots();
+    //program that draws a world-space box: positions in [0,1]^3 are mapped to [BOX_MIN, BOX_MAX] (see OcclusionBoxProgram):
+    struct {
+        GLuint program = 0;
+        GLuint WORLD_TO_CLIP_mat4 = -1U;
+        GLuint BOX_MIN_vec3 = -1U;
+        GLuint BOX_MAX_vec3 = -1U;
+        GLuint buffer = 0; //unit cube, as triangles
+        GLuint vao = 0; //'buffer' as attribute 0
+    } occlusion_box;
+    //query the boxes of 'tested', then draw 'hidden' (drawables hidden last frame) conditionally:
+    void render_occlusion(std::vector< Drawable * > const &tested, std::vector< Drawable * > const &hidden, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state);
+    struct HiZReadback {
+        GLuint buffer = 0; //GL_PIXEL_PACK_BUFFER
+        GLsync fence = 0; //0 if nothing is in flight
+        glm::mat4 world_to_clip = glm::mat4(1.0f);
+        uint32_t static_serial = 0;
+        glm::uvec2 size = glm::uvec2(0);
+    } hiz_readback;
+
+    //reused by draw() to sort visible drawables by GL state and depth:
+    RenderQueue render_queue;
+    struct QueuedDraw {
+        Drawable const *drawable; //drawable to draw...
+        uint32_t instance_group; //...or, if not -1U, instance group to draw
+        uint32_t static_batch; //...or, if not -1U, static batch to draw
+    };
+    std::vector< QueuedDraw > queued_draws; //packet ids index this
+    uint32_t draw_serial = 0;
+
     //Version of draw function for different render modes:
     void draw(Camera const &camera, Drawable::PassType pass_type = Drawable::PassTypeDefault);
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
-	void draw(Drawable::PassType pass_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) ;
+	// (and maybe only the static or only the dynamic drawables -- baked chunks count as static; the second half of a
+	//  split pass adds to the first half's pass_stats)
+	enum DrawSubset : uint8_t { DrawAll, DrawStatic, DrawDynamic };
+	void draw(Drawable::PassType pass_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f), DrawSubset subset = DrawAll) ;
 
-    //render picture, return reference to buffer and also fill in results. tex_buffer should be an allocated texture buffer
+    //render picture, read it back into 'data' (RGB floats, bottom row first) and also fill in results
+    // (blocks until the GPU is done; see begin_picture() for the non-blocking version, which leaves the picture on the GPU)
     void render_picture(Camera const &camera, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector<GLfloat> &data);
 
-    //extrapolated for use in render_picture
-    void render_drawable(Drawable const &drawable, Scene::Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const;
+    //a picture whose pixels and fragment counts are still on their way back from the GPU:
+    struct PictureCapture {
+        PictureCapture() = default;
+        PictureCapture(PictureCapture const &) = delete;
+        PictureCapture &operator=(PictureCapture const &) = delete;
+        ~PictureCapture();
+
+        glm::uvec2 size = glm::uvec2(0);
+        //the tone-mapped picture, copied on the GPU (whoever takes these should zero them, or they are freed with the capture):
+        GLuint texture = 0; //GL_RGBA8, with mipmaps
+        GLuint thumbnail = 0; //GL_RGBA8, ThumbnailWidth wide (or less, for small pictures)
+        glm::uvec2 thumbnail_size = glm::uvec2(0);
+        enum : uint32_t { ThumbnailWidth = 320 };
+        GLuint ids = 0; //GL_PIXEL_PACK_BUFFER the object ID image (framebuffers.id_tex) is read into
+        std::vector< Drawable * > id_drawables; //drawable drawn with id i + 1 (id 0 is "nothing")
+        uint32_t occluded = 0; //drawables the ID pass skipped as hidden (see Scene::hiz)
+        std::vector< GLuint > focal_points; //samples-passed query for each focal point
+        GLsync fence = 0; //issued after everything above, so once it is signalled all results are in
+
+        //true if finish_picture() won't wait (never blocks):
+        bool ready() const;
+    };
+    //copy a picture into new textures and issue the readbacks for its scoring (and visibility tests of 'focal_points') without waiting for any results:
+    // the picture itself is blitted from framebuffers.picture_fb and never comes back to the CPU (see Picture::read_pixels)
+    // fragment counts come from an ID pass: each render_to_picture drawable writes its id wherever it is frontmost
+    //  (the pass draws its own depth, with the same programs that write the ids, rather than testing against the prepass)
+    // n.b. uses the current contents of framebuffers.screen_texture, both depth buffers, and framebuffers.post, so call between frames
+    void begin_picture(Camera const &camera, std::vector< Drawable * > const &focal_points, PictureCapture *capture);
+    //collect the results of begin_picture() (waits if !capture->ready()); frees the capture's GL objects, except its textures:
+    // focal_results[i] is true if focal_points[i] was visible
+    void finish_picture(PictureCapture *capture, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector< bool > *focal_results = nullptr);
+    //the same counts, from a small picture drawn on the CPU by 'raster' (see SoftRaster) -- doesn't touch GL:
+    // fragment counts are in raster pixels; drawables without cpu_positions or pose_positions are left out,
+    // and nothing is alpha tested (so cut-out leaves block more than they do on the GPU)
+    void soft_picture(Camera const &camera, std::vector< Drawable * > const &focal_points, SoftRaster *raster, std::list<std::pair<Scene::Drawable &, GLuint>> &occlusion_results, std::vector< bool > &focal_results);
 
-    //for checking focal points
-    void test_focal_points(const Scene::Camera &camera, std::vector< Scene::Drawable *> &focal_points, std::vector< bool > &results);
+    //extrapolated for use in render_picture
+    // without 'state', binds everything the drawable needs and unbinds its textures afterward
+    // with 'state', skips binds that match 'state' and leaves textures bound (call state->unbind_textures() when done)
+    void render_drawable(Drawable const &drawable, Scene::Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState *state = nullptr) const;
+    //draw every member of an instance group with the pipelines' instanced programs:
+    void render_instances(InstanceGroup const &group, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const;
+    //draw the visible members of a static batch (gathered by draw()) with one call:
+    void render_static_batch(StaticBatch const &batch, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const;
+    //(shared setup for the above; 'draws' is how many separate draws this replaces)
+    bool bind_instanced(InstanceGroup const &group, Drawable::ProgramType program_type, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state, uint32_t draws) const;
+    //point the Material block at a material (skipped if 'state' says it is already bound):
+    void bind_material(uint32_t material, BoundState *state) const;
+    //draw the baked chunks that intersect the frustum with one call:
+    void render_baked(Frustum const &frustum, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, BoundState &state) const;
+
+    //for checking focal points: each one is drawn against the main view's depth (framebuffers.ms_fb, nothing is written) inside its own samples-passed query
+    // begin_focal_points issues the whole batch in one pass without waiting on anything:
+    void begin_focal_points(const Scene::Camera &camera, std::vector< Scene::Drawable *> const &focal_points, std::vector< GLuint > *queries) const;
+    // finish_focal_points waits once for the batch, sets results[i] to whether focal_points[i] was visible, and deletes the queries:
+    void finish_focal_points(std::vector< GLuint > *queries, std::vector< bool > &results) const;
+    //both of the above, back to back:
+    void test_focal_points(const Scene::Camera &camera, std::vector< Scene::Drawable *> const &focal_points, std::vector< bool > &results);
 
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
@@ -200,7 +651,12 @@ struct Scene {
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const, GLuint tex) > const &on_drawable);
 
+	//frees the GL objects the scene made for itself (instance data, baked chunks, uniform buffers, hi-z readback,
+	// occlusion queries); the programs, vaos, and textures drawables use belong to whoever loaded them:
+	virtual ~Scene();
+
 	//copy a scene (with proper pointer fixup):
+	// GL objects the scene made for itself aren't shared; the copy makes its own as needed (and has to bake_static again)
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
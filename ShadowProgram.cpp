@@ -7,12 +7,22 @@
 
 Scene::Drawable::Pipeline shadow_program_pipeline;
 
-ShadowProgram::ShadowProgram() {
+ShadowProgram::ShadowProgram(bool instanced) {
     //note: returns world position
 	program = gl_compile_program(
 		"#version 330\n"
+		+ std::string(instanced ? "#define INSTANCED\n" : "") +
+		"#ifdef INSTANCED\n"
+		"uniform mat4 WORLD_TO_CLIP;\n"
+		"uniform mat4x3 WORLD_TO_LIGHT;\n"
+		"uniform samplerBuffer INSTANCES;\n" //see Scene::InstanceGroup for layout
+		"uniform bool BATCHED;\n" //see LitColorTextureProgram
+		"uniform int SLOTS_BASE;\n"
+		"uniform usamplerBuffer SLOTS;\n"
+		"#else\n"
 		"uniform mat4 object_to_clip;\n"
         "uniform mat4x3 object_to_light;\n"
+		"#endif\n"
 		"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
 //		"in vec3 Normal;\n" //DEBUG
         "in vec2 TexCoord;\n"
@@ -20,6 +30,13 @@ ShadowProgram::ShadowProgram() {
         "out vec2 texCoord;\n"
         "out vec4 position;\n"
 		"void main() {\n"
+		"#ifdef INSTANCED\n"
+		"	int instance = BATCHED ? int(texelFetch(SLOTS, gl_VertexID - SLOTS_BASE).r) : gl_InstanceID;\n"
+		"	int i = " + std::to_string(Scene::InstanceTexels) + " * instance;\n"
+		"	mat4x3 object_to_world = transpose(mat3x4(texelFetch(INSTANCES, i), texelFetch(INSTANCES, i+1), texelFetch(INSTANCES, i+2)));\n"
+		"	mat4 object_to_clip = WORLD_TO_CLIP * mat4(object_to_world);\n"
+		"	mat4x3 object_to_light = WORLD_TO_LIGHT * mat4(object_to_world);\n"
+		"#endif\n"
 		"	gl_Position = mat4(object_to_clip) * Position;\n"
         "   position = mat4(object_to_light) * Position;\n"
         "   texCoord = TexCoord;\n"
@@ -31,23 +48,35 @@ ShadowProgram::ShadowProgram() {
         "in vec2 texCoord;\n"
         "in vec4 position;\n"
 		"uniform sampler2D TEX;\n"
-		"out vec4 fragColor;\n"
+		"uniform uint OBJECT_ID;\n" //only written to framebuffers.id_fb (see Scene::begin_picture)
+		"layout(location=0) out vec4 fragColor;\n"
+		"layout(location=1) out uint objectId;\n"
 		"void main() {\n"
         "   vec4 albedo = texture(TEX, texCoord);\n"
         "   if(albedo.a < 0.5) {\n"
         "       discard;\n"
         "   }\n"
 		"	fragColor = position;\n"
+		"	objectId = OBJECT_ID;\n"
 		"}\n"
 	);
 
     OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "object_to_clip");
     OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "object_to_light");
+    OBJECT_ID_uint = glGetUniformLocation(program, "OBJECT_ID");
+    WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+    WORLD_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "WORLD_TO_LIGHT");
+    BATCHED_bool = glGetUniformLocation(program, "BATCHED");
+    SLOTS_BASE_int = glGetUniformLocation(program, "SLOTS_BASE");
     GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+    GLuint INSTANCES_samplerBuffer = glGetUniformLocation(program, "INSTANCES");
+    GLuint SLOTS_usamplerBuffer = glGetUniformLocation(program, "SLOTS");
 
 
     glUseProgram(program); //bind program
     glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+    if (INSTANCES_samplerBuffer != -1U) glUniform1i(INSTANCES_samplerBuffer, Scene::InstancesTextureUnit);
+    if (SLOTS_usamplerBuffer != -1U) glUniform1i(SLOTS_usamplerBuffer, Scene::SlotsTextureUnit);
 
     glUseProgram(0); //unbind program
 }
@@ -56,6 +85,7 @@ Load< ShadowProgram > shadow_program(LoadTagEarly, [](){
 	ShadowProgram *ret = new ShadowProgram();
     shadow_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
     shadow_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+    shadow_program_pipeline.OBJECT_ID_uint = ret->OBJECT_ID_uint;
     shadow_program_pipeline.program = ret->program;
 
     //make a 1-pixel white texture to bind by default:
@@ -80,6 +110,75 @@ Load< ShadowProgram > shadow_program(LoadTagEarly, [](){
     return ret;
 });
 
+Load< ShadowProgram > instanced_shadow_program(LoadTagEarly, [](){
+	ShadowProgram *ret = new ShadowProgram(true);
+    shadow_program_pipeline.instanced_program = ret->program;
+    shadow_program_pipeline.WORLD_TO_CLIP_mat4 = ret->WORLD_TO_CLIP_mat4;
+    shadow_program_pipeline.WORLD_TO_LIGHT_mat4x3 = ret->WORLD_TO_LIGHT_mat4x3;
+    shadow_program_pipeline.BATCHED_bool = ret->BATCHED_bool;
+    shadow_program_pipeline.SLOTS_BASE_int = ret->SLOTS_BASE_int;
+    return ret;
+});
+
+//Shadow program for static scenery baked into world space (see Scene::bake_static):
+BakedShadowProgram::BakedShadowProgram() {
+    //no texture coordinates, so no alpha test -- only untextured drawables are baked
+    program = gl_compile_program(
+        "#version 330\n"
+        "uniform mat4 WORLD_TO_CLIP;\n"
+        "uniform mat4x3 WORLD_TO_LIGHT;\n"
+        "layout(location=0) in vec4 Position;\n" //(Scene::Baked::vao binds positions to location 0)
+        "out vec4 position;\n"
+        "void main() {\n"
+        "	gl_Position = WORLD_TO_CLIP * Position;\n"
+        "	position = mat4(WORLD_TO_LIGHT) * Position;\n"
+        "}\n"
+        ,
+        "#version 330\n"
+        "in vec4 position;\n"
+        "out vec4 fragColor;\n"
+        "void main() {\n"
+        "	fragColor = position;\n"
+        "}\n"
+    );
+
+    WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+    WORLD_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "WORLD_TO_LIGHT");
+}
+
+Load< BakedShadowProgram > baked_shadow_program(LoadTagEarly, [](){
+    return new BakedShadowProgram();
+});
+
+//Bounding boxes for occlusion queries (see Scene::render_occlusion):
+OcclusionBoxProgram::OcclusionBoxProgram() {
+    //writes nothing -- only whether any samples pass matters
+    program = gl_compile_program(
+        "#version 330\n"
+        "uniform mat4 WORLD_TO_CLIP;\n"
+        "uniform vec3 BOX_MIN;\n"
+        "uniform vec3 BOX_MAX;\n"
+        "layout(location=0) in vec3 Position;\n" //unit cube corner
+        "void main() {\n"
+        "	gl_Position = WORLD_TO_CLIP * vec4(mix(BOX_MIN, BOX_MAX, Position), 1.0);\n"
+        "}\n"
+        ,
+        "#version 330\n"
+        "out vec4 fragColor;\n"
+        "void main() {\n"
+        "	fragColor = vec4(1.0);\n"
+        "}\n"
+    );
+
+    WORLD_TO_CLIP_mat4 = glGetUniformLocation(program, "WORLD_TO_CLIP");
+    BOX_MIN_vec3 = glGetUniformLocation(program, "BOX_MIN");
+    BOX_MAX_vec3 = glGetUniformLocation(program, "BOX_MAX");
+}
+
+Load< OcclusionBoxProgram > occlusion_box_program(LoadTagEarly, [](){
+    return new OcclusionBoxProgram();
+});
+
 //Shadow program for creatures
 Scene::Drawable::Pipeline bone_shadow_program_pipeline;
 
@@ -116,13 +215,16 @@ BoneShadowProgram::BoneShadowProgram() {
             "in vec2 texCoord;\n"
             "in vec4 position;\n"
             "uniform sampler2D TEX;\n"
-            "out vec4 fragColor;\n"
+            "uniform uint OBJECT_ID;\n" //see ShadowProgram
+            "layout(location=0) out vec4 fragColor;\n"
+            "layout(location=1) out uint objectId;\n"
             "void main() {\n"
             "   vec4 albedo = texture(TEX, texCoord);\n"
             "   if(albedo.a < 0.5) {\n"
             "       discard;\n"
             "   }\n"
             "	fragColor = position;\n"
+            "	objectId = OBJECT_ID;\n"
             "}\n"
     );
 
@@ -133,6 +235,7 @@ BoneShadowProgram::BoneShadowProgram() {
 
     OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "object_to_clip");
     OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "object_to_light");
+    OBJECT_ID_uint = glGetUniformLocation(program, "OBJECT_ID");
     GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
 
@@ -146,6 +249,7 @@ Load< BoneShadowProgram > bone_shadow_program(LoadTagEarly, [](){
     BoneShadowProgram *ret = new BoneShadowProgram();
     bone_shadow_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
     bone_shadow_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+    bone_shadow_program_pipeline.OBJECT_ID_uint = ret->OBJECT_ID_uint;
     bone_shadow_program_pipeline.program = ret->program;
 
     //make a 1-pixel white texture to bind by default:
@@ -10,17 +10,50 @@ struct ShadowProgram {
 	//uniform locations:
 	GLuint OBJECT_TO_CLIP_mat4 = -1U;
     GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
+    GLuint OBJECT_ID_uint = -1U;
+    //(instanced variant only)
+    GLuint WORLD_TO_CLIP_mat4 = -1U;
+    GLuint WORLD_TO_LIGHT_mat4x3 = -1U;
+    GLuint BATCHED_bool = -1U;
+    GLuint SLOTS_BASE_int = -1U;
 
     //textures
     //0 - object texture
 
-	ShadowProgram();
+	//instanced variant reads object matrices from INSTANCES instead of object_to_* uniforms:
+	ShadowProgram(bool instanced = false);
 };
 
 extern Load< ShadowProgram > shadow_program;
+extern Load< ShadowProgram > instanced_shadow_program;
 
 extern Scene::Drawable::Pipeline shadow_program_pipeline;
 
+//position-only shadow program for Scene::baked chunks (vertices already in world space):
+struct BakedShadowProgram {
+    GLuint program = 0;
+
+    GLuint WORLD_TO_CLIP_mat4 = -1U;
+    GLuint WORLD_TO_LIGHT_mat4x3 = -1U;
+
+    BakedShadowProgram();
+};
+
+extern Load< BakedShadowProgram > baked_shadow_program;
+
+//draws a drawable's world-space bounding box for Scene's occlusion queries (positions are a unit cube):
+struct OcclusionBoxProgram {
+    GLuint program = 0;
+
+    GLuint WORLD_TO_CLIP_mat4 = -1U;
+    GLuint BOX_MIN_vec3 = -1U;
+    GLuint BOX_MAX_vec3 = -1U;
+
+    OcclusionBoxProgram();
+};
+
+extern Load< OcclusionBoxProgram > occlusion_box_program;
+
 struct BoneShadowProgram {
     //opengl program object:
     GLuint program = 0;
@@ -32,6 +65,7 @@ struct BoneShadowProgram {
     //uniform locations:
     GLuint OBJECT_TO_CLIP_mat4 = -1U;
     GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
+    GLuint OBJECT_ID_uint = -1U;
 
     GLuint BONES_mat4x3_array = -1U;
 
@@ -0,0 +1,227 @@
+#include "SoftRaster.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cassert>
+
+//run fn(0) ... fn(count - 1), each on its own thread (fn(0) on the calling thread):
+template< typename F >
+static void run_parallel(uint32_t count, F const &fn) {
+	std::vector< std::thread > workers;
+	workers.reserve(count > 0 ? count - 1 : 0);
+	for (uint32_t i = 1; i < count; ++i) {
+		workers.emplace_back([&fn, i](){ fn(i); });
+	}
+	if (count > 0) fn(0);
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+static uint32_t thread_count(uint32_t threads) {
+	return threads == 0 ? std::max(1U, std::thread::hardware_concurrency()) : threads;
+}
+
+//window-space triangle from clip-space corners (all with w > 0); false if it covers no pixel centers:
+static bool make_triangle(glm::vec4 const &a, glm::vec4 const &b, glm::vec4 const &c, glm::uvec2 size, uint32_t mesh, SoftRaster::Triangle *tri) {
+	glm::vec4 const *clip[3] = {&a, &b, &c};
+	for (uint32_t i = 0; i < 3; ++i) {
+		glm::vec4 const &p = *clip[i];
+		if (!(p.w > 0.0f)) return false;
+		tri->v[i] = glm::vec2(
+			(p.x / p.w * 0.5f + 0.5f) * float(size.x),
+			(p.y / p.w * 0.5f + 0.5f) * float(size.y)
+		);
+		tri->z[i] = p.z / p.w * 0.5f + 0.5f;
+	}
+
+	//make it counter-clockwise (both windings are drawn):
+	float area = (tri->v[1].x - tri->v[0].x) * (tri->v[2].y - tri->v[0].y) - (tri->v[1].y - tri->v[0].y) * (tri->v[2].x - tri->v[0].x);
+	if (!(area != 0.0f)) return false; //(also catches NaN)
+	if (area < 0.0f) {
+		std::swap(tri->v[1], tri->v[2]);
+		std::swap(tri->z[1], tri->z[2]);
+	}
+
+	//pixels whose centers are inside the bounds:
+	glm::vec2 lo = glm::min(tri->v[0], glm::min(tri->v[1], tri->v[2]));
+	glm::vec2 hi = glm::max(tri->v[0], glm::max(tri->v[1], tri->v[2]));
+	lo = glm::clamp(glm::ceil(lo - 0.5f), glm::vec2(0.0f), glm::vec2(size) - 1.0f);
+	hi = glm::clamp(glm::floor(hi - 0.5f), glm::vec2(-1.0f), glm::vec2(size) - 1.0f);
+	tri->min = glm::ivec2(lo);
+	tri->max = glm::ivec2(hi);
+	if (tri->min.x > tri->max.x || tri->min.y > tri->max.y) return false;
+
+	tri->mesh = mesh;
+	return true;
+}
+
+//clip one triangle against the view and append what's left:
+static void clip_triangle(glm::vec4 const (&c)[3], glm::uvec2 size, uint32_t mesh, std::vector< SoftRaster::Triangle > *out) {
+	//entirely outside one of the side or far planes:
+	for (uint32_t axis = 0; axis < 3; ++axis) {
+		if (c[0][axis] > c[0].w && c[1][axis] > c[1].w && c[2][axis] > c[2].w) return;
+		if (axis < 2 && c[0][axis] < -c[0].w && c[1][axis] < -c[1].w && c[2][axis] < -c[2].w) return;
+	}
+
+	SoftRaster::Triangle tri;
+	float d[3] = { c[0].z + c[0].w, c[1].z + c[1].w, c[2].z + c[2].w }; //>= 0 in front of the near plane
+	if (d[0] >= 0.0f && d[1] >= 0.0f && d[2] >= 0.0f) {
+		if (make_triangle(c[0], c[1], c[2], size, mesh, &tri)) out->emplace_back(tri);
+		return;
+	}
+	if (d[0] < 0.0f && d[1] < 0.0f && d[2] < 0.0f) return;
+
+	//crosses the near plane, so keep the part in front (at most a quad):
+	glm::vec4 poly[4];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < 3; ++i) {
+		uint32_t j = (i + 1) % 3;
+		if (d[i] >= 0.0f) poly[n++] = c[i];
+		if ((d[i] >= 0.0f) != (d[j] >= 0.0f)) {
+			poly[n++] = glm::mix(c[i], c[j], d[i] / (d[i] - d[j]));
+		}
+	}
+	for (uint32_t i = 2; i < n; ++i) {
+		if (make_triangle(poly[0], poly[i - 1], poly[i], size, mesh, &tri)) out->emplace_back(tri);
+	}
+}
+
+void SoftRaster::setup(std::vector< Mesh > const &meshes, uint32_t threads, std::vector< Triangle > *triangles) const {
+	//meshes[m] has triangles [first[m], first[m + 1]):
+	std::vector< size_t > first(meshes.size() + 1, 0);
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		first[m + 1] = first[m] + meshes[m].count / 3;
+	}
+	size_t total = first.back();
+
+	//contiguous ranges of triangles per thread, concatenated in order afterward so the result is the same for any count:
+	uint32_t parts = uint32_t(std::max< size_t >(1, std::min< size_t >(thread_count(threads), total / MinTriangles)));
+	std::vector< std::vector< Triangle > > part_triangles(parts);
+	run_parallel(parts, [&](uint32_t part) {
+		size_t begin = total * part / parts;
+		size_t end = total * (part + 1) / parts;
+		std::vector< Triangle > &out = part_triangles[part];
+		out.reserve(end - begin);
+		size_t m = std::upper_bound(first.begin(), first.end(), begin) - first.begin() - 1;
+		for (size_t t = begin; t < end; ++t) {
+			while (t >= first[m + 1]) ++m;
+			Mesh const &mesh = meshes[m];
+			glm::vec3 const *p = mesh.positions + 3 * (t - first[m]);
+			glm::vec4 const c[3] = {
+				mesh.object_to_clip * glm::vec4(p[0], 1.0f),
+				mesh.object_to_clip * glm::vec4(p[1], 1.0f),
+				mesh.object_to_clip * glm::vec4(p[2], 1.0f),
+			};
+			clip_triangle(c, size, uint32_t(m), &out);
+		}
+	});
+
+	triangles->clear();
+	for (auto const &part : part_triangles) {
+		triangles->insert(triangles->end(), part.begin(), part.end());
+	}
+}
+
+//call fn(pixel index, depth) for each pixel center of rows [y0, y1] the triangle covers; stops early if fn returns false:
+// (edges are evaluated directly at each pixel, so rows come out the same however the image is split)
+template< typename F >
+static void for_each_fragment(SoftRaster::Triangle const &tri, int32_t y0, int32_t y1, uint32_t width, F const &fn) {
+	y0 = std::max(y0, tri.min.y);
+	y1 = std::min(y1, tri.max.y);
+	if (y0 > y1) return;
+
+	//edge i is across from corner i; positive inside, with ties going to top and left edges:
+	float A[3], B[3], C[3];
+	bool top_left[3];
+	for (uint32_t i = 0; i < 3; ++i) {
+		glm::vec2 const &a = tri.v[(i + 1) % 3];
+		glm::vec2 const &b = tri.v[(i + 2) % 3];
+		A[i] = a.y - b.y;
+		B[i] = b.x - a.x;
+		C[i] = -(A[i] * a.x + B[i] * a.y);
+		top_left[i] = (b.y < a.y) || (b.y == a.y && b.x < a.x);
+	}
+	//window depth is linear in screen space:
+	float area = C[0] + C[1] + C[2];
+	float zA = (A[0] * tri.z[0] + A[1] * tri.z[1] + A[2] * tri.z[2]) / area;
+	float zB = (B[0] * tri.z[0] + B[1] * tri.z[1] + B[2] * tri.z[2]) / area;
+	float zC = (C[0] * tri.z[0] + C[1] * tri.z[1] + C[2] * tri.z[2]) / area;
+
+	for (int32_t y = y0; y <= y1; ++y) {
+		float py = float(y) + 0.5f;
+		float r0 = B[0] * py + C[0], r1 = B[1] * py + C[1], r2 = B[2] * py + C[2];
+		float rz = zB * py + zC;
+		uint32_t row = uint32_t(y) * width;
+		for (int32_t x = tri.min.x; x <= tri.max.x; ++x) {
+			float px = float(x) + 0.5f;
+			float w0 = A[0] * px + r0, w1 = A[1] * px + r1, w2 = A[2] * px + r2;
+			bool inside = (w0 > 0.0f || (w0 == 0.0f && top_left[0]))
+			           & (w1 > 0.0f || (w1 == 0.0f && top_left[1]))
+			           & (w2 > 0.0f || (w2 == 0.0f && top_left[2]));
+			if (inside && !fn(row + uint32_t(x), zA * px + rz)) return;
+		}
+	}
+}
+
+//how many bands of rows to split an image of height rows into (one per thread):
+static uint32_t band_count(uint32_t threads, uint32_t height) {
+	return std::max(1U, std::min(thread_count(threads), height));
+}
+
+void SoftRaster::render(std::vector< Mesh > const &meshes, uint32_t threads) {
+	size_t pixels = size_t(size.x) * size.y;
+	depth.assign(pixels, 1.0f);
+	ids.assign(pixels, 0);
+
+	std::vector< Triangle > triangles;
+	setup(meshes, threads, &triangles);
+
+	uint32_t bands = band_count(threads, size.y);
+	run_parallel(bands, [&](uint32_t band) {
+		int32_t y0 = int32_t(size.y * band / bands);
+		int32_t y1 = int32_t(size.y * (band + 1) / bands) - 1;
+		for (Triangle const &tri : triangles) {
+			uint32_t id = meshes[tri.mesh].id;
+			for_each_fragment(tri, y0, y1, size.x, [&](uint32_t i, float z) {
+				if (z < depth[i]) {
+					depth[i] = z;
+					ids[i] = id;
+				}
+				return true;
+			});
+		}
+	});
+}
+
+void SoftRaster::test(std::vector< Mesh > const &meshes, std::vector< bool > *visible, uint32_t threads) const {
+	assert(depth.size() == size_t(size.x) * size.y && "call render() first");
+	std::vector< Triangle > triangles;
+	setup(meshes, threads, &triangles);
+
+	uint32_t bands = band_count(threads, size.y);
+	std::vector< std::vector< uint8_t > > band_visible(bands, std::vector< uint8_t >(meshes.size(), 0));
+	run_parallel(bands, [&](uint32_t band) {
+		int32_t y0 = int32_t(size.y * band / bands);
+		int32_t y1 = int32_t(size.y * (band + 1) / bands) - 1;
+		std::vector< uint8_t > &seen = band_visible[band];
+		for (Triangle const &tri : triangles) {
+			if (seen[tri.mesh]) continue;
+			for_each_fragment(tri, y0, y1, size.x, [&](uint32_t i, float z) {
+				if (z <= depth[i]) {
+					seen[tri.mesh] = 1;
+					return false;
+				}
+				return true;
+			});
+		}
+	});
+
+	visible->assign(meshes.size(), false);
+	for (auto const &seen : band_visible) {
+		for (size_t m = 0; m < meshes.size(); ++m) {
+			if (seen[m]) (*visible)[m] = true;
+		}
+	}
+}
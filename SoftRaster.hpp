@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * "SoftRaster" draws triangle lists into a small depth + object-ID image on the CPU,
+ *  so a picture's subjects can be counted without waiting on the GPU.
+ *
+ * Triangles are transformed and clipped against the near plane in parallel, then the image
+ *  is split into bands of rows, each rasterized by its own thread (pixel centers, top-left
+ *  fill rule, both windings drawn, depth test LESS -- like the GPU ID pass without alpha).
+ * Results don't depend on the thread count.
+ *
+ * Doesn't touch GL (see 'tests/aperture-tests soft_raster', and 'aperture --benchmark soft_raster' for the game's scene).
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct SoftRaster {
+	//image size; a picture's aspect is kept by the caller's projection:
+	glm::uvec2 size = glm::uvec2(320, 180);
+
+	//row-major, bottom row first (like glReadPixels):
+	std::vector< float > depth; //window-space depth ([0,1], 1 is far)
+	std::vector< uint32_t > ids; //id of the frontmost mesh (0 where nothing was drawn)
+
+	struct Mesh {
+		glm::mat4 object_to_clip = glm::mat4(1.0f);
+		glm::vec3 const *positions = nullptr; //GL_TRIANGLES order
+		uint32_t count = 0; //vertices (a multiple of three)
+		uint32_t id = 0;
+	};
+
+	//clear the image and draw 'meshes' into it (threads == 0 means one per hardware thread):
+	void render(std::vector< Mesh > const &meshes, uint32_t threads = 0);
+
+	//(*visible)[i] is true if any fragment of meshes[i] passes a LEQUAL test against 'depth'; nothing is written:
+	void test(std::vector< Mesh > const &meshes, std::vector< bool > *visible, uint32_t threads = 0) const;
+
+	//fewest triangles worth handing to another thread during setup:
+	enum : size_t { MinTriangles = 2048 };
+
+	//-- internals ---
+	struct Triangle {
+		glm::vec2 v[3]; //window-space, counter-clockwise
+		glm::vec3 z; //window-space depth at each corner
+		glm::ivec2 min, max; //pixel bounds (inclusive), already clamped to the image
+		uint32_t mesh; //index into the 'meshes' being drawn
+	};
+	//transform and clip 'meshes' into screen triangles (in mesh order):
+	void setup(std::vector< Mesh > const &meshes, uint32_t threads, std::vector< Triangle > *triangles) const;
+};
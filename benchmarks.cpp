@@ -0,0 +1,899 @@
+#include "benchmarks.hpp"
+#include "checks.hpp"
+
+#include "Scene.hpp"
+#include "SoftRaster.hpp"
+#include "Picture.hpp"
+#include "PlayMode.hpp"
+#include "GameObjects.hpp"
+#include "Framebuffers.hpp"
+#include "DepthReconstruct.hpp"
+#include "DynamicResolution.hpp"
+#include "ShadowProgram.hpp"
+#include "GL.hpp"
+#include "gl_errors.hpp"
+#include "gl_compile_program.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//helper: the game scene's 'player_camera' (most benchmarks draw from it), or nullptr (after saying so) if there isn't one:
+static Scene::Camera *find_player_camera(Scene &scene, char const *benchmark) {
+	for (auto &c : scene.cameras) {
+		if (c.transform->name == "player_camera") return &c;
+	}
+	std::cerr << benchmark << ": scene has no 'player_camera'" << std::endl;
+	return nullptr;
+}
+
+//GL calls per frame drawing the game's scene (shadow + main pass) with each combination of
+// instancing and static batching, plus CPU time to submit a frame (n.b. needs the GL context main() creates):
+static bool benchmark_draw_calls() {
+	constexpr uint32_t Iterations = 100;
+
+	Scene scene(*main_scene);
+	Scene::Camera *camera = find_player_camera(scene, "draw_calls");
+	if (!camera) return false;
+	camera->aspect = 16.0f / 9.0f;
+	scene.update_world_bounds();
+
+	glm::mat4 world_to_clip = camera->make_projection() * glm::mat4(camera->transform->make_world_to_local());
+
+	struct Config {
+		char const *name;
+		bool instancing, batches, queries;
+	};
+	static Config const configs[] = {
+		{"one draw per drawable", false, false, false},
+		{"instancing", true, false, false},
+		{"static batches", false, true, false},
+		{"instancing + static batches", true, true, false},
+		{"instancing + static batches + occlusion queries", true, true, true},
+	};
+	scene.occlusion_box.program = occlusion_box_program->program;
+	scene.occlusion_box.WORLD_TO_CLIP_mat4 = occlusion_box_program->WORLD_TO_CLIP_mat4;
+	scene.occlusion_box.BOX_MIN_vec3 = occlusion_box_program->BOX_MIN_vec3;
+	scene.occlusion_box.BOX_MAX_vec3 = occlusion_box_program->BOX_MAX_vec3;
+
+	std::cout << "draw_calls: " << scene.drawables.size() << " drawables, "
+	          << scene.instance_groups.size() << " instance groups, " << scene.static_batches.size() << " static batches" << std::endl;
+	for (auto const &config : configs) {
+		scene.use_instancing = config.instancing;
+		scene.use_static_batches = config.batches;
+		scene.use_occlusion_queries = config.queries;
+
+		double ms = time_ms(Iterations, [&](){
+			scene.draw(Scene::Drawable::PassTypeShadow, world_to_clip);
+			scene.draw(Scene::Drawable::PassTypeDefault, world_to_clip);
+			glFinish();
+		});
+
+		uint32_t draws = 0, binds = 0;
+		for (auto pass : {Scene::Drawable::PassTypeShadow, Scene::Drawable::PassTypeDefault}) {
+			Scene::PassStats const &stats = scene.pass_stats[pass];
+			draws += stats.draw_calls;
+			binds += stats.program_binds + stats.vao_binds + stats.texture_binds + stats.material_changes;
+		}
+		std::cout << "  " << config.name << ": " << draws << " draw calls, " << binds << " binds, " << ms << " ms/frame" << std::endl;
+		if (config.queries) {
+			Scene::PassStats const &stats = scene.pass_stats[Scene::Drawable::PassTypeDefault];
+			std::cout << "    (" << stats.proxy_queries << " box queries, " << stats.conditional << " drawn conditionally)" << std::endl;
+		}
+	}
+	GL_ERRORS();
+	return true;
+}
+
+//Lights block upload cost against light count, for a static scene vs. every light moving every frame
+// (sky and sun are repacked each frame in both cases, like PlayMode::draw does):
+static bool benchmark_lights() {
+	constexpr uint32_t Iterations = 1000;
+	uint32_t const Counts[] = {8, 40, Scene::MaxLights - 2};
+
+	std::cout << "lights: MaxLights " << Scene::MaxLights << ", " << sizeof(Scene::LightData) << " bytes/light" << std::endl;
+	for (uint32_t count : Counts) {
+		Scene scene;
+		for (uint32_t i = 0; i < count; ++i) {
+			scene.transforms.emplace_back();
+			Scene::Transform *t = &scene.transforms.back();
+			t->position = glm::vec3(float(i % 7), float(i % 11), 2.0f);
+			scene.lights.emplace_back(t);
+			scene.lights.back().type = (i % 2 ? Scene::Light::Spot : Scene::Light::Point);
+		}
+		std::vector< Scene::LightData > sky_lights(2);
+		glm::vec3 eye = glm::vec3(0.0f);
+
+		uint64_t bytes = 0;
+		uint32_t frame = 0;
+		auto run = [&](bool moving) {
+			bytes = 0;
+			double ms = time_ms(Iterations, [&](){
+				frame += 1;
+				if (moving) {
+					for (auto &light : scene.lights) light.transform->position.z = 2.0f + 0.001f * float(frame % 2);
+				}
+				sky_lights[1].energy = glm::vec3(float(frame % 100) * 0.01f);
+				scene.upload_lights(eye, sky_lights);
+				bytes += scene.lights_uploaded;
+			});
+			glFinish();
+			return ms;
+		};
+		scene.upload_lights(eye, sky_lights); //(first upload packs everything)
+		double still = run(false);
+		uint64_t still_bytes = bytes / Iterations;
+		double moving = run(true);
+		uint64_t moving_bytes = bytes / Iterations;
+
+		std::cout << "  " << count << " scene lights: static " << still << " ms (" << still_bytes << " bytes/frame), "
+		          << "all moving " << moving << " ms (" << moving_bytes << " bytes/frame)" << std::endl;
+	}
+	GL_ERRORS();
+	return true;
+}
+
+//the serial focal point test Scene::test_focal_points used to do (one query per point, waiting on each before issuing the next),
+// kept as a reference for benchmark_focal_points:
+static void test_focal_points_serial(Scene &scene, Scene::Camera const &camera, std::vector< Scene::Drawable * > const &focal_points, std::vector< bool > &results) {
+	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
+
+	results.resize(focal_points.size());
+	scene.upload_materials();
+
+	GLuint query = 0;
+	glGenQueries(1, &query);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.ms_fb);
+	glDepthMask(GL_FALSE);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	for (size_t i = 0; i < focal_points.size(); i++) {
+		auto &drawable = focal_points.at(i);
+		glBeginQuery(GL_SAMPLES_PASSED, query);
+		scene.render_drawable(*drawable, Scene::Drawable::ProgramTypeShadow, world_to_clip, world_to_light);
+		glEndQuery(GL_SAMPLES_PASSED);
+		GLuint passed = 0;
+		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &passed);
+		results.at(i) = passed;
+	}
+	glDeleteQueries(1, &query);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glUseProgram(0);
+	glBindVertexArray(0);
+	GL_ERRORS();
+}
+
+//focal point visibility: serial (wait per point) vs. batched (one wait) testing of every drawable in the game's scene
+// against the player camera's view, checking that both give the same answer for every point:
+static bool benchmark_focal_points() {
+	constexpr uint32_t Iterations = 20;
+	bool ok = true;
+
+	Scene scene(*main_scene);
+	Scene::Camera *camera = find_player_camera(scene, "focal_points");
+	if (!camera) return false;
+	camera->aspect = 16.0f / 9.0f;
+	scene.update_world_bounds();
+
+	//depth for the points to be tested against:
+	glm::uvec2 size = glm::uvec2(1280, 720);
+	framebuffers.realloc(size, glm::uvec2(1024, 1024));
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers.ms_fb);
+	glViewport(0, 0, size.x, size.y);
+	glClearDepth(1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+	scene.draw(Scene::Drawable::PassTypeShadow, camera->make_projection() * glm::mat4(camera->transform->make_world_to_local()));
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	std::vector< Scene::Drawable * > focal_points;
+	for (auto &drawable : scene.drawables) {
+		focal_points.emplace_back(&drawable);
+	}
+
+	std::vector< bool > serial_results, batched_results;
+	double serial = time_ms(Iterations, [&](){
+		test_focal_points_serial(scene, *camera, focal_points, serial_results);
+	});
+	double batched = time_ms(Iterations, [&](){
+		scene.test_focal_points(*camera, focal_points, batched_results);
+	});
+
+	uint32_t visible = 0, mismatches = 0;
+	for (size_t i = 0; i < focal_points.size(); ++i) {
+		if (serial_results[i]) visible += 1;
+		if (serial_results[i] != batched_results[i]) {
+			mismatches += 1;
+			std::cout << "  mismatch: '" << focal_points[i]->transform->name << "' serial " << serial_results[i] << ", batched " << batched_results[i] << std::endl;
+		}
+	}
+
+	std::cout << "focal_points: " << focal_points.size() << " points (" << visible << " visible)" << std::endl;
+	std::cout << "  serial " << serial << " ms, batched " << batched << " ms" << std::endl;
+	std::cout << "  mismatches vs serial: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	GL_ERRORS();
+	return ok;
+}
+
+//CPU picture counting (SoftRaster) of the main scene from the player camera:
+// every on-screen drawable with CPU vertices is drawn (each with its own id) on one thread and on every hardware
+// thread, at a few sizes; the two ID images must be identical. Also times the whole Scene::soft_picture path.
+static bool benchmark_soft_raster() {
+	constexpr uint32_t Iterations = 20;
+	bool ok = true;
+
+	Scene scene(*main_scene);
+	Scene::Camera *camera = find_player_camera(scene, "soft_raster");
+	if (!camera) return false;
+	camera->aspect = 16.0f / 9.0f;
+	scene.update_world_bounds();
+
+	glm::mat4 world_to_clip = camera->make_projection() * glm::mat4(camera->transform->make_world_to_local());
+	std::vector< SoftRaster::Mesh > meshes;
+	uint32_t triangles = 0;
+	for (auto &drawable : scene.drawables) {
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline[Scene::Drawable::ProgramTypeShadow];
+		if (!drawable.render_to_screen || !drawable.cpu_positions || pipeline.type != GL_TRIANGLES) continue;
+		SoftRaster::Mesh mesh;
+		mesh.object_to_clip = world_to_clip * glm::mat4(drawable.transform->make_local_to_world());
+		mesh.positions = drawable.cpu_positions + pipeline.start;
+		mesh.count = pipeline.count;
+		mesh.id = uint32_t(meshes.size() + 1);
+		meshes.emplace_back(mesh);
+		triangles += pipeline.count / 3;
+	}
+	std::cout << "soft_raster: " << meshes.size() << " meshes, " << triangles << " triangles (no culling)" << std::endl;
+
+	uint32_t mismatches = 0;
+	for (glm::uvec2 size : {glm::uvec2(160, 90), glm::uvec2(320, 180), glm::uvec2(640, 360)}) {
+		SoftRaster single, threaded;
+		single.size = threaded.size = size;
+		double one_thread = time_ms(Iterations, [&](){
+			single.render(meshes, 1);
+		});
+		double all_threads = time_ms(Iterations, [&](){
+			threaded.render(meshes);
+		});
+		if (single.ids != threaded.ids) mismatches += 1;
+
+		uint32_t covered = 0;
+		for (uint32_t id : single.ids) {
+			if (id != 0) covered += 1;
+		}
+		std::cout << "  " << size.x << "x" << size.y << ": one thread " << one_thread << " ms, "
+		          << std::max(1U, std::thread::hardware_concurrency()) << " threads " << all_threads << " ms ("
+		          << (100.0f * covered / float(single.ids.size())) << "% covered)" << std::endl;
+	}
+
+	//the whole picture path, with frustum culling and focal points:
+	std::vector< Scene::Drawable * > focal_points;
+	for (auto &drawable : scene.drawables) {
+		if (!drawable.render_to_screen) focal_points.emplace_back(&drawable);
+	}
+	SoftRaster raster;
+	std::list< std::pair< Scene::Drawable &, GLuint > > frag_counts;
+	std::vector< bool > focal_results;
+	double picture = time_ms(Iterations, [&](){
+		frag_counts.clear();
+		scene.soft_picture(*camera, focal_points, &raster, frag_counts, focal_results);
+	});
+	std::cout << "  soft_picture " << picture << " ms (" << frag_counts.size() << " drawables in picture, "
+	          << std::count(focal_results.begin(), focal_results.end(), true) << " / " << focal_points.size() << " focal points visible)" << std::endl;
+	std::cout << "  thread count mismatches: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	return ok;
+}
+
+//memory held by retained photos, for a session of 100 pictures at 1920x1080 captured from the main scene:
+// the old layout kept the float readback (RGB32F) plus a GL_RGB texture with mipmaps (taken as 4 bytes/texel, as drivers pad it);
+// pictures are now copied into GPU textures (RGBA8 with mipmaps, plus a thumbnail) and only the thumbnail stays once reviewed
+static bool benchmark_photo_memory() {
+	constexpr uint32_t Photos = 100;
+
+	Scene scene(*main_scene);
+	Scene::Camera *camera = find_player_camera(scene, "photo_memory");
+	if (!camera) return false;
+	glm::uvec2 size = glm::uvec2(1920, 1080);
+	camera->aspect = float(size.x) / float(size.y);
+	scene.update_world_bounds();
+	framebuffers.realloc(size, glm::uvec2(1024, 1024));
+	size_t texels = size_t(size.x) * size.y;
+
+	std::vector< std::shared_ptr< Picture > > pictures;
+	glm::vec3 player_position = glm::vec3(0.0f);
+	double capture = time_ms(Photos, [&](){
+		Scene::PictureCapture capture;
+		PictureInfo stats;
+		stats.dimensions = size;
+		stats.focal_distance = 1.0f;
+		stats.total_frag_count = 0;
+		scene.begin_picture(*camera, {}, &capture);
+		scene.finish_picture(&capture, stats.frag_counts);
+		stats.frag_counts.clear(); //(scored as an empty picture, so no creatures are needed)
+		stats.texture = std::exchange(capture.texture, 0);
+		stats.thumbnail_tex = std::exchange(capture.thumbnail, 0);
+		stats.thumbnail_size = capture.thumbnail_size;
+		pictures.emplace_back(std::make_shared< Picture >(stats, player_position));
+	});
+	double readback = time_ms(1, [&](){
+		pictures.back()->read_pixels();
+	});
+	GL_ERRORS();
+
+	//flip through every picture a page (of at most a full atlas) at a time -- each must get an atlas slot while shown:
+	constexpr uint32_t PageSize = 12;
+	uint32_t copies_before = thumbnail_atlas.copies, missing = 0;
+	for (uint32_t first = 0; first < pictures.size(); first += PageSize) {
+		std::vector< ThumbnailAtlas::Quad > quads;
+		for (uint32_t p = first; p < std::min(first + PageSize, uint32_t(pictures.size())); ++p) {
+			uint32_t slot = thumbnail_atlas.acquire(*pictures[p]);
+			if (slot == -1U) missing += 1;
+			else quads.emplace_back(ThumbnailAtlas::Quad{slot, glm::vec2(0.0f), glm::vec2(16.0f)});
+		}
+		thumbnail_atlas.draw(quads, size);
+	}
+	GL_ERRORS();
+	bool ok = true;
+
+	size_t old_cpu = 3 * sizeof(GLfloat) * texels;
+	size_t old_gpu = 4 * texels * 4 / 3;
+	auto total = [&](size_t *cpu, size_t *gpu) {
+		*cpu = *gpu = 0;
+		for (auto const &picture : pictures) {
+			*cpu += picture->cpu_bytes();
+			*gpu += picture->gpu_bytes();
+		}
+	};
+	size_t new_cpu, new_gpu;
+	total(&new_cpu, &new_gpu);
+	for (auto const &picture : pictures) {
+		picture->compact();
+	}
+	size_t kept_cpu, kept_gpu;
+	total(&kept_cpu, &kept_gpu);
+
+	auto mb = [](size_t bytes) { return double(bytes) / (1024.0 * 1024.0); };
+	std::cout << "photo_memory: " << Photos << " pictures at " << size.x << "x" << size.y << " (" << capture << " ms each to capture and score; "
+	          << readback << " ms for one lazy CPU readback)" << std::endl;
+	std::cout << "  per photo, before: " << mb(old_cpu) << " MB CPU + " << mb(old_gpu) << " MB GPU" << std::endl;
+	std::cout << "  per photo, until reviewed: " << mb(new_cpu / Photos) << " MB CPU + " << mb(new_gpu / Photos) << " MB GPU" << std::endl;
+	std::cout << "  per photo, once saved or skipped: " << mb(kept_cpu / Photos) << " MB CPU + " << mb(kept_gpu / Photos) << " MB GPU" << std::endl;
+	std::cout << "  session total: " << mb(Photos * (old_cpu + old_gpu)) << " MB before, " << mb(new_cpu + new_gpu) << " MB until reviewed, "
+	          << mb(kept_cpu + kept_gpu) << " MB after" << std::endl;
+	std::cout << "  thumbnail atlas, " << PageSize << " pictures a page: " << (thumbnail_atlas.copies - copies_before) << " copies, "
+	          << missing << " pictures without a slot" << mark_failed(missing, &ok) << std::endl;
+	return ok;
+}
+
+//render target memory: everything allocated up front (as Framebuffers::realloc used to) vs. persistent targets + the
+// transient pool, as left by drawing outside the camera view, then inside it, then taking a picture:
+static bool benchmark_render_targets() {
+	PlayMode play;
+	play.dynamic_resolution.enabled = false; //(draw at exactly 'size')
+	glm::uvec2 sizes[2] = {glm::uvec2(1920, 1080), glm::uvec2(3840, 2160)};
+	auto mb = [](size_t bytes) { return double(bytes) / (1024.0 * 1024.0); };
+	for (glm::uvec2 size : sizes) {
+		auto draw_frames = [&](bool in_cam_view) {
+			play.player->in_cam_view = in_cam_view;
+			for (uint32_t i = 0; i < 3; ++i) {
+				play.draw(size);
+			}
+			glFinish();
+			return framebuffers.persistent_bytes() + framebuffers.transient_bytes();
+		};
+		size_t walking = draw_frames(false);
+		size_t camera = draw_frames(true);
+
+		Scene::PictureCapture capture;
+		std::list< std::pair< Scene::Drawable &, GLuint > > frag_counts;
+		play.scene.begin_picture(*play.active_camera, {}, &capture);
+		play.scene.finish_picture(&capture, frag_counts);
+		size_t picture = framebuffers.persistent_bytes() + framebuffers.transient_bytes();
+		GL_ERRORS();
+
+		size_t texels = size_t(size.x) * size.y;
+		size_t before = framebuffers.persistent_bytes() + texels * (
+			Framebuffers::texel_bytes(GL_RGBA32F) //vertex_position_tex (since replaced by DepthReconstruct)
+			+ Framebuffers::texel_bytes(GL_RGB16F) //depth_effect_tex (since fused into Framebuffers::post_process)
+			+ 2 * Framebuffers::texel_bytes(GL_RGB16F) //blur_tex, picture_tex
+			+ Framebuffers::texel_bytes(GL_R32UI) //id_tex
+		);
+		std::cout << "render_targets at " << size.x << "x" << size.y << ": " << mb(before) << " MB before; "
+		          << mb(walking) << " MB walking around, " << mb(camera) << " MB in camera view, "
+		          << mb(picture) << " MB after a picture (" << framebuffers.transients.size() << " pooled textures)" << std::endl;
+	}
+	return true;
+}
+
+//fragment counts of pictures of the game's creatures: a camera is put just outside each creature's bounds, looking at it,
+// a frame is drawn, and a picture is taken with the creature as its focal point; wherever the focal point test finds the
+// creature visible, the ID pass must have counted some of its fragments (or the picture would score as empty):
+static bool benchmark_picture_ids() {
+	bool ok = true;
+	PlayMode play;
+	play.dynamic_resolution.enabled = false; //(draw at exactly 'size')
+	play.player->in_cam_view = true;
+	glm::uvec2 size = glm::uvec2(1280, 720);
+	Scene &scene = play.scene;
+	scene.update_world_bounds();
+
+	scene.transforms.emplace_back();
+	Scene::Transform *eye = &scene.transforms.back();
+	eye->name = "picture_ids eye";
+	scene.cameras.emplace_back(eye);
+	Scene::Camera *camera = &scene.cameras.back();
+	camera->aspect = float(size.x) / float(size.y);
+	play.active_camera = camera;
+
+	uint32_t pictured = 0, visible = 0, counted = 0;
+	for (auto &pair : Creature::creature_map) {
+		Creature &creature = pair.second;
+		if (!creature.drawable || !creature.drawable->render_to_picture || !creature.drawable->has_bounds()) continue;
+		Scene::Drawable &drawable = *creature.drawable;
+
+		glm::vec3 center = 0.5f * (drawable.world_bbox_min + drawable.world_bbox_max);
+		float radius = 0.5f * glm::length(drawable.world_bbox_max - drawable.world_bbox_min);
+		glm::vec3 from = center + (1.5f * radius + 0.5f) * glm::normalize(glm::vec3(1.0f, 1.0f, 0.5f));
+		glm::mat4 local_to_world = glm::inverse(glm::lookAt(from, center, glm::vec3(0.0f, 0.0f, 1.0f)));
+		eye->position = from;
+		eye->rotation = glm::quat_cast(glm::mat3(local_to_world));
+		play.draw(size);
+
+		Scene::PictureCapture capture;
+		std::list< std::pair< Scene::Drawable &, GLuint > > frag_counts;
+		std::vector< bool > focal_results;
+		scene.begin_picture(*camera, {&drawable}, &capture);
+		scene.finish_picture(&capture, frag_counts, &focal_results);
+		GLuint fragments = 0;
+		for (auto const &count : frag_counts) {
+			if (&count.first == &drawable) fragments += count.second;
+		}
+
+		pictured += 1;
+		if (focal_results.empty() || !focal_results[0]) continue;
+		visible += 1;
+		if (fragments > 0) counted += 1;
+		else std::cout << "  '" << creature.get_code_and_number() << "' is visible but counted no fragments" << mark_failed(true, &ok) << std::endl;
+	}
+	GL_ERRORS();
+
+	std::cout << "picture_ids: " << pictured << " creatures pictured, " << visible << " visible, " << counted << " with fragments counted" << std::endl;
+	std::cout << "  visible creatures checked: " << visible << mark_failed(visible == 0, &ok) << std::endl;
+	return ok;
+}
+
+//hi-z culling during play: the game is drawn from a still camera while every creature moves a little each frame,
+// which must not stop the main pass from using the pyramid (it is built from static drawables only):
+static bool benchmark_hiz_gameplay() {
+	constexpr uint32_t Frames = 20;
+	constexpr uint32_t Settle = 4; //(bounds are computed, moved drawables switched to dynamic, and the first pyramid read back)
+	bool ok = true;
+	PlayMode play;
+	play.dynamic_resolution.enabled = false; //(draw at exactly 'size')
+	glm::uvec2 size = glm::uvec2(1280, 720);
+
+	uint32_t moving = 0, in_use = 0, occluded = 0;
+	for (uint32_t frame = 0; frame < Frames; ++frame) {
+		moving = 0;
+		for (auto &pair : Creature::creature_map) {
+			if (!pair.second.transform) continue;
+			pair.second.transform->position.x += 0.01f;
+			moving += 1;
+		}
+		play.draw(size);
+		glFinish(); //(so each frame's pyramid has been read back by the next)
+		if (frame < Settle) continue;
+
+		glm::mat4 world_to_clip = play.active_camera->make_projection() * glm::mat4(play.active_camera->transform->make_world_to_local());
+		if (play.scene.hiz_current(world_to_clip)) in_use += 1;
+		occluded += play.scene.pass_stats[Scene::Drawable::PassTypeDefault].occluded;
+	}
+	GL_ERRORS();
+
+	std::cout << "hiz_gameplay: " << moving << " creatures moving, " << (Frames - Settle) << " frames from a still camera" << std::endl;
+	std::cout << "  frames using the pyramid: " << in_use << mark_failed(in_use != Frames - Settle, &ok) << std::endl;
+	std::cout << "  drawables occluded (hi-z) in the main pass: " << occluded << " (" << float(occluded) / float(Frames - Settle) << " per frame)" << std::endl;
+	return ok;
+}
+
+//distances reconstructed from depth (DepthReconstruct) vs. the RGBA32F world positions the prepass used to write:
+// draws the main scene's prepass from the player camera into a depth texture and a position texture, reconstructs
+// every pixel's distance from the eye on the GPU, and compares it to the distance to the stored position.
+// Also times the prepass with and without the position target.
+static bool benchmark_depth_positions() {
+	constexpr uint32_t Iterations = 20;
+	bool ok = true;
+
+	Scene scene(*main_scene);
+	Scene::Camera *camera = find_player_camera(scene, "depth_positions");
+	if (!camera) return false;
+	glm::uvec2 size = glm::uvec2(1920, 1080);
+	camera->aspect = float(size.x) / float(size.y);
+	scene.transforms.update_world_matrices();
+	scene.update_world_bounds();
+	glm::mat4 world_to_clip = camera->make_projection() * glm::mat4(camera->transform->make_world_to_local());
+	glm::vec3 eye = camera->transform->make_local_to_world()[3];
+
+	//(the old prepass target, and somewhere to put reconstructed distances)
+	auto make_texture = [&](GLenum internal_format, GLenum format, GLenum type) {
+		GLuint tex = 0;
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y, 0, format, type, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return tex;
+	};
+	GLuint depth_tex = make_texture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+	GLuint position_tex = make_texture(GL_RGBA32F, GL_RGBA, GL_FLOAT);
+	GLuint distance_tex = make_texture(GL_R32F, GL_RED, GL_FLOAT);
+	GLuint fbs[2] = {0, 0};
+	glGenFramebuffers(2, fbs);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbs[0]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, position_tex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbs[1]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, distance_tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	auto prepass = [&](bool positions) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbs[0]);
+		glDrawBuffer(positions ? GL_COLOR_ATTACHMENT0 : GL_NONE);
+		glViewport(0, 0, size.x, size.y);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClearDepth(1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LEQUAL);
+		glDisable(GL_BLEND);
+		scene.draw(*camera, Scene::Drawable::PassTypePrepass);
+		glFinish();
+	};
+	double with_positions = time_ms(Iterations, [&](){ prepass(true); });
+	double depth_only = time_ms(Iterations, [&](){ prepass(false); });
+	prepass(true);
+
+	GLuint program = gl_compile_program(
+		"#version 330\n"
+		"void main() {\n"
+		"	gl_Position = vec4(4 * (gl_VertexID & 1) - 1,  2 * (gl_VertexID & 2) - 1, 0.0, 1.0);\n"
+		"}\n"
+		,
+		std::string("#version 330\n")
+		+ DepthReconstruct::GLSL +
+		"uniform sampler2D DEPTH_TEX;\n"
+		"out vec4 fragColor;\n"
+		"void main() {\n"
+		"	float depth = texelFetch(DEPTH_TEX, ivec2(gl_FragCoord.xy), 0).r;\n"
+		"	fragColor = vec4(depth < 1.0 ? view_distance(gl_FragCoord.xy, depth) : -1.0);\n"
+		"}\n"
+	);
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbs[1]);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "DEPTH_TEX"), 0);
+	DepthReconstruct(program).set(world_to_clip, eye, size);
+	glBindVertexArray(vao);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depth_tex);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glEnable(GL_DEPTH_TEST);
+
+	std::vector< float > distances(size_t(size.x) * size.y);
+	std::vector< glm::vec4 > positions(size_t(size.x) * size.y);
+	std::vector< float > depths(size_t(size.x) * size.y);
+	glReadPixels(0, 0, size.x, size.y, GL_RED, GL_FLOAT, distances.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, fbs[0]);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_FLOAT, positions.data());
+	glReadPixels(0, 0, size.x, size.y, GL_DEPTH_COMPONENT, GL_FLOAT, depths.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glDeleteVertexArrays(1, &vao);
+	glDeleteProgram(program);
+	glDeleteFramebuffers(2, fbs);
+	glDeleteTextures(1, &depth_tex);
+	glDeleteTextures(1, &position_tex);
+	glDeleteTextures(1, &distance_tex);
+	GL_ERRORS();
+
+	//(the position target held zero where nothing was drawn)
+	uint32_t compared = 0, sky_mismatches = 0;
+	double total_error = 0.0, max_error = 0.0, max_relative = 0.0, max_cpu_relative = 0.0;
+	glm::mat4 clip_to_world = glm::inverse(world_to_clip);
+	for (size_t i = 0; i < distances.size(); ++i) {
+		bool drawn = positions[i] != glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		if (drawn != (distances[i] >= 0.0f)) {
+			sky_mismatches += 1;
+			continue;
+		}
+		if (!drawn) continue;
+		double expected = glm::length(glm::vec3(positions[i]) - eye);
+		double error = std::abs(double(distances[i]) - expected);
+		compared += 1;
+		total_error += error;
+		max_error = std::max(max_error, error);
+		max_relative = std::max(max_relative, error / std::max(expected, 1e-6));
+		//(and the same reconstruction on the CPU)
+		glm::vec2 frag_coord = glm::vec2(float(i % size.x) + 0.5f, float(i / size.x) + 0.5f);
+		double cpu = glm::length(DepthReconstruct::world_position(clip_to_world, frag_coord, size, depths[i]) - eye);
+		max_cpu_relative = std::max(max_cpu_relative, std::abs(cpu - expected) / std::max(expected, 1e-6));
+	}
+	std::cout << "depth_positions: " << size.x << "x" << size.y << " prepass of the main scene from the player camera" << std::endl;
+	std::cout << "  prepass with RGBA32F positions: " << with_positions << " ms; depth only: " << depth_only << " ms" << std::endl;
+	std::cout << "  " << compared << " pixels compared: mean error " << (compared ? total_error / compared : 0.0) << ", max " << max_error
+	          << " (" << 100.0 * max_relative << "% of the distance)" << mark_failed(max_relative > 0.01, &ok) << std::endl;
+	std::cout << "  CPU reconstruction: max " << 100.0 * max_cpu_relative << "% of the distance" << mark_failed(max_cpu_relative > 0.01, &ok) << std::endl;
+	std::cout << "  pixels drawn in one but not the other: " << sky_mismatches << mark_failed(sky_mismatches, &ok) << std::endl;
+	return ok;
+}
+
+//helper: an RGB16F texture of 'size' attached to a new framebuffer (delete both when done):
+static std::pair< GLuint, GLuint > make_hdr_target(glm::uvec2 size) {
+	GLuint tex = 0, fb = 0;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, size.x, size.y, 0, GL_RGB, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenFramebuffers(1, &fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GL_ERRORS();
+	return std::make_pair(tex, fb);
+}
+
+//helper: largest per-channel difference between two images, averaged over pixels, and the largest overall:
+static std::pair< double, double > image_difference(std::vector< glm::vec3 > const &a, std::vector< glm::vec3 > const &b) {
+	double total = 0.0, largest = 0.0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		glm::vec3 d = glm::abs(a[i] - b[i]);
+		double diff = std::max(d.x, std::max(d.y, d.z));
+		total += diff;
+		largest = std::max(largest, diff);
+	}
+	return std::make_pair(a.empty() ? 0.0 : total / double(a.size()), largest);
+}
+
+//depth of field blurred at full size vs. through the half/quarter size pyramid:
+// draws camera-view frames of the game's opening view with each, and reports the GPU time of the
+// depth of field blur and post passes (Framebuffers::pass_timers) and how far apart the two images are.
+static bool benchmark_depth_of_field() {
+	constexpr uint32_t Frames = 60;
+	std::vector< std::string > const dof_passes = {"dof blur 1/2", "dof blur 1/4", "dof blur", "post"};
+
+	PlayMode play;
+	play.dynamic_resolution.enabled = false; //(draw at exactly 'size')
+	play.player->in_cam_view = true;
+	glm::uvec2 sizes[2] = {glm::uvec2(1920, 1080), glm::uvec2(3840, 2160)};
+	for (glm::uvec2 size : sizes) {
+		std::vector< glm::vec3 > images[2];
+		float ms[2];
+		for (uint32_t pyramid = 0; pyramid < 2; ++pyramid) {
+			framebuffers.dof_pyramid = (pyramid != 0);
+			//(start each run with fresh timers, since both paths have a "post" pass)
+			for (auto &pair : framebuffers.pass_timers) {
+				glDeleteQueries(GLsizei(pair.second.queries.size()), pair.second.queries.data());
+			}
+			framebuffers.pass_timers.clear();
+			for (uint32_t i = 0; i < Frames; ++i) {
+				play.draw(size);
+			}
+			glFinish();
+			ms[pyramid] = framebuffers.pass_ms(dof_passes);
+
+			//(just the depth of field, in HDR, without the UI the frame drew on top)
+			auto target = make_hdr_target(size);
+			glBindFramebuffer(GL_FRAMEBUFFER, target.second);
+			framebuffers.post_process(framebuffers.screen_texture, Framebuffers::PostDepthOfField);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			images[pyramid].resize(size_t(size.x) * size.y);
+			glBindTexture(GL_TEXTURE_2D, target.first);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, images[pyramid].data());
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glDeleteFramebuffers(1, &target.second);
+			glDeleteTextures(1, &target.first);
+			GL_ERRORS();
+		}
+		framebuffers.dof_pyramid = true;
+
+		auto difference = image_difference(images[0], images[1]);
+		std::cout << "depth_of_field at " << size.x << "x" << size.y << " (focus " << play.player->player_camera->cur_focus << "): "
+		          << ms[0] << " ms full size, " << ms[1] << " ms pyramid (" << (ms[1] > 0.0f ? ms[0] / ms[1] : 0.0f) << "x); "
+		          << "image difference mean " << difference.first << ", max " << difference.second << std::endl;
+	}
+	return true;
+}
+
+//post-processing as one fused pass vs. the same sections as separate passes (depth of field, fog, tone map),
+// each writing an RGB16F target for the next, as before Framebuffers::post_process fused them.
+// Times both after a camera-view frame of the game's opening view, and checks they draw the same image.
+static bool benchmark_post() {
+	constexpr uint32_t Iterations = 50;
+	bool ok = true;
+
+	PlayMode play;
+	play.dynamic_resolution.enabled = false; //(draw at exactly 'size')
+	play.player->in_cam_view = true;
+	glm::uvec2 sizes[2] = {glm::uvec2(1920, 1080), glm::uvec2(3840, 2160)};
+	for (glm::uvec2 size : sizes) {
+		play.draw(size); //(leaves screen_texture, the depth buffers, the blur and framebuffers.post ready)
+		auto targets = std::array< std::pair< GLuint, GLuint >, 3 >{make_hdr_target(size), make_hdr_target(size), make_hdr_target(size)};
+
+		auto separate = [&](GLuint out_fb) {
+			glBindFramebuffer(GL_FRAMEBUFFER, targets[0].second);
+			framebuffers.post_process(framebuffers.screen_texture, Framebuffers::PostDepthOfField);
+			glBindFramebuffer(GL_FRAMEBUFFER, targets[1].second);
+			framebuffers.post_process(targets[0].first, Framebuffers::PostFog);
+			glBindFramebuffer(GL_FRAMEBUFFER, out_fb);
+			framebuffers.post_process(targets[1].first, Framebuffers::PostToneMap);
+		};
+		auto fused = [&](GLuint out_fb) {
+			glBindFramebuffer(GL_FRAMEBUFFER, out_fb);
+			framebuffers.post_process(framebuffers.screen_texture, Framebuffers::PostDepthOfField | Framebuffers::PostFog | Framebuffers::PostToneMap);
+		};
+		double separate_ms = time_ms(Iterations, [&](){ separate(0); glFinish(); });
+		double fused_ms = time_ms(Iterations, [&](){ fused(0); glFinish(); });
+
+		std::vector< glm::vec3 > images[2];
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (i == 0) separate(targets[2].second);
+			else fused(targets[2].second);
+			images[i].resize(size_t(size.x) * size.y);
+			glBindTexture(GL_TEXTURE_2D, targets[2].first);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, images[i].data());
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		for (auto &target : targets) {
+			glDeleteFramebuffers(1, &target.second);
+			glDeleteTextures(1, &target.first);
+		}
+		GL_ERRORS();
+
+		//(the separate passes round to half floats in between, so expect differences around 1e-3)
+		auto difference = image_difference(images[0], images[1]);
+		std::cout << "post at " << size.x << "x" << size.y << ": " << separate_ms << " ms as three passes, " << fused_ms << " ms fused ("
+		          << (fused_ms > 0.0 ? separate_ms / fused_ms : 0.0) << "x); image difference mean " << difference.first << ", max " << difference.second
+		          << mark_failed(difference.second > 0.01, &ok) << std::endl;
+	}
+	return ok;
+}
+
+//dynamic resolution: replays the scale changes the game logged (run with '--dynamic-resolution-log <file>' to give it one), or, without a log,
+// steps down through every scale, drawing camera-view frames of the game's opening view at 1920x1080 and reporting the
+// GPU time per frame (DynamicResolution's timestamps) at each scale; then runs the controller on those times to see where it settles.
+// Also takes a picture at the smallest scale, which must come out at full size without reallocating the shared render targets.
+static bool benchmark_dynamic_resolution() {
+	constexpr uint32_t Frames = 60; //per scale
+	glm::uvec2 const size = glm::uvec2(1920, 1080);
+
+	PlayMode play;
+	play.player->in_cam_view = true;
+	DynamicResolution &dr = play.dynamic_resolution;
+	dr.enabled = false; //(the benchmark sets the scale)
+
+	std::string filename = DynamicResolution::default_log_filename;
+	std::vector< DynamicResolution::Change > changes = DynamicResolution::load_log(filename);
+	bool replaying = !changes.empty();
+	if (!replaying) {
+		uint32_t levels = uint32_t(std::lround((dr.max_scale - dr.min_scale) / dr.step));
+		for (uint32_t i = 0; i < levels; ++i) {
+			DynamicResolution::Change change;
+			change.frame = (i + 1) * Frames;
+			change.from = dr.max_scale - i * dr.step;
+			change.to = dr.max_scale - (i + 1) * dr.step;
+			changes.emplace_back(change);
+		}
+	}
+	std::cout << "dynamic_resolution at " << size.x << "x" << size.y << ": "
+	          << (replaying ? "replaying " + std::to_string(changes.size()) + " changes from " + filename : std::string("no log, stepping through every scale")) << std::endl;
+
+	//GPU ms per frame at 'scale' (measured from the second half of the frames, so the old scale's frames in flight and the reallocation don't count):
+	std::map< float, float > measured;
+	auto measure = [&](float scale) {
+		dr.set_scale(scale);
+		for (uint32_t i = 0; i < Frames / 2; ++i) {
+			play.draw(size);
+		}
+		glFinish();
+		play.draw(size); //(reads back everything before it)
+		dr.set_scale(scale);
+		for (uint32_t i = 0; i < Frames / 2; ++i) {
+			play.draw(size);
+		}
+		glFinish();
+		play.draw(size);
+		measured[dr.scale] = dr.average_ms;
+		return dr.average_ms;
+	};
+
+	std::cout << "  scale " << changes[0].from << ": " << measure(changes[0].from) << " ms" << std::endl;
+	for (auto const &change : changes) {
+		float ms = measure(change.to);
+		std::cout << "  frame " << change.frame << ": scale " << change.from << " -> " << change.to;
+		if (replaying) std::cout << " (logged at " << change.gpu_ms << " ms)";
+		std::cout << ": " << ms << " ms" << std::endl;
+	}
+
+	//the controller, fed those times (scales that weren't measured are estimated from the nearest one that was, by area):
+	DynamicResolution controller;
+	uint32_t const Simulated = 3000;
+	for (uint32_t i = 0; i < Simulated; ++i) {
+		auto nearest = measured.lower_bound(controller.scale);
+		if (nearest == measured.end()) --nearest;
+		float ratio = controller.scale / nearest->first;
+		controller.update(nearest->second * ratio * ratio);
+	}
+	std::cout << "  the controller (budget " << controller.budget_ms << " ms) settles at scale " << controller.scale << " after "
+	          << controller.changes.size() << " changes in " << Simulated << " frames" << std::endl;
+
+	//a picture while scaled down (it is drawn into PlayMode::picture_framebuffers, swapped in for the frame):
+	bool ok = true;
+	{
+		dr.set_scale(dr.min_scale);
+		play.draw(size);
+		glm::uvec2 scaled = framebuffers.size;
+		GLuint screen = framebuffers.screen_texture;
+		std::list< PendingPicture > &pending = play.player->player_camera->pending_pictures;
+		size_t before = pending.size();
+		play.cur_state = PlayMode::playing;
+		play.picture_requested = true;
+		play.draw(size);
+		glm::uvec2 picture = (pending.size() == before + 1 ? pending.back().capture.size : glm::uvec2(0));
+		bool reallocated = (framebuffers.size != scaled || framebuffers.screen_texture != screen);
+		std::cout << "  picture at scale " << dr.scale << ": " << picture.x << "x" << picture.y << mark_failed(picture != size, &ok)
+		          << ", shared targets " << (reallocated ? "reallocated" : "untouched") << " (" << framebuffers.size.x << "x" << framebuffers.size.y << ")" << mark_failed(reallocated, &ok) << std::endl;
+	}
+	return ok;
+}
+
+bool run_benchmark(std::string const &name) {
+	struct Benchmark {
+		char const *name;
+		std::function< bool() > run; //false if a check failed
+	};
+	static std::vector< Benchmark > const benchmarks = {
+		{"draw_calls", benchmark_draw_calls},
+		{"lights", benchmark_lights},
+		{"focal_points", benchmark_focal_points},
+		{"hiz_gameplay", benchmark_hiz_gameplay},
+		{"soft_raster", benchmark_soft_raster},
+		{"photo_memory", benchmark_photo_memory},
+		{"render_targets", benchmark_render_targets},
+		{"picture_ids", benchmark_picture_ids},
+		{"depth_positions", benchmark_depth_positions},
+		{"depth_of_field", benchmark_depth_of_field},
+		{"post", benchmark_post},
+		{"dynamic_resolution", benchmark_dynamic_resolution},
+	};
+
+	for (auto const &b : benchmarks) {
+		if (name == b.name) {
+			return b.run();
+		}
+	}
+
+	std::cerr << "Unknown benchmark '" << name << "'; available:";
+	for (auto const &b : benchmarks) {
+		std::cerr << " " << b.name;
+	}
+	std::cerr << std::endl;
+	return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+//developer timing benchmarks, run with 'aperture --benchmark <name>':
+// (called after assets are loaded, so a GL context is available; checks that don't need GL are in tests.cpp instead)
+// returns false if any of its checks failed (they print "<-- FAILED"), or (after printing the available names) if 'name' is unknown
+bool run_benchmark(std::string const &name);
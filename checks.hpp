@@ -0,0 +1,24 @@
+#pragma once
+
+//helpers shared by the developer checks ('aperture --benchmark <name>' in benchmarks.cpp and 'tests/aperture-tests' in tests.cpp):
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+//mark a failed check in a report line (and clear *ok, so the check returns false):
+inline char const *mark_failed(bool failed, bool *ok) {
+	if (!failed) return "";
+	*ok = false;
+	return "  <-- FAILED";
+}
+
+//time 'iterations' calls of 'fn', return average milliseconds per call:
+inline double time_ms(uint32_t iterations, std::function< void() > const &fn) {
+	auto before = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < iterations; ++i) {
+		fn();
+	}
+	auto after = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration< double, std::milli >(after - before).count() / double(iterations);
+}
@@ -18,6 +18,11 @@
 //for screenshots:
 #include "load_save_png.hpp"
 
+//for '--benchmark':
+#include "benchmarks.hpp"
+//for '--dynamic-resolution-log':
+#include "DynamicResolution.hpp"
+
 //Includes for libSDL:
 #include <SDL.h>
 
@@ -151,8 +156,22 @@ int main(int argc, char **argv) {
 	std::cout << "Assets loaded." << std::endl;
 
 	//------------ create game mode + make current --------------
-	//Mode::set_current(std::make_shared< PlayMode >());
-	Mode::set_current(std::make_shared< GP22IntroMode >(std::make_shared< PlayMode >())); // Splash screen mode that transitions to PlayMode
+	int exit_code = 0;
+	//developer options (each takes one value; anything else on the command line is ignored):
+	// '--benchmark <name>' runs a benchmark instead of the game,
+	// '--dynamic-resolution-log <file>' prints dynamic resolution changes and appends them to <file> (the dynamic_resolution benchmark replays it)
+	std::string benchmark;
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (std::string(argv[i]) == "--benchmark") benchmark = argv[++i];
+		else if (std::string(argv[i]) == "--dynamic-resolution-log") DynamicResolution::default_log_filename = argv[++i];
+	}
+	if (!benchmark.empty()) {
+		//run a developer benchmark instead of the game (main loop will exit immediately; exits nonzero if it failed):
+		if (!run_benchmark(benchmark)) exit_code = 1;
+	} else {
+		//Mode::set_current(std::make_shared< PlayMode >());
+		Mode::set_current(std::make_shared< GP22IntroMode >(std::make_shared< PlayMode >())); // Splash screen mode that transitions to PlayMode
+	}
 
 	//------------ main loop ------------
 
@@ -241,7 +260,7 @@ int main(int argc, char **argv) {
 	SDL_DestroyWindow(sdl_window);
     sdl_window = NULL;
 
-	return 0;
+	return exit_code;
 
 #ifdef _WIN32
 	} catch (std::exception const &e) {
@@ -0,0 +1,672 @@
+/*
+ * Developer checks that don't need a GL context (or a window), so they can run anywhere:
+ *  'tests/aperture-tests' runs every check, 'tests/aperture-tests <name> ...' runs the named ones.
+ * Exits nonzero if any check failed (its report line says "<-- FAILED").
+ *
+ * Checks that draw with GL live in benchmarks.cpp ('aperture --benchmark <name>').
+ *
+ */
+
+#include "checks.hpp"
+
+#include "Scene.hpp"
+#include "BVH.hpp"
+#include "RenderQueue.hpp"
+#include "IdHistogram.hpp"
+#include "HiZ.hpp"
+#include "SoftRaster.hpp"
+#include "PhotoWriter.hpp"
+#include "data_path.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+//world matrix cache vs. recursive parent-chain walk:
+// 10k transforms in chains of depth 8; each "frame" queries every world matrix
+// once per render pass (shadow, prepass, main, picture) like Scene::render_drawable does.
+static bool test_transforms() {
+	constexpr uint32_t TransformCount = 10000;
+	constexpr uint32_t Depth = 8;
+	constexpr uint32_t Passes = 4;
+	constexpr uint32_t Frames = 100;
+	bool ok = true;
+
+	Scene scene;
+	std::vector< Scene::Transform * > transforms;
+	transforms.reserve(TransformCount);
+	for (uint32_t i = 0; i < TransformCount; ++i) {
+		scene.transforms.emplace_back();
+		Scene::Transform *t = &scene.transforms.back();
+		t->name = "bench" + std::to_string(i);
+		t->position = glm::vec3(float(i % 7), float(i % 11), float(i % 13)) * 0.1f;
+		t->rotation = glm::angleAxis(0.01f * float(i), glm::vec3(0.0f, 0.0f, 1.0f));
+		if (i % Depth != 0) t->parent = transforms.back();
+		transforms.emplace_back(t);
+	}
+
+	glm::vec3 sink = glm::vec3(0.0f);
+	uint32_t frame = 0;
+
+	//move one in 'stride' root transforms per frame (stride = 0 means a static scene):
+	auto animate = [&](uint32_t stride) {
+		frame += 1;
+		if (stride == 0) return;
+		for (uint32_t i = (frame % stride) * Depth; i < TransformCount; i += stride * Depth) {
+			transforms[i]->position.z = 0.01f * float(frame);
+		}
+	};
+
+	auto run = [&](char const *label, uint32_t stride) {
+		double uncached = time_ms(Frames, [&](){
+			animate(stride);
+			for (uint32_t pass = 0; pass < Passes; ++pass) {
+				for (auto t : transforms) sink += t->make_local_to_world_uncached()[3];
+			}
+		});
+		//warm the cache so the counts below only reflect per-frame changes:
+		for (auto t : transforms) t->make_local_to_world();
+		Scene::Transform::world_cache_recomputes = 0;
+		double cached = time_ms(Frames, [&](){
+			animate(stride);
+			for (uint32_t pass = 0; pass < Passes; ++pass) {
+				for (auto t : transforms) sink += t->make_local_to_world()[3];
+			}
+		});
+		//sanity check: cached matrices should match the recursive computation:
+		float max_error = 0.0f;
+		for (auto t : transforms) {
+			glm::mat4x3 a = t->make_local_to_world();
+			glm::mat4x3 b = t->make_local_to_world_uncached();
+			for (uint32_t c = 0; c < 4; ++c) {
+				max_error = std::max(max_error, glm::length(a[c] - b[c]));
+			}
+		}
+		std::cout << "  " << label << ": uncached " << uncached << " ms/frame, cached " << cached << " ms/frame"
+		          << " (" << (Scene::Transform::world_cache_recomputes / Frames) << " recomputes/frame, max error " << max_error << ")" << mark_failed(max_error > 1e-3f, &ok) << std::endl;
+	};
+
+	std::cout << "transforms: " << TransformCount << " transforms, depth " << Depth << ", " << Passes << " passes/frame" << std::endl;
+	run("static", 0);
+	run("1% moving", 100);
+	run("all moving", 1);
+	std::cout << "  (checksum " << sink.x + sink.y + sink.z << ")" << std::endl;
+	return ok;
+}
+
+//scene storage: copying and traversing the game's scene (transforms, cameras, lights, one drawable per mesh):
+// (reads dist/assets, so build the game first; drawables get no GL objects)
+static bool test_scene() {
+	constexpr uint32_t Iterations = 1000;
+
+	Scene scene(data_path("../dist/assets/proto-world2.scene"), [](Scene &scene, Scene::Transform *transform, std::string const mesh_name, GLuint tex){
+		std::unique_lock< std::mutex > lock(scene.drawable_load_mutex);
+		scene.drawables.emplace_back(transform);
+		Scene::Material material;
+		material.uses_vertex_color = true; //skip texture loading
+		scene.drawables.back().material = scene.add_material(material);
+		scene.drawables.back().bbox_min = glm::vec3(-1.0f); //(so update_world_bounds has boxes to move)
+		scene.drawables.back().bbox_max = glm::vec3( 1.0f);
+	});
+	bool ok = true;
+
+	glm::vec3 sink = glm::vec3(0.0f);
+
+	double copy = time_ms(Iterations, [&](){
+		Scene copy(scene);
+		sink.x += float(copy.transforms.size());
+	});
+
+	//walk every drawable's parent chain (what every render pass did before world matrices were cached):
+	double traverse = time_ms(Iterations, [&](){
+		for (auto const &drawable : scene.drawables) {
+			sink += drawable.transform->make_local_to_world_uncached()[3];
+		}
+	});
+
+	//rebuild every world matrix in storage order (each root moved, so everything is recomputed):
+	uint32_t frame = 0;
+	double rebuild = time_ms(Iterations, [&](){
+		frame += 1;
+		for (auto &transform : scene.transforms) {
+			if (!transform.parent) transform.position.z += (frame % 2 ? 1.0f : -1.0f) * 1e-3f;
+		}
+		scene.transforms.update_world_matrices();
+		for (auto const &drawable : scene.drawables) {
+			sink += drawable.transform->make_local_to_world()[3];
+		}
+	});
+
+	std::cout << "scene: " << scene.transforms.size() << " transforms, " << scene.drawables.size() << " drawables" << std::endl;
+	std::cout << "  copy: " << copy << " ms" << std::endl;
+	std::cout << "  traverse (uncached parent chains): " << traverse << " ms" << std::endl;
+	std::cout << "  rebuild all world matrices (linear pass): " << rebuild << " ms" << std::endl;
+
+	//re-parent the first root under a new transform, like Player does with the scene's camera: the first update
+	// reaches its subtree before the new parent (recursive fallback), then re-sorts so later updates are linear again:
+	{
+		Scene::Transform *child = nullptr;
+		for (auto &transform : scene.transforms) {
+			if (!transform.parent) {
+				child = &transform;
+				break;
+			}
+		}
+		Scene::Transform &adopter = scene.transforms.emplace_back();
+		adopter.name = "adopter";
+		if (child) child->parent = &adopter;
+		uint32_t behind = scene.transforms.out_of_order();
+		double fallback = time_ms(1, [&](){
+			scene.transforms.update_world_matrices();
+		});
+		uint32_t still_behind = scene.transforms.out_of_order();
+		double resorted = time_ms(Iterations, [&](){
+			frame += 1;
+			adopter.position.z += (frame % 2 ? 1.0f : -1.0f) * 1e-3f;
+			scene.transforms.update_world_matrices();
+		});
+		float max_error = 0.0f;
+		for (auto const &transform : scene.transforms) {
+			glm::mat4x3 a = transform.make_local_to_world();
+			glm::mat4x3 b = transform.make_local_to_world_uncached();
+			for (uint32_t c = 0; c < 4; ++c) {
+				max_error = std::max(max_error, glm::length(a[c] - b[c]));
+			}
+		}
+		std::cout << "  re-parented '" << (child ? child->name : "") << "' under a new transform: " << behind << " behind their parent"
+		          << ", first update (fallback + re-sort) " << fallback << " ms, " << still_behind << " left behind after it" << mark_failed(still_behind, &ok)
+		          << ", then " << resorted << " ms (max error " << max_error << ")" << mark_failed(!child || behind != 1 || max_error > 1e-3f, &ok) << std::endl;
+	}
+	std::cout << "  (checksum " << sink.x + sink.y + sink.z << ")" << std::endl;
+
+	//static drawables that all start moving in the same frame should switch to the dynamic tree with one rebuild:
+	scene.update_world_bounds();
+	uint32_t builds_before = scene.bvh_builds;
+	for (uint32_t step = 0; step < 3; ++step) {
+		for (auto &transform : scene.transforms) {
+			if (!transform.parent) transform.position.z += 1e-2f;
+		}
+		scene.transforms.update_world_matrices();
+		scene.update_world_bounds();
+	}
+	uint32_t still_static = 0;
+	for (auto const &drawable : scene.drawables) {
+		if (!drawable.dynamic) still_static += 1;
+	}
+	uint32_t rebuilds = scene.bvh_builds - builds_before;
+	std::cout << "  moving every drawable for 3 frames: " << rebuilds << " BVH rebuilds" << mark_failed(rebuilds != 1, &ok)
+	          << ", " << still_static << " drawables left in the static tree" << mark_failed(still_static, &ok) << std::endl;
+	return ok;
+}
+
+//BVH frustum and ray queries vs. brute force on randomized boxes (also checks that both agree):
+static bool test_bvh() {
+	constexpr uint32_t Scenes = 20;
+	constexpr uint32_t Queries = 200;
+	bool ok = true;
+
+	std::mt19937 mt(0x15466);
+	auto rand01 = [&]() { return std::uniform_real_distribution< float >(0.0f, 1.0f)(mt); };
+	auto rand_vec = [&](float scale) { return scale * glm::vec3(2.0f * rand01() - 1.0f, 2.0f * rand01() - 1.0f, 2.0f * rand01() - 1.0f); };
+
+	uint32_t mismatches = 0;
+	double brute_ms = 0.0, bvh_ms = 0.0;
+	double visible = 0.0;
+	for (uint32_t s = 0; s < Scenes; ++s) {
+		uint32_t count = 100 + uint32_t(rand01() * 10000.0f);
+		std::vector< BVH::Item > boxes;
+		boxes.reserve(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			glm::vec3 center = rand_vec(200.0f);
+			glm::vec3 radius = glm::abs(rand_vec(5.0f)) + glm::vec3(0.01f);
+			boxes.emplace_back(BVH::Item{i, center - radius, center + radius});
+		}
+		BVH bvh;
+		bvh.build(boxes);
+
+		//move a few boxes and refit, like creatures do:
+		for (uint32_t i = 0; i < count; i += 10) {
+			glm::vec3 offset = rand_vec(20.0f);
+			boxes[i].min += offset;
+			boxes[i].max += offset;
+		}
+		bvh.refit([&](uint32_t id, glm::vec3 *min, glm::vec3 *max) {
+			*min = boxes[id].min;
+			*max = boxes[id].max;
+		});
+
+		for (uint32_t q = 0; q < Queries; ++q) {
+			glm::vec3 eye = rand_vec(200.0f);
+			glm::vec3 target = eye + rand_vec(1.0f);
+			Scene::Frustum frustum(glm::infinitePerspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f) * glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f)));
+			auto test = [&frustum](glm::vec3 const &min, glm::vec3 const &max) { return frustum.classify(min, max); };
+
+			std::vector< uint32_t > expected, got;
+			brute_ms += time_ms(1, [&](){
+				for (auto const &b : boxes) if (frustum.intersects(b.min, b.max)) expected.emplace_back(b.id);
+			});
+			bvh_ms += time_ms(1, [&](){
+				bvh.query(test, [&](uint32_t id){ got.emplace_back(id); });
+			});
+			visible += double(expected.size()) / double(boxes.size());
+			std::sort(got.begin(), got.end());
+			if (got != expected) mismatches += 1;
+
+			//ray from the eye toward the target; compare closest hit:
+			glm::vec3 dir = glm::normalize(target - eye);
+			glm::vec3 inv_dir = 1.0f / dir;
+			float expected_t = std::numeric_limits< float >::infinity();
+			for (auto const &b : boxes) {
+				float t;
+				if (BVH::ray_hits_box(eye, inv_dir, expected_t, b.min, b.max, &t)) expected_t = std::min(expected_t, t);
+			}
+			float got_t = std::numeric_limits< float >::infinity();
+			bvh.ray_query(eye, dir, std::numeric_limits< float >::infinity(), [&](uint32_t id, float t){ got_t = std::min(got_t, t); });
+			if (got_t != expected_t) mismatches += 1;
+		}
+	}
+
+	std::cout << "bvh: " << Scenes << " random scenes, " << Queries << " frustum + ray queries each" << std::endl;
+	std::cout << "  frustum query: brute force " << brute_ms / (Scenes * Queries) << " ms, bvh " << bvh_ms / (Scenes * Queries) << " ms"
+	          << " (" << int(100.0 * visible / (Scenes * Queries)) << "% of boxes visible on average)" << std::endl;
+	std::cout << "  mismatches vs brute force: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	return ok;
+}
+
+//render queue radix sort vs. std::stable_sort, and how many state changes sorting saves:
+// packets draw from a handful of programs, a few dozen vaos, and a couple dozen textures (like the game's scenes)
+static bool test_render_queue() {
+	constexpr uint32_t Counts[] = {200, 2000, 20000};
+	constexpr uint32_t Iterations = 100;
+	bool ok = true;
+
+	std::mt19937 mt(0x15466);
+	auto rand_below = [&](uint32_t n) { return std::uniform_int_distribution< uint32_t >(0, n - 1)(mt); };
+
+	struct State {
+		GLuint program, vao, texture;
+	};
+
+	uint32_t mismatches = 0;
+	for (uint32_t count : Counts) {
+		std::vector< State > states;
+		RenderQueue queue;
+		for (uint32_t i = 0; i < count; ++i) {
+			states.emplace_back(State{1 + rand_below(3), 1 + rand_below(40), 1 + rand_below(25)});
+			float depth = std::uniform_real_distribution< float >(0.1f, 500.0f)(mt);
+			queue.push(RenderQueue::make_key(0, states.back().program, states.back().vao, states.back().texture, depth), i);
+		}
+		std::vector< RenderQueue::Packet > const unsorted = queue.packets;
+
+		auto count_changes = [&](std::vector< RenderQueue::Packet > const &packets, uint32_t *programs, uint32_t *vaos, uint32_t *textures) {
+			State bound{0, 0, 0};
+			*programs = *vaos = *textures = 0;
+			for (auto const &packet : packets) {
+				State const &want = states[packet.id];
+				if (want.program != bound.program) *programs += 1;
+				if (want.vao != bound.vao) *vaos += 1;
+				if (want.texture != bound.texture) *textures += 1;
+				bound = want;
+			}
+		};
+
+		double radix = time_ms(Iterations, [&](){
+			queue.packets = unsorted;
+			queue.sort();
+		});
+		std::vector< RenderQueue::Packet > expected;
+		double stable = time_ms(Iterations, [&](){
+			expected = unsorted;
+			std::stable_sort(expected.begin(), expected.end(), [](RenderQueue::Packet const &a, RenderQueue::Packet const &b) {
+				return a.key < b.key;
+			});
+		});
+		for (uint32_t i = 0; i < count; ++i) {
+			if (queue.packets[i].id != expected[i].id) {
+				mismatches += 1;
+				break;
+			}
+		}
+
+		uint32_t programs_before, vaos_before, textures_before;
+		uint32_t programs_after, vaos_after, textures_after;
+		count_changes(unsorted, &programs_before, &vaos_before, &textures_before);
+		count_changes(queue.packets, &programs_after, &vaos_after, &textures_after);
+
+		std::cout << "render_queue: " << count << " packets" << std::endl;
+		std::cout << "  sort: radix " << radix << " ms, std::stable_sort " << stable << " ms" << std::endl;
+		std::cout << "  state changes (unsorted -> sorted): program " << programs_before << " -> " << programs_after
+		          << ", vao " << vaos_before << " -> " << vaos_after
+		          << ", texture " << textures_before << " -> " << textures_after << std::endl;
+	}
+	std::cout << "  mismatches vs std::stable_sort: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	return ok;
+}
+
+//object-ID histogram (IdHistogram) on synthetic ID images :
+// images are rows of random-length runs of random ids (like drawables covering the screen),
+// counted with a plain loop, then on one thread, then on every hardware thread; all three must agree
+static bool test_id_histogram() {
+	constexpr uint32_t Iterations = 50;
+	bool ok = true;
+	struct Image {
+		uint32_t width, height, ids;
+	};
+	static Image const images[] = {
+		{320, 180, 20},
+		{1280, 720, 200},
+		{1920, 1080, 2000},
+		{3840, 2160, 2000},
+	};
+
+	std::mt19937 mt(0x15466);
+	uint32_t mismatches = 0;
+	for (auto const &image : images) {
+		std::vector< uint32_t > ids(size_t(image.width) * image.height);
+		for (size_t i = 0; i < ids.size(); ) {
+			uint32_t id = std::uniform_int_distribution< uint32_t >(0, image.ids)(mt); //(== image.ids is out of range, and should be ignored)
+			size_t run = std::uniform_int_distribution< size_t >(1, 200)(mt);
+			for (size_t end = std::min(ids.size(), i + run); i < end; ++i) ids[i] = id;
+		}
+
+		std::vector< uint32_t > expected;
+		double plain = time_ms(Iterations, [&](){
+			expected.assign(image.ids, 0);
+			for (uint32_t id : ids) {
+				if (id < image.ids) expected[id] += 1;
+			}
+		});
+		IdHistogram single, threaded;
+		double one_thread = time_ms(Iterations, [&](){
+			single.count(ids.data(), ids.size(), image.ids, 1);
+		});
+		double all_threads = time_ms(Iterations, [&](){
+			threaded.count(ids.data(), ids.size(), image.ids);
+		});
+		if (single.counts != expected) mismatches += 1;
+		if (threaded.counts != expected) mismatches += 1;
+
+		std::cout << "id_histogram: " << image.width << "x" << image.height << ", " << image.ids << " ids" << std::endl;
+		std::cout << "  plain loop " << plain << " ms, one thread " << one_thread << " ms, "
+		          << std::max(1U, std::thread::hardware_concurrency()) << " threads " << all_threads << " ms" << std::endl;
+	}
+	std::cout << "  mismatches vs plain loop: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	return ok;
+}
+
+//hi-z occlusion test (HiZ::occluded) on synthetic depth :
+// depth is a field of random rectangles, boxes are random; with an identity world_to_clip, box coordinates are
+// already normalized device coordinates. Compares against checking every covered texel of the finest level, which
+// rejects the most; the hi-z test must never reject a box that check says is visible.
+static bool test_hiz() {
+	constexpr uint32_t Boxes = 100000;
+	bool ok = true;
+
+	std::mt19937 mt(0x15466);
+	auto rand01 = [&]() { return std::uniform_real_distribution< float >(0.0f, 1.0f)(mt); };
+
+	HiZ::Level finest;
+	finest.size = glm::uvec2(160, 90);
+	finest.depth.assign(size_t(finest.size.x) * finest.size.y, 1.0f);
+	for (uint32_t r = 0; r < 60; ++r) {
+		uint32_t x0 = uint32_t(rand01() * finest.size.x), y0 = uint32_t(rand01() * finest.size.y);
+		uint32_t x1 = std::min(finest.size.x, x0 + 1 + uint32_t(rand01() * 60.0f));
+		uint32_t y1 = std::min(finest.size.y, y0 + 1 + uint32_t(rand01() * 40.0f));
+		float depth = rand01();
+		for (uint32_t y = y0; y < y1; ++y) {
+			for (uint32_t x = x0; x < x1; ++x) {
+				finest.depth[y * finest.size.x + x] = std::min(finest.depth[y * finest.size.x + x], depth);
+			}
+		}
+	}
+	HiZ hiz;
+	hiz.levels.emplace_back(finest);
+	hiz.world_to_clip = glm::mat4(1.0f);
+	hiz.build_levels();
+
+	std::vector< std::pair< glm::vec3, glm::vec3 > > boxes;
+	for (uint32_t b = 0; b < Boxes; ++b) {
+		glm::vec3 center = glm::vec3(2.0f * rand01() - 1.0f, 2.0f * rand01() - 1.0f, 2.0f * rand01() - 1.0f);
+		glm::vec3 radius = glm::vec3(0.2f * rand01() * rand01(), 0.2f * rand01() * rand01(), 0.05f * rand01());
+		boxes.emplace_back(glm::max(center - radius, glm::vec3(-1.0f)), glm::min(center + radius, glm::vec3(1.0f)));
+	}
+
+	std::vector< bool > expected(Boxes), got(Boxes);
+	double brute = time_ms(1, [&](){
+		for (uint32_t b = 0; b < Boxes; ++b) {
+			glm::vec3 const &min = boxes[b].first, &max = boxes[b].second;
+			glm::uvec2 lo = glm::min(glm::uvec2((0.5f * glm::vec2(min) + 0.5f) * glm::vec2(finest.size)), finest.size - 1U);
+			glm::uvec2 hi = glm::min(glm::uvec2((0.5f * glm::vec2(max) + 0.5f) * glm::vec2(finest.size)), finest.size - 1U);
+			float nearest = 0.5f * min.z + 0.5f;
+			bool hidden = nearest > 0.0f;
+			for (uint32_t y = lo.y; y <= hi.y && hidden; ++y) {
+				for (uint32_t x = lo.x; x <= hi.x && hidden; ++x) {
+					if (finest.depth[y * finest.size.x + x] >= nearest) hidden = false;
+				}
+			}
+			expected[b] = hidden;
+		}
+	});
+	double pyramid = time_ms(1, [&](){
+		for (uint32_t b = 0; b < Boxes; ++b) {
+			got[b] = hiz.occluded(boxes[b].first, boxes[b].second);
+		}
+	});
+
+	uint32_t hidden = 0, rejected = 0, wrong = 0;
+	for (uint32_t b = 0; b < Boxes; ++b) {
+		if (expected[b]) hidden += 1;
+		if (got[b]) rejected += 1;
+		if (got[b] && !expected[b]) wrong += 1;
+	}
+	std::cout << "hiz: " << Boxes << " boxes against " << finest.size.x << "x" << finest.size.y << " depth (" << hiz.levels.size() << " levels)" << std::endl;
+	std::cout << "  every texel: " << brute << " ms, " << hidden << " hidden" << std::endl;
+	std::cout << "  pyramid: " << pyramid << " ms, " << rejected << " rejected" << std::endl;
+	std::cout << "  visible boxes rejected: " << wrong << mark_failed(wrong, &ok) << std::endl;
+	return ok;
+}
+
+//CPU picture counting (SoftRaster) on synthetic meshes:
+// random triangles (in clip space, so object_to_clip is the identity) are drawn on one thread and on every hardware
+// thread, at a few sizes; the two images must be identical. A full-screen quad behind everything must leave no pixel empty,
+// and test() must find a quad in front of the image visible and one behind it hidden.
+// (the same check against the game's scene, with GL-loaded meshes, is 'aperture --benchmark soft_raster')
+static bool test_soft_raster() {
+	constexpr uint32_t Meshes = 200;
+	constexpr uint32_t TrianglesPerMesh = 50;
+	constexpr uint32_t Iterations = 20;
+	bool ok = true;
+
+	std::mt19937 mt(0x15466);
+	auto rand01 = [&]() { return std::uniform_real_distribution< float >(0.0f, 1.0f)(mt); };
+
+	std::vector< std::vector< glm::vec3 > > positions(Meshes + 1);
+	for (uint32_t m = 0; m < Meshes; ++m) {
+		glm::vec3 center = glm::vec3(2.4f * rand01() - 1.2f, 2.4f * rand01() - 1.2f, 1.6f * rand01() - 0.9f);
+		for (uint32_t v = 0; v < 3 * TrianglesPerMesh; ++v) {
+			positions[m].emplace_back(center + glm::vec3(0.4f * rand01() - 0.2f, 0.4f * rand01() - 0.2f, 0.2f * rand01() - 0.1f));
+		}
+	}
+	//full-screen quad behind every triangle above:
+	auto quad = [](float z) {
+		return std::vector< glm::vec3 >{
+			glm::vec3(-1.0f,-1.0f, z), glm::vec3( 1.0f,-1.0f, z), glm::vec3( 1.0f, 1.0f, z),
+			glm::vec3(-1.0f,-1.0f, z), glm::vec3( 1.0f, 1.0f, z), glm::vec3(-1.0f, 1.0f, z),
+		};
+	};
+	positions[Meshes] = quad(0.95f);
+
+	std::vector< SoftRaster::Mesh > meshes;
+	for (auto const &p : positions) {
+		SoftRaster::Mesh mesh;
+		mesh.positions = p.data();
+		mesh.count = uint32_t(p.size());
+		mesh.id = uint32_t(meshes.size() + 1);
+		meshes.emplace_back(mesh);
+	}
+	std::cout << "soft_raster: " << Meshes << " random meshes of " << TrianglesPerMesh << " triangles, plus a background quad" << std::endl;
+
+	uint32_t mismatches = 0, empty = 0;
+	for (glm::uvec2 size : {glm::uvec2(160, 90), glm::uvec2(320, 180), glm::uvec2(640, 360)}) {
+		SoftRaster single, threaded;
+		single.size = threaded.size = size;
+		double one_thread = time_ms(Iterations, [&](){
+			single.render(meshes, 1);
+		});
+		double all_threads = time_ms(Iterations, [&](){
+			threaded.render(meshes);
+		});
+		if (single.ids != threaded.ids || single.depth != threaded.depth) mismatches += 1;
+
+		uint32_t background = 0;
+		for (uint32_t id : single.ids) {
+			if (id == 0) empty += 1;
+			if (id == Meshes + 1) background += 1;
+		}
+		std::cout << "  " << size.x << "x" << size.y << ": one thread " << one_thread << " ms, "
+		          << std::max(1U, std::thread::hardware_concurrency()) << " threads " << all_threads << " ms ("
+		          << (100.0f * background / float(single.ids.size())) << "% background)" << std::endl;
+	}
+
+	//test() against the last image drawn:
+	SoftRaster raster;
+	raster.render(meshes);
+	std::vector< glm::vec3 > front = quad(-0.99f), back = quad(0.99f);
+	std::vector< SoftRaster::Mesh > probes(2);
+	probes[0].positions = front.data();
+	probes[0].count = uint32_t(front.size());
+	probes[1].positions = back.data();
+	probes[1].count = uint32_t(back.size());
+	std::vector< bool > visible;
+	raster.test(probes, &visible);
+	bool wrong = visible.size() != 2 || !visible[0] || visible[1];
+
+	std::cout << "  thread count mismatches: " << mismatches << mark_failed(mismatches, &ok) << std::endl;
+	std::cout << "  empty pixels: " << empty << mark_failed(empty, &ok) << std::endl;
+	std::cout << "  test(): quad in front " << (visible.size() > 0 && visible[0] ? "visible" : "hidden")
+	          << ", quad behind " << (visible.size() > 1 && visible[1] ? "visible" : "hidden") << mark_failed(wrong, &ok) << std::endl;
+	return ok;
+}
+
+//background photo saving (PhotoWriter) into a scratch album in the temp folder :
+// queues a few hundred pictures, timing each save() call on this thread (which must never wait on the disk),
+// then checks every picture was written under its own name, and that a second writer picks up the numbering from the index
+static bool test_photo_writer() {
+	constexpr uint32_t Photos = 300;
+	constexpr uint32_t Titles = 5;
+	bool ok = true;
+	glm::uvec2 size = glm::uvec2(640, 360);
+
+	std::filesystem::path folder = std::filesystem::temp_directory_path() / "aperture-photo-writer-benchmark";
+	std::filesystem::remove_all(folder);
+
+	std::mt19937 mt(0x15466);
+	auto data = std::make_shared< std::vector< glm::u8vec4 > >(size_t(size.x) * size.y);
+	for (glm::u8vec4 &px : *data) {
+		px = glm::u8vec4(uint8_t(mt()), uint8_t(mt()), uint8_t(mt()), 0xff);
+	}
+
+	uint32_t failed = 0;
+	std::vector< PhotoWriter::Result > results;
+	double worst_save = 0.0, total_save = 0.0;
+	{
+		PhotoWriter writer(folder.string());
+		for (uint32_t i = 0; i < Photos; ++i) {
+			double ms = time_ms(1, [&](){
+				writer.save(std::string("Photo ") + char('A' + i % Titles), size, data);
+			});
+			worst_save = std::max(worst_save, ms);
+			total_save += ms;
+		}
+		uint32_t queued = writer.pending();
+		double flush = time_ms(1, [&](){
+			writer.flush();
+		});
+		results = writer.poll();
+		std::cout << "photo_writer: " << Photos << " pictures (" << size.x << "x" << size.y << "), " << queued << " still queued after the last save()" << std::endl;
+		std::cout << "  save(): worst " << worst_save << " ms, average " << (total_save / Photos) << " ms; flush() waited " << flush << " ms" << std::endl;
+	}
+
+	std::unordered_set< std::string > names;
+	float worker_ms = 0.0f;
+	for (auto const &result : results) {
+		worker_ms += result.ms;
+		if (!result.ok || !names.insert(result.filename).second || !std::filesystem::exists(folder / result.filename)) failed += 1;
+	}
+	if (results.size() != Photos) failed += 1;
+	std::cout << "  writer thread: " << (results.empty() ? 0.0f : worker_ms / results.size()) << " ms per picture (the hitch save() used to be)" << std::endl;
+
+	//a new writer should carry on from the index instead of reusing names:
+	{
+		PhotoWriter writer(folder.string());
+		writer.save("Photo A", glm::uvec2(1), std::make_shared< std::vector< glm::u8vec4 > >(1, glm::u8vec4(0x80)));
+		writer.flush();
+		std::vector< PhotoWriter::Result > more = writer.poll();
+		std::string expected = "Photo A" + std::to_string(Photos / Titles) + ".png";
+		if (more.size() != 1 || !more[0].ok || more[0].filename != expected) {
+			failed += 1;
+			std::cout << "  reopened album wrote '" << (more.empty() ? "" : more[0].filename) << "', expected '" << expected << "'" << std::endl;
+		}
+	}
+	std::filesystem::remove_all(folder);
+
+	std::cout << "  missing, failed, or duplicate saves: " << failed << mark_failed(failed || worst_save > 5.0, &ok) << std::endl;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	struct Test {
+		char const *name;
+		std::function< bool() > run; //false if a check failed
+	};
+	static std::vector< Test > const tests = {
+		{"transforms", test_transforms},
+		{"scene", test_scene},
+		{"bvh", test_bvh},
+		{"render_queue", test_render_queue},
+		{"id_histogram", test_id_histogram},
+		{"hiz", test_hiz},
+		{"soft_raster", test_soft_raster},
+		{"photo_writer", test_photo_writer},
+	};
+
+	std::vector< std::string > names(argv + 1, argv + argc);
+	for (auto const &name : names) {
+		if (std::none_of(tests.begin(), tests.end(), [&](Test const &t) { return name == t.name; })) {
+			std::cerr << "Unknown test '" << name << "'; available:";
+			for (auto const &t : tests) {
+				std::cerr << " " << t.name;
+			}
+			std::cerr << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector< std::string > failed;
+	for (auto const &t : tests) {
+		if (!names.empty() && std::find(names.begin(), names.end(), t.name) == names.end()) continue;
+		if (!t.run()) failed.emplace_back(t.name);
+	}
+
+	if (!failed.empty()) {
+		std::cerr << failed.size() << " test(s) failed:";
+		for (auto const &name : failed) {
+			std::cerr << " " << name;
+		}
+		std::cerr << std::endl;
+		return 1;
+	}
+	return 0;
+}